@@ -0,0 +1,250 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <numeric>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+
+CameraPath CameraPath::Load(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file)
+		throw std::runtime_error("Could not open camera path " + path);
+
+	CameraPath cameraPath;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		CameraPathSegment segment;
+		std::istringstream stream(line);
+		if (!(stream >> segment.frameCount >> segment.forward >> segment.right
+			>> segment.up >> segment.turn))
+			throw std::runtime_error("Invalid camera path segment: " + line);
+
+		cameraPath.segments.push_back(segment);
+		cameraPath.totalFrameCount += segment.frameCount;
+	}
+
+	if (cameraPath.totalFrameCount == 0)
+		throw std::runtime_error("Camera path " + path + " has no frames");
+
+	return cameraPath;
+}
+
+CameraPath CameraPath::Orbit(float radius, unsigned int frameCount)
+{
+	// Every frame moves along the chord to the next point of the circle, which points half the
+	// angle towards the centre, then turns left by the angle to face the centre again
+	const float angle = 2.0f * 3.14159265f / frameCount;
+	const float chord = 2.0f * radius * std::sin(angle / 2.0f);
+	CameraPathSegment segment;
+	segment.frameCount = frameCount;
+	segment.forward = chord * std::sin(angle / 2.0f);
+	segment.right = chord * std::cos(angle / 2.0f);
+	segment.turn = -angle;
+
+	CameraPath cameraPath;
+	cameraPath.segments.push_back(segment);
+	cameraPath.totalFrameCount = frameCount;
+	return cameraPath;
+}
+
+void CameraPath::Apply(Camera* camera, unsigned int frame) const
+{
+	frame %= totalFrameCount;
+	for (const CameraPathSegment& segment : segments)
+	{
+		if (frame >= segment.frameCount)
+		{
+			frame -= segment.frameCount;
+			continue;
+		}
+
+		camera->MoveForward(segment.forward);
+		camera->MoveRight(segment.right);
+		camera->MoveUp(segment.up);
+		camera->RotateY(segment.turn);
+		return;
+	}
+}
+
+MetricSummary Summarise(std::vector<double> samples)
+{
+	MetricSummary summary;
+	if (samples.empty())
+		return summary;
+
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&](double fraction) {
+		size_t rank = static_cast<size_t>(std::ceil(fraction * samples.size()));
+		return samples[std::max<size_t>(rank, 1) - 1];
+	};
+
+	summary.sampleCount = static_cast<unsigned int>(samples.size());
+	summary.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+	summary.p50 = percentile(0.50);
+	summary.p95 = percentile(0.95);
+	summary.p99 = percentile(0.99);
+	summary.max = samples.back();
+	return summary;
+}
+
+const std::pair<const char*, MetricSummary BenchmarkResults::*> METRICS[] =
+{
+	{ "frameTime", &BenchmarkResults::frameTime },
+	{ "cpuRecordTime", &BenchmarkResults::cpuRecordTime },
+	{ "gpuTime", &BenchmarkResults::gpuTime },
+};
+
+bool WriteBenchmarkJson(const std::string& path, const BenchmarkResults& results)
+{
+	std::ofstream file(path);
+	if (!file)
+		return false;
+
+	file << "{\n\t\"configuration\": {";
+	for (size_t i = 0; i < results.configuration.size(); ++i)
+	{
+		file << (i == 0 ? "\n" : ",\n") << "\t\t\"" << results.configuration[i].first
+			<< "\": \"" << results.configuration[i].second << "\"";
+	}
+	file << "\n\t}";
+
+	for (const auto& [name, metric] : METRICS)
+	{
+		const MetricSummary& summary = results.*metric;
+		file << ",\n\t\"" << name << "\": {\"samples\": " << summary.sampleCount
+			<< ", \"mean\": " << summary.mean << ", \"p50\": " << summary.p50
+			<< ", \"p95\": " << summary.p95 << ", \"p99\": " << summary.p99
+			<< ", \"max\": " << summary.max << "}";
+	}
+	file << "\n}\n";
+
+	return static_cast<bool>(file);
+}
+
+bool WriteBenchmarkCsv(const std::string& path, const BenchmarkResults& results)
+{
+	std::ofstream file(path);
+	if (!file)
+		return false;
+
+	file << "metric,samples,mean,p50,p95,p99,max\n";
+	for (const auto& [name, metric] : METRICS)
+	{
+		const MetricSummary& summary = results.*metric;
+		file << name << "," << summary.sampleCount << "," << summary.mean << ","
+			<< summary.p50 << "," << summary.p95 << "," << summary.p99 << ","
+			<< summary.max << "\n";
+	}
+
+	return static_cast<bool>(file);
+}
+
+// Only understands the files written by WriteBenchmarkJson, where every metric is a flat object
+std::optional<double> findBaselineValue(const std::string& json, const std::string& metric,
+	const std::string& statistic)
+{
+	size_t metricBegin = json.find("\"" + metric + "\"");
+	if (metricBegin == std::string::npos)
+		return std::nullopt;
+
+	size_t metricEnd = json.find('}', metricBegin);
+	size_t valueBegin = json.find("\"" + statistic + "\":", metricBegin);
+	if (valueBegin == std::string::npos || valueBegin > metricEnd)
+		return std::nullopt;
+
+	valueBegin += statistic.size() + 3;
+	return std::strtod(json.c_str() + valueBegin, nullptr);
+}
+
+// Only understands the files written by WriteBenchmarkJson, where every configuration value is a
+// string without quotes in it. Empty if the file has no configuration
+std::vector<std::pair<std::string, std::string>> findBaselineConfiguration(
+	const std::string& json)
+{
+	std::vector<std::pair<std::string, std::string>> configuration;
+	size_t position = json.find("\"configuration\": {");
+	if (position == std::string::npos)
+		return configuration;
+
+	const size_t end = json.find('}', position);
+	position = json.find('{', position) + 1;
+	while (true)
+	{
+		// Every entry is "key": "value"
+		size_t quotes[4];
+		for (size_t& quote : quotes)
+		{
+			quote = json.find('"', position);
+			if (quote == std::string::npos || quote > end)
+				return configuration;
+			position = quote + 1;
+		}
+
+		configuration.emplace_back(json.substr(quotes[0] + 1, quotes[1] - quotes[0] - 1),
+			json.substr(quotes[2] + 1, quotes[3] - quotes[2] - 1));
+	}
+}
+
+std::vector<std::string> FindRegressions(const BenchmarkResults& results,
+	const std::string& baselinePath, double tolerance)
+{
+	std::ifstream file(baselinePath);
+	if (!file)
+		throw std::runtime_error("Could not open baseline " + baselinePath);
+	std::stringstream contents;
+	contents << file.rdbuf();
+	const std::string json = contents.str();
+
+	// Timings of e.g. a different grid size or renderer say nothing about this run
+	const std::vector<std::pair<std::string, std::string>> baselineConfiguration =
+		findBaselineConfiguration(json);
+	for (const auto& [key, value] : results.configuration)
+	{
+		auto baselineEntry = std::find_if(baselineConfiguration.begin(),
+			baselineConfiguration.end(), [&](const auto& entry) { return entry.first == key; });
+		if (baselineEntry == baselineConfiguration.end())
+			throw std::runtime_error("Baseline " + baselinePath + " has no " + key);
+		if (baselineEntry->second != value)
+			throw std::runtime_error("Baseline " + baselinePath + " has " + key + " "
+				+ baselineEntry->second + " but this run has " + value);
+	}
+
+	std::vector<std::string> regressions;
+	for (const auto& [name, metric] : METRICS)
+	{
+		// E.g. GPU time on a renderer that can't measure it
+		const MetricSummary& summary = results.*metric;
+		std::optional<double> baselineSamples = findBaselineValue(json, name, "samples");
+		if (summary.sampleCount == 0 || !baselineSamples || *baselineSamples == 0.0)
+			continue;
+
+		const std::pair<const char*, double> percentiles[] =
+		{
+			{ "p50", summary.p50 },
+			{ "p95", summary.p95 },
+			{ "p99", summary.p99 },
+		};
+		for (const auto& [statistic, value] : percentiles)
+		{
+			std::optional<double> baseline = findBaselineValue(json, name, statistic);
+			if (!baseline || value <= *baseline * (1.0 + tolerance))
+				continue;
+
+			std::ostringstream regression;
+			regression << name << " " << statistic << " " << value << " ms, baseline "
+				<< *baseline << " ms";
+			regressions.push_back(regression.str());
+		}
+	}
+
+	return regressions;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Camera.h"
+
+// Applied once per frame for frameCount frames. Movement is per frame instead of per second, so
+// every run renders exactly the same views no matter how fast it is
+struct CameraPathSegment
+{
+	unsigned int frameCount = 0;
+	float forward = 0.0f;
+	float right = 0.0f;
+	float up = 0.0f;
+	float turn = 0.0f; // Radians, positive turns right
+};
+
+class CameraPath
+{
+private:
+	std::vector<CameraPathSegment> segments;
+	unsigned int totalFrameCount = 0;
+
+public:
+	// One segment per line as "frameCount forward right up turn". Empty lines and lines starting
+	// with # are skipped. Throws if the file can't be read or has no frames
+	static CameraPath Load(const std::string& path);
+	// Circles the point radius in front of the camera once every frameCount frames, facing it
+	static CameraPath Orbit(float radius, unsigned int frameCount);
+
+	// Starts over once the path has ended
+	void Apply(Camera* camera, unsigned int frame) const;
+};
+
+struct MetricSummary
+{
+	unsigned int sampleCount = 0;
+	double mean = 0.0;
+	double p50 = 0.0;
+	double p95 = 0.0;
+	double p99 = 0.0;
+	double max = 0.0;
+};
+
+// Nearest-rank percentiles, all zero without samples
+MetricSummary Summarise(std::vector<double> samples);
+
+struct BenchmarkResults
+{
+	// Written as strings, so that runs with different settings are told apart
+	std::vector<std::pair<std::string, std::string>> configuration;
+	// In milliseconds. Frame time is a whole iteration of the frame loop, CPU record time is the
+	// renderer's recording without waiting for the GPU or the swapchain, see
+	// RendererVulkan::GetCpuRecordTime, and GPU time is the GPU's "Frame" region. Renderers that
+	// can't measure a metric leave it without samples
+	MetricSummary frameTime;
+	MetricSummary cpuRecordTime;
+	MetricSummary gpuTime;
+};
+
+bool WriteBenchmarkJson(const std::string& path, const BenchmarkResults& results);
+// One row per metric
+bool WriteBenchmarkCsv(const std::string& path, const BenchmarkResults& results);
+// Reads a file written by WriteBenchmarkJson and returns one line per percentile that is more
+// than tolerance (0.1 for 10%) slower than in it. The max is too noisy to compare. Throws if the
+// baseline can't be read or its configuration differs from the one of results
+std::vector<std::string> FindRegressions(const BenchmarkResults& results,
+	const std::string& baselinePath, double tolerance);
@@ -12,7 +12,10 @@ enum class PerFrameWritePattern
 enum BufferBinding
 {
 	STRUCTURED_BUFFER = 1,
-	CONSTANT_BUFFER = 2
+	CONSTANT_BUFFER = 2,
+	// Mesh data, may be placed in a shared geometry buffer by backends that support it
+	VERTEX_BUFFER = 4,
+	INDEX_BUFFER = 8
 };
 
 class BufferManager : public ResourceManager
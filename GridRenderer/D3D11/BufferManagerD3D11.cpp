@@ -1,5 +1,7 @@
 #include "BufferManagerD3D11.h"
 
+#include "../Profiler.h"
+
 bool BufferManagerD3D11::DetermineUsage(PerFrameWritePattern cpuWrite,
 	PerFrameWritePattern gpuWrite, D3D11_USAGE& usage)
 {
@@ -101,6 +103,7 @@ ResourceIndex BufferManagerD3D11::AddBuffer(void* data,
 	PerFrameWritePattern cpuWrite, PerFrameWritePattern gpuWrite,
 	unsigned int bindingFlags)
 {
+	PROFILE_ZONE("AddBuffer");
 	D3D11_BUFFER_DESC desc;
 	bool result = CreateDescription(elementSize, nrOfElements,
 		cpuWrite, gpuWrite, bindingFlags, desc);
@@ -3,6 +3,8 @@
 #include <stdexcept>
 #include <SDL2/SDL_syswm.h>
 
+#include "../Profiler.h"
+
 void RendererD3D11::CreateBasicInterfaces(SDL_Window* window)
 {
 	DXGI_SWAP_CHAIN_DESC swapChainDesc = {};
@@ -264,6 +266,7 @@ RendererD3D11::~RendererD3D11()
 GraphicsRenderPass* RendererD3D11::CreateGraphicsRenderPass(
 	const GraphicsRenderPassInfo& intialisationInfo)
 {
+	PROFILE_ZONE("CreateGraphicsRenderPass");
 	return new GraphicsRenderPassD3D11(device, intialisationInfo);
 }
 
@@ -314,6 +317,7 @@ void RendererD3D11::SetLightBuffer(ResourceIndex lightBufferIndexToUse)
 
 void RendererD3D11::PreRender()
 {
+	PROFILE_ZONE("PreRender");
 	float clearColour[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
 	immediateContext->ClearRenderTargetView(backBufferRTV, clearColour);
 	immediateContext->ClearDepthStencilView(depthBufferDSV, D3D11_CLEAR_DEPTH, 1.0f, 0);
@@ -324,6 +328,7 @@ void RendererD3D11::PreRender()
 
 void RendererD3D11::Render(const std::vector<RenderObject>& objectsToRender)
 {
+	PROFILE_ZONE("Render");
 	currentRenderPass->SetShaders(immediateContext);
 	const std::vector<PipelineBinding>& objectBindings = currentRenderPass->GetObjectBindings();
 	const std::vector<PipelineBinding>& globalBindings = currentRenderPass->GetGlobalBindings();
@@ -349,5 +354,6 @@ void RendererD3D11::Render(const std::vector<RenderObject>& objectsToRender)
 
 void RendererD3D11::Present()
 {
+	PROFILE_ZONE("Present");
 	swapChain->Present(0, 0);
 }
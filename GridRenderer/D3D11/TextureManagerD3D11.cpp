@@ -1,5 +1,7 @@
 #include "TextureManagerD3D11.h"
 
+#include "../Profiler.h"
+
 bool TextureManagerD3D11::TranslateFormatInfo(const FormatInfo& formatInfo,
 	DXGI_FORMAT& toSet)
 {
@@ -151,6 +153,7 @@ void TextureManagerD3D11::Initialise(ID3D11Device* deviceToUse)
 ResourceIndex TextureManagerD3D11::AddTexture(void* textureData,
 	const TextureInfo& textureInfo)
 {
+	PROFILE_ZONE("AddTexture");
 	D3D11_TEXTURE2D_DESC desc;
 	bool result = CreateDescription(textureInfo, desc);
 	if (result == false)
@@ -17,7 +17,13 @@ enum class PipelineDataType
 	INDEX,
 	DIFFUSE,
 	SPECULAR,
-	SAMPLER
+	SAMPLER,
+	// Renderers that draw every object with one texture array instead of binding textures per
+	// object: the material ID of every object, the texture array and the material table that
+	// maps material IDs to textures in the array
+	MATERIAL_ID,
+	TEXTURE_ARRAY,
+	MATERIAL_TABLE
 };
 
 enum class PipelineBindingType
@@ -43,10 +49,29 @@ struct PipelineBinding
 	std::uint8_t slotToBindTo = std::uint8_t(-1);
 };
 
+enum DrawFlags : std::uint32_t
+{
+	DRAW_FLAG_NONE = 0,
+	DRAW_FLAG_MATERIAL_OVERRIDE = 1 << 0, // Draw every object with materialOverride
+	DRAW_FLAG_UNLIT = 1 << 1, // Output the diffuse texture without lighting
+};
+
+// Small values that the Vulkan renderer pushes with the draws of a pass instead of going through
+// descriptor sets. Taken when the objects are rendered, so they can change between the draws of
+// one pass. Renderers without push constants ignore them
+struct DrawParameters
+{
+	SurfaceProperty materialOverride;
+	std::uint32_t flags = DRAW_FLAG_NONE;
+};
+
 struct GraphicsRenderPassInfo
 {
 	std::string vsPath = "";
 	std::string psPath = "";
+	// Position-only variant of the vertex shader for renderers with a depth prepass. Passes
+	// without one are left out of the prepass
+	std::string depthVsPath = "";
 	std::vector<PipelineBinding> objectBindings;
 	std::vector<PipelineBinding> globalBindings;
 };
@@ -54,6 +79,7 @@ struct GraphicsRenderPassInfo
 class GraphicsRenderPass
 {
 protected:
+	DrawParameters drawParameters;
 
 public:
 	GraphicsRenderPass() = default;
@@ -65,4 +91,14 @@ public:
 
 	virtual void SetGlobalSampler(PipelineShaderStage shader,
 		std::uint8_t slot, ResourceIndex index) = 0;
+
+	void SetDrawParameters(const DrawParameters& parameters)
+	{
+		drawParameters = parameters;
+	}
+
+	const DrawParameters& GetDrawParameters() const
+	{
+		return drawParameters;
+	}
 };
\ No newline at end of file
@@ -1,9 +1,16 @@
 #include <stdexcept>
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
 #include <SDL2/SDL.h>
 
+#include "Benchmark.h"
+#include "Profiler.h"
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -26,6 +33,15 @@ struct Inputs
     bool turnRightPushed = false;
 
     bool quitKey = false;
+
+    // Toggled with C
+    bool frustumCulling = true;
+    // Toggled with O
+    bool occlusionCulling = true;
+    // Toggled with P
+    bool depthPrepass = false;
+    // Toggled with L
+    bool unlit = false;
 } globalInputs;
 
 struct SimpleVertex
@@ -41,6 +57,184 @@ struct PointLight
     float colour[3] = { 1.0f, 1.0f, 1.0f };
 };
 
+struct LaunchOptions
+{
+    // 1 for lowest latency, 2 for double buffering, 3 for triple, etc.
+    unsigned int framesInFlight = 2;
+    // Render into offscreen images without opening a window
+    bool headless = false;
+    // Number of frames to render before exiting, 0 to run until the window is closed
+    unsigned int frameCount = 0;
+    // fifo, mailbox or immediate. The latter two do not cap the frame rate to the refresh rate
+    std::string presentMode = "fifo";
+    // Generate the draws on the GPU instead of sorting and recording them on the CPU
+    bool gpuDriven = false;
+    // Initial state, can be toggled at runtime
+    bool frustumCulling = true;
+    // Initial state, can be toggled at runtime. Only used by GPU-driven rendering
+    bool occlusionCulling = true;
+    // Initial state, can be toggled at runtime. Only supported by the Vulkan renderer
+    bool depthPrepass = false;
+    // Log the GPU time of every region of every frame. Only supported by the Vulkan renderer
+    bool gpuTimings = false;
+    // Write the CPU zones of the frames below as a Chrome trace. Frame 0 includes startup
+    std::string tracePath;
+    unsigned int traceFirstFrame = 0;
+    unsigned int traceFrameCount = 10;
+    // The pyramid is this many blocks high, and the ground grows with it
+    int gridDimension = 5;
+    // Spread evenly around the grid
+    unsigned int lightCount = 4;
+    // Follow a scripted camera path without input, then write frame time percentiles
+    bool benchmark = false;
+    // See CameraPath::Load, orbits the grid once over the measured frames when empty
+    std::string cameraPath;
+    // Not measured, so that caches and clocks have settled
+    unsigned int warmupFrames = 60;
+    unsigned int measuredFrames = 600;
+    std::string benchmarkJsonPath;
+    std::string benchmarkCsvPath;
+    // JSON written by an earlier run. Slower percentiles make the exit status nonzero
+    std::string baselinePath;
+    // Fraction that a percentile may be slower than the baseline
+    double regressionTolerance = 0.1;
+};
+
+LaunchOptions ParseLaunchOptions(int argc, char* argv[])
+{
+    LaunchOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string argument = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (argument == "--frames-in-flight" && hasValue)
+            options.framesInFlight = std::stoi(argv[++i]);
+        else if (argument == "--headless")
+            options.headless = true;
+        else if (argument == "--frames" && hasValue)
+            options.frameCount = std::stoi(argv[++i]);
+        else if (argument == "--present-mode" && hasValue)
+            options.presentMode = argv[++i];
+        else if (argument == "--gpu-driven")
+            options.gpuDriven = true;
+        else if (argument == "--no-frustum-culling")
+            options.frustumCulling = false;
+        else if (argument == "--no-occlusion-culling")
+            options.occlusionCulling = false;
+        else if (argument == "--depth-prepass")
+            options.depthPrepass = true;
+        else if (argument == "--gpu-timings")
+            options.gpuTimings = true;
+        else if (argument == "--trace" && hasValue)
+            options.tracePath = argv[++i];
+        else if (argument == "--trace-first-frame" && hasValue)
+            options.traceFirstFrame = std::stoi(argv[++i]);
+        else if (argument == "--trace-frame-count" && hasValue)
+            options.traceFrameCount = std::stoi(argv[++i]);
+        else if (argument == "--grid-dimension" && hasValue)
+            options.gridDimension = std::stoi(argv[++i]);
+        else if (argument == "--light-count" && hasValue)
+            options.lightCount = std::stoi(argv[++i]);
+        else if (argument == "--benchmark")
+            options.benchmark = true;
+        else if (argument == "--camera-path" && hasValue)
+            options.cameraPath = argv[++i];
+        else if (argument == "--warmup-frames" && hasValue)
+            options.warmupFrames = std::stoi(argv[++i]);
+        else if (argument == "--measured-frames" && hasValue)
+            options.measuredFrames = std::stoi(argv[++i]);
+        else if (argument == "--benchmark-json" && hasValue)
+            options.benchmarkJsonPath = argv[++i];
+        else if (argument == "--benchmark-csv" && hasValue)
+            options.benchmarkCsvPath = argv[++i];
+        else if (argument == "--baseline" && hasValue)
+            options.baselinePath = argv[++i];
+        else if (argument == "--regression-tolerance" && hasValue)
+            options.regressionTolerance = std::stod(argv[++i]);
+        else
+            throw std::runtime_error("Unknown or incomplete argument " + argument);
+    }
+
+    if (options.presentMode != "fifo" && options.presentMode != "mailbox"
+        && options.presentMode != "immediate")
+        throw std::runtime_error("Unknown present mode " + options.presentMode);
+
+    if (options.framesInFlight == 0)
+        throw std::runtime_error("At least one frame has to be in flight");
+
+#ifndef PROFILER_ENABLED
+    if (!options.tracePath.empty())
+        throw std::runtime_error("--trace requires a debug build or ENABLE_PROFILER");
+#endif
+
+    if (options.traceFrameCount == 0)
+        throw std::runtime_error("At least one frame has to be traced");
+
+    if (options.gridDimension < 1)
+        throw std::runtime_error("The grid needs a dimension of at least 1");
+
+    if (options.lightCount == 0)
+        throw std::runtime_error("At least one light is needed");
+
+    if (options.benchmark)
+    {
+        if (options.frameCount != 0)
+            throw std::runtime_error("--benchmark sets the frame count, use --measured-frames");
+        if (options.measuredFrames == 0)
+            throw std::runtime_error("At least one frame has to be measured");
+
+        // GPU results arrive frames in flight later, so render that many more afterwards
+        options.frameCount = options.warmupFrames + options.measuredFrames
+            + options.framesInFlight;
+    }
+    else if (!options.cameraPath.empty() || !options.benchmarkJsonPath.empty()
+        || !options.benchmarkCsvPath.empty() || !options.baselinePath.empty())
+    {
+        throw std::runtime_error("Camera paths and benchmark results require --benchmark");
+    }
+
+    // There is no window to close, so it would never exit
+    if (options.headless && options.frameCount == 0)
+        throw std::runtime_error("--headless requires --frames");
+
+    return options;
+}
+
+#ifdef PROFILER_ENABLED
+void ExportTrace(const LaunchOptions& options)
+{
+    const unsigned int lastFrame = options.traceFirstFrame + options.traceFrameCount - 1;
+    if (ProfilerExportChromeTrace(options.tracePath, options.traceFirstFrame, lastFrame))
+        std::cout << "Wrote trace of frames " << options.traceFirstFrame << " to " << lastFrame
+            << " to " << options.tracePath << std::endl;
+    else
+        std::cout << "Couldn't write trace to " << options.tracePath << std::endl;
+}
+#endif
+
+#ifdef USE_VULKAN
+// One line per frame, regions are indented by how deep they are nested
+void LogGpuFrameStatistics(const GpuFrameStatistics& statistics)
+{
+    std::cout << "GPU frame " << statistics.frame << ":";
+    for (const GpuRegionTiming& region : statistics.regions)
+    {
+        std::cout << " " << std::string(region.depth, '>') << region.name << " "
+            << region.milliseconds << " ms";
+    }
+    if (statistics.hasPipelineStatistics)
+    {
+        const GpuPipelineStatistics& pipeline = statistics.pipelineStatistics;
+        std::cout << " | " << pipeline.vertexShaderInvocations << " vertex invocations, "
+            << pipeline.clippingInvocations << " primitives clipped into "
+            << pipeline.clippingPrimitives << ", "
+            << pipeline.fragmentShaderInvocations << " fragment invocations";
+    }
+    std::cout << std::endl;
+}
+#endif
+
 void HandleKeyEvent(SDL_Keysym sym, bool value)
 {
     switch (sym.sym)
@@ -72,6 +266,22 @@ void HandleKeyEvent(SDL_Keysym sym, bool value)
     case SDLK_e:
         globalInputs.turnRightPushed = value;
         break;
+    case SDLK_c:
+        if (value)
+            globalInputs.frustumCulling = !globalInputs.frustumCulling;
+        break;
+    case SDLK_o:
+        if (value)
+            globalInputs.occlusionCulling = !globalInputs.occlusionCulling;
+        break;
+    case SDLK_p:
+        if (value)
+            globalInputs.depthPrepass = !globalInputs.depthPrepass;
+        break;
+    case SDLK_l:
+        if (value)
+            globalInputs.unlit = !globalInputs.unlit;
+        break;
     }
 }
 
@@ -83,7 +293,7 @@ SDL_Window* InitialiseWindow(unsigned int windowWidth,
         windowFlags |= SDL_WINDOW_FULLSCREEN;
     }
 #ifdef USE_VULKAN
-  windowFlags |= SDL_WINDOW_VULKAN;
+  windowFlags |= SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE;
 #endif
 
     SDL_Init(SDL_INIT_VIDEO);
@@ -101,6 +311,7 @@ GraphicsRenderPass* CreateStandardRenderPass(Renderer* renderer)
     #elif USE_VULKAN
     info.vsPath = SHADER_ROOT_DIR "shaders/Standard.vert.spv";
     info.psPath = SHADER_ROOT_DIR "shaders/Standard.frag.spv";
+    info.depthVsPath = SHADER_ROOT_DIR "shaders/StandardDepth.vert.spv";
     #endif
 
     PipelineBinding vertexBinding;
@@ -131,6 +342,7 @@ GraphicsRenderPass* CreateStandardRenderPass(Renderer* renderer)
     vpBinding.slotToBindTo = 1;
     info.globalBindings.push_back(vpBinding);
 
+    #ifdef USE_D3D11
     PipelineBinding diffuseTextureBinding;
     diffuseTextureBinding.dataType = PipelineDataType::DIFFUSE;
     diffuseTextureBinding.bindingType = PipelineBindingType::SHADER_RESOURCE;
@@ -144,6 +356,29 @@ GraphicsRenderPass* CreateStandardRenderPass(Renderer* renderer)
     specularTextureBinding.shaderStage = PipelineShaderStage::PS;
     specularTextureBinding.slotToBindTo = 1;
     info.objectBindings.push_back(specularTextureBinding);
+    #elif USE_VULKAN
+    // The Vulkan shaders look up both textures of an object through its material ID
+    PipelineBinding materialIdBinding;
+    materialIdBinding.dataType = PipelineDataType::MATERIAL_ID;
+    materialIdBinding.bindingType = PipelineBindingType::SHADER_RESOURCE;
+    materialIdBinding.shaderStage = PipelineShaderStage::VS;
+    materialIdBinding.slotToBindTo = 2;
+    info.objectBindings.push_back(materialIdBinding);
+
+    PipelineBinding textureArrayBinding;
+    textureArrayBinding.dataType = PipelineDataType::TEXTURE_ARRAY;
+    textureArrayBinding.bindingType = PipelineBindingType::SHADER_RESOURCE;
+    textureArrayBinding.shaderStage = PipelineShaderStage::PS;
+    textureArrayBinding.slotToBindTo = 0;
+    info.globalBindings.push_back(textureArrayBinding);
+
+    PipelineBinding materialTableBinding;
+    materialTableBinding.dataType = PipelineDataType::MATERIAL_TABLE;
+    materialTableBinding.bindingType = PipelineBindingType::SHADER_RESOURCE;
+    materialTableBinding.shaderStage = PipelineShaderStage::PS;
+    materialTableBinding.slotToBindTo = 1;
+    info.globalBindings.push_back(materialTableBinding);
+    #endif
 
     PipelineBinding lightBufferBinding;
     lightBufferBinding.dataType = PipelineDataType::LIGHT;
@@ -190,7 +425,7 @@ bool CreateTriangleMesh(Mesh& mesh, Renderer* renderer)
     ResourceIndex verticesIndex = renderer->GetBufferManager()->AddBuffer(
         vertices, sizeof(SimpleVertex), std::size(vertices),
         PerFrameWritePattern::NEVER, PerFrameWritePattern::NEVER,
-        BufferBinding::STRUCTURED_BUFFER);
+        BufferBinding::STRUCTURED_BUFFER | BufferBinding::VERTEX_BUFFER);
 
     if (verticesIndex == ResourceIndex(-1))
         return false;
@@ -200,7 +435,7 @@ bool CreateTriangleMesh(Mesh& mesh, Renderer* renderer)
     ResourceIndex indicesIndex = renderer->GetBufferManager()->AddBuffer(
         indices, sizeof(unsigned int), std::size(indices),
         PerFrameWritePattern::NEVER, PerFrameWritePattern::NEVER,
-        BufferBinding::STRUCTURED_BUFFER);
+        BufferBinding::STRUCTURED_BUFFER | BufferBinding::INDEX_BUFFER);
 
     if (indicesIndex == ResourceIndex(-1))
         return false;
@@ -250,7 +485,7 @@ bool CreateCubeMesh(Mesh& mesh, Renderer* renderer)
     ResourceIndex verticesIndex = renderer->GetBufferManager()->AddBuffer(
         vertices, sizeof(SimpleVertex), std::size(vertices),
         PerFrameWritePattern::NEVER, PerFrameWritePattern::NEVER,
-        BufferBinding::STRUCTURED_BUFFER);
+        BufferBinding::STRUCTURED_BUFFER | BufferBinding::VERTEX_BUFFER);
 
     if (verticesIndex == ResourceIndex(-1))
         return false;
@@ -271,7 +506,8 @@ bool CreateCubeMesh(Mesh& mesh, Renderer* renderer)
 
     ResourceIndex indicesIndex = renderer->GetBufferManager()->AddBuffer(
         indices, sizeof(unsigned int), NR_OF_INDICES, PerFrameWritePattern::NEVER,
-        PerFrameWritePattern::NEVER, BufferBinding::STRUCTURED_BUFFER);
+        PerFrameWritePattern::NEVER,
+        BufferBinding::STRUCTURED_BUFFER | BufferBinding::INDEX_BUFFER);
 
     if (indicesIndex == ResourceIndex(-1))
         return false;
@@ -285,6 +521,7 @@ bool CreateCubeMesh(Mesh& mesh, Renderer* renderer)
 bool LoadTexture(ResourceIndex& toSet,
     Renderer* renderer, std::string filePath, unsigned int components)
 {
+    PROFILE_ZONE("LoadTexture");
     filePath = CONTENT_ROOT_DIR + filePath;
     int width, height;
     unsigned char* imageData = stbi_load(filePath.c_str(),
@@ -364,19 +601,29 @@ bool LoadSurfacePropertyFiles(SurfaceProperty& surfaceProperties,
     return true;
 }
 
-bool CreateLights(ResourceIndex& toSet, Renderer* renderer, float offset)
+bool CreateLights(ResourceIndex& toSet, Renderer* renderer, float offset,
+    unsigned int lightCount)
 {
-    float height = offset / 2.0f;
-    PointLight lights[4] =
+    // Four lights are placed on the axes, in these colours
+    const float colours[4][3] =
     {
-        {{ -offset, height, 0.0f }, { 1.0f, 0.0f, 0.0f }},
-        {{ offset, height, 0.0f }, { 0.0f, 0.0f, 1.0f }},
-        {{ 0.0f, height, -offset }, { 1.0f, 1.0f, 1.0f }},
-        {{ 0.0f, height, offset }, { 0.0f, 1.0f, 0.0f }}
+        { 0.0f, 0.0f, 1.0f },
+        { 0.0f, 1.0f, 0.0f },
+        { 1.0f, 0.0f, 0.0f },
+        { 1.0f, 1.0f, 1.0f }
     };
 
-    toSet = renderer->GetBufferManager()->AddBuffer(lights,
-        sizeof(PointLight), 4, PerFrameWritePattern::NEVER,
+    float height = offset / 2.0f;
+    std::vector<PointLight> lights(lightCount);
+    for (unsigned int i = 0; i < lightCount; ++i)
+    {
+        float angle = 2.0f * 3.14159265f * i / lightCount;
+        lights[i] = {{ offset * std::cos(angle), height, offset * std::sin(angle) },
+            { colours[i % 4][0], colours[i % 4][1], colours[i % 4][2] }};
+    }
+
+    toSet = renderer->GetBufferManager()->AddBuffer(lights.data(),
+        sizeof(PointLight), lightCount, PerFrameWritePattern::NEVER,
         PerFrameWritePattern::NEVER, BufferBinding::STRUCTURED_BUFFER);
 
     return toSet != ResourceIndex(-1);
@@ -503,52 +750,103 @@ bool PlaceBlocks(std::vector<RenderObject>& toStoreIn, Renderer* renderer, int h
 }
 
 int main(int argc, char* argv[]) {
+    LaunchOptions options = ParseLaunchOptions(argc, argv);
+    PROFILE_THREAD_NAME("Main");
+    auto startupBegin = std::chrono::steady_clock::now();
+
     const unsigned int WINDOW_WIDTH = 1280;
     const unsigned int WINDOW_HEIGHT = 720;
-    SDL_Window* windowHandle = InitialiseWindow(WINDOW_WIDTH, WINDOW_HEIGHT);
+    SDL_Window* windowHandle = nullptr;
+    if (!options.headless)
+        windowHandle = InitialiseWindow(WINDOW_WIDTH, WINDOW_HEIGHT);
 
     Renderer* renderer;
 #ifdef USE_VULKAN
-    renderer = new RendererVulkan(windowHandle);
+    if (options.headless)
+        renderer = new RendererVulkan(WINDOW_WIDTH, WINDOW_HEIGHT, options.framesInFlight);
+    else
+    {
+        PresentMode presentMode = PresentMode::FIFO;
+        if (options.presentMode == "mailbox")
+            presentMode = PresentMode::MAILBOX;
+        else if (options.presentMode == "immediate")
+            presentMode = PresentMode::IMMEDIATE;
+        renderer = new RendererVulkan(windowHandle, options.framesInFlight, presentMode);
+    }
+    static_cast<RendererVulkan*>(renderer)->SetGpuDrivenRendering(options.gpuDriven);
 #elif USE_D3D11
+    if (options.headless)
+        throw std::runtime_error("Headless rendering is only supported by the Vulkan renderer");
+    if (options.gpuDriven)
+        throw std::runtime_error("GPU-driven rendering is only supported by the Vulkan renderer");
+    if (options.depthPrepass)
+        throw std::runtime_error("The depth prepass is only supported by the Vulkan renderer");
+    if (options.gpuTimings)
+        throw std::runtime_error("GPU timings are only supported by the Vulkan renderer");
     renderer = new RendererD3D11(windowHandle);
 #endif
 
     GraphicsRenderPass* standardPass = CreateStandardRenderPass(renderer);
 
-    const int DIMENSION = 5;
+    const int DIMENSION = options.gridDimension;
     std::vector<RenderObject> renderObjects;
     if (!PlaceBlocks(renderObjects, renderer, DIMENSION))
         return -1;
 
-    Camera* camera = renderer->CreateCamera(0.1f, 20.0f,
+    // Far enough to see the whole ground from the edge of larger grids
+    Camera* camera = renderer->CreateCamera(0.1f, std::max(20.0f, DIMENSION * 4.0f),
         static_cast<float>(WINDOW_WIDTH) / WINDOW_HEIGHT);
     camera->MoveForward(-DIMENSION);
     camera->MoveUp(1);
 
     ResourceIndex lightBufferIndex;
-    if (!CreateLights(lightBufferIndex, renderer, DIMENSION * 2.5f))
+    if (!CreateLights(lightBufferIndex, renderer, DIMENSION * 2.5f, options.lightCount))
         return -1;
 
+    CameraPath cameraPath = options.cameraPath.empty()
+        ? CameraPath::Orbit(static_cast<float>(DIMENSION), options.measuredFrames)
+        : CameraPath::Load(options.cameraPath);
+
     renderer->SetLightBuffer(lightBufferIndex);
+    globalInputs.frustumCulling = options.frustumCulling;
+    globalInputs.occlusionCulling = options.occlusionCulling;
+    globalInputs.depthPrepass = options.depthPrepass;
 
     float deltaTime = 0.0f;
     float moveSpeed = 2.0f;
     float turnSpeed = 3.14f / 2;
-    auto lastFrameEnd = std::chrono::system_clock::now();
+    auto lastFrameEnd = std::chrono::steady_clock::now();
 
     SDL_Event event;
     bool run = true;
+    unsigned int renderedFrames = 0;
+    // Excludes the first frame, which includes startup
+    double steadyFrameTime = 0.0;
+#ifdef USE_VULKAN
+    uint64_t lastLoggedGpuFrame = UINT64_MAX;
+#endif
+    // In milliseconds, one sample per measured frame
+    std::vector<double> frameTimes;
+    std::vector<double> cpuRecordTimes;
+    std::vector<double> gpuTimes;
+#ifdef USE_VULKAN
+    // Renderer frame numbers, which don't count frames that were skipped
+    uint64_t firstMeasuredGpuFrame = UINT64_MAX;
+    uint64_t lastMeasuredGpuFrame = 0;
+    uint64_t lastSampledGpuFrame = UINT64_MAX;
+#endif
     while (!globalInputs.quitKey && run)
     {
-        if (SDL_PollEvent(&event))
+        if (!options.headless && SDL_PollEvent(&event))
         {
             switch (event.type) {
             case SDL_QUIT:
                 run = false;
                 break;
             case SDL_KEYDOWN:
-                HandleKeyEvent(event.key.keysym, true);
+                // Held keys repeat, which would flip toggles back and forth
+                if (!event.key.repeat)
+                    HandleKeyEvent(event.key.keysym, true);
                 break;
             case SDL_KEYUP:
                 HandleKeyEvent(event.key.keysym, false);
@@ -559,28 +857,194 @@ int main(int argc, char* argv[]) {
         }
         else
         {
+            PROFILE_FRAME(renderedFrames);
+#ifdef PROFILER_ENABLED
+            // The last traced frame ends when the next one is marked
+            const unsigned int traceEnd = options.traceFirstFrame + options.traceFrameCount;
+            if (!options.tracePath.empty() && renderedFrames == traceEnd)
+                ExportTrace(options);
+#endif
+            PROFILE_ZONE("Frame");
 
-            TransformCamera(camera, moveSpeed, turnSpeed, deltaTime);
+            const bool measured = options.benchmark
+                && renderedFrames >= options.warmupFrames
+                && renderedFrames < options.warmupFrames + options.measuredFrames;
+            // Warm-up frames render the starting view, the path starts with the measured frames
+            if (options.benchmark)
+            {
+                if (renderedFrames >= options.warmupFrames)
+                    cameraPath.Apply(camera, renderedFrames - options.warmupFrames);
+            }
+            else
+            {
+                TransformCamera(camera, moveSpeed, turnSpeed, deltaTime);
+            }
 
+#ifdef USE_VULKAN
+            const uint64_t gpuFrame = static_cast<RendererVulkan*>(renderer)->GetCurrentFrame();
+            if (measured)
+            {
+                firstMeasuredGpuFrame = std::min(firstMeasuredGpuFrame, gpuFrame);
+                lastMeasuredGpuFrame = std::max(lastMeasuredGpuFrame, gpuFrame);
+            }
+#endif
             renderer->PreRender();
 
             renderer->SetCamera(camera);
+#ifdef USE_VULKAN
+            static_cast<RendererVulkan*>(renderer)->SetFrustumCulling(
+                globalInputs.frustumCulling);
+            static_cast<RendererVulkan*>(renderer)->SetOcclusionCulling(
+                globalInputs.occlusionCulling);
+            static_cast<RendererVulkan*>(renderer)->SetDepthPrepass(globalInputs.depthPrepass);
+#endif
+            DrawParameters drawParameters;
+            drawParameters.flags = globalInputs.unlit ? DRAW_FLAG_UNLIT : DRAW_FLAG_NONE;
+            standardPass->SetDrawParameters(drawParameters);
             renderer->SetRenderPass(standardPass);
             renderer->Render(renderObjects);
 
             renderer->Present();
-            auto currentFrameEnd = std::chrono::system_clock::now();
+#ifdef USE_VULKAN
+            // Skipped frames record nothing and keep their frame number
+            RendererVulkan* vulkanRenderer = static_cast<RendererVulkan*>(renderer);
+            if (measured && vulkanRenderer->GetCurrentFrame() != gpuFrame)
+                cpuRecordTimes.push_back(vulkanRenderer->GetCpuRecordTime());
+
+            // Results arrive frames in flight later, log every frame once
+            const GpuFrameStatistics& gpuStatistics = vulkanRenderer->GetGpuFrameStatistics();
+            if (options.gpuTimings && !gpuStatistics.regions.empty()
+                && gpuStatistics.frame != lastLoggedGpuFrame)
+            {
+                LogGpuFrameStatistics(gpuStatistics);
+                lastLoggedGpuFrame = gpuStatistics.frame;
+            }
+
+            // The first region covers the whole frame, see GpuProfiler
+            if (options.benchmark && gpuStatistics.frame >= firstMeasuredGpuFrame
+                && gpuStatistics.frame <= lastMeasuredGpuFrame
+                && gpuStatistics.frame != lastSampledGpuFrame && !gpuStatistics.regions.empty())
+            {
+                gpuTimes.push_back(gpuStatistics.regions.front().milliseconds);
+                lastSampledGpuFrame = gpuStatistics.frame;
+            }
+#endif
+            auto currentFrameEnd = std::chrono::steady_clock::now();
             auto elapsed = std::chrono::duration_cast<
                 std::chrono::microseconds>(currentFrameEnd - lastFrameEnd).count();
             deltaTime = elapsed / 1000000.0f;
             lastFrameEnd = currentFrameEnd;
+
+            if (measured)
+                frameTimes.push_back(elapsed / 1000.0);
+
+            ++renderedFrames;
+            // Includes pipeline creation, so compare runs with a cold and a warm pipeline cache
+            if (renderedFrames == 1)
+            {
+                std::chrono::duration<double, std::milli> startupTime =
+                    std::chrono::steady_clock::now() - startupBegin;
+                std::cout << "Startup took " << startupTime.count() << " ms" << std::endl;
+#ifdef USE_VULKAN
+                std::cout << "Created pipelines in " << vulkanRenderer->GetPipelineCreationTime()
+                    << " ms with a " << (vulkanRenderer->IsPipelineCacheWarm() ? "warm" : "cold")
+                    << " pipeline cache" << std::endl;
+#endif
+            }
+            else
+            {
+                steadyFrameTime += elapsed / 1000.0;
+            }
+            if (options.frameCount != 0 && renderedFrames == options.frameCount)
+                run = false;
         }
 
     }
 
+#ifdef PROFILER_ENABLED
+    // Runs that stop right after the last traced frame never mark the frame after it
+    const unsigned int traceEnd = options.traceFirstFrame + options.traceFrameCount;
+    if (!options.tracePath.empty() && renderedFrames <= traceEnd)
+    {
+        PROFILE_FRAME(renderedFrames);
+        if (renderedFrames == traceEnd)
+            ExportTrace(options);
+        else
+            std::cout << "Too few frames were rendered to write the trace" << std::endl;
+    }
+#endif
+
+    // Compare runs with and without e.g. the depth prepass over the same number of frames
+    if (renderedFrames > 1)
+    {
+        std::cout << "Average frame time " << steadyFrameTime / (renderedFrames - 1) << " ms"
+            << std::endl;
+    }
+
+#ifdef USE_VULKAN
+    if (options.gpuDriven)
+    {
+        CullingStatistics statistics =
+            static_cast<RendererVulkan*>(renderer)->GetCullingStatistics();
+        std::cout << "Last culled frame: " << statistics.instanceCount << " instances, "
+            << statistics.frustumCulledCount << " outside the frustum, "
+            << statistics.occlusionCulledCount << " occluded" << std::endl;
+    }
+#endif
+
+    int exitCode = 0;
+    if (options.benchmark)
+    {
+        BenchmarkResults results;
+        results.configuration = {
+#ifdef USE_VULKAN
+            { "renderer", "Vulkan" },
+#elif USE_D3D11
+            { "renderer", "D3D11" },
+#endif
+            { "gridDimension", std::to_string(options.gridDimension) },
+            { "objectCount", std::to_string(renderObjects.size()) },
+            { "lightCount", std::to_string(options.lightCount) },
+            { "framesInFlight", std::to_string(options.framesInFlight) },
+            { "headless", options.headless ? "true" : "false" },
+            { "presentMode", options.presentMode },
+            { "gpuDriven", options.gpuDriven ? "true" : "false" },
+            { "frustumCulling", options.frustumCulling ? "true" : "false" },
+            { "occlusionCulling", options.occlusionCulling ? "true" : "false" },
+            { "depthPrepass", options.depthPrepass ? "true" : "false" },
+            { "cameraPath", options.cameraPath.empty() ? "orbit" : options.cameraPath },
+            { "warmupFrames", std::to_string(options.warmupFrames) },
+            { "measuredFrames", std::to_string(options.measuredFrames) },
+        };
+        results.frameTime = Summarise(frameTimes);
+        results.cpuRecordTime = Summarise(cpuRecordTimes);
+        results.gpuTime = Summarise(gpuTimes);
+
+        std::cout << "Frame time p50 " << results.frameTime.p50 << " ms, p95 "
+            << results.frameTime.p95 << " ms, p99 " << results.frameTime.p99 << " ms, max "
+            << results.frameTime.max << " ms" << std::endl;
+
+        if (!options.benchmarkJsonPath.empty()
+            && !WriteBenchmarkJson(options.benchmarkJsonPath, results))
+            throw std::runtime_error("Could not write " + options.benchmarkJsonPath);
+        if (!options.benchmarkCsvPath.empty()
+            && !WriteBenchmarkCsv(options.benchmarkCsvPath, results))
+            throw std::runtime_error("Could not write " + options.benchmarkCsvPath);
+
+        if (!options.baselinePath.empty())
+        {
+            std::vector<std::string> regressions = FindRegressions(results,
+                options.baselinePath, options.regressionTolerance);
+            for (const std::string& regression : regressions)
+                std::cout << "Regression: " << regression << std::endl;
+            if (!regressions.empty())
+                exitCode = 1;
+        }
+    }
+
     renderer->DestroyGraphicsRenderPass(standardPass);
     delete renderer;
     SDL_Quit();
 
-    return 0;
+    return exitCode;
 }
@@ -0,0 +1,169 @@
+#include "Profiler.h"
+
+#ifdef PROFILER_ENABLED
+
+#include <cassert>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Zones per thread, older ones are overwritten. A frame has a few dozen, so this keeps well over a
+// thousand frames
+constexpr uint64_t RING_CAPACITY = 1 << 16;
+
+struct ZoneEvent
+{
+	const char* name;
+	uint64_t begin;
+	uint64_t end;
+};
+
+struct ThreadBuffer
+{
+	std::vector<ZoneEvent> events;
+	// Total number of zones written, the ring index is this modulo RING_CAPACITY
+	uint64_t writtenCount = 0;
+	uint32_t threadIndex = 0;
+	const char* name = nullptr;
+};
+
+uint64_t profilerTimestamp()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct ProfilerState
+{
+	// Only taken when a thread writes its first zone, when a frame is marked and when exporting
+	std::mutex mutex;
+	// Kept after their threads exit so that their zones can still be exported
+	std::vector<std::unique_ptr<ThreadBuffer>> threads;
+	std::vector<uint64_t> frameStarts;
+	// Traces start at 0 instead of at whenever the clock started
+	uint64_t epoch = profilerTimestamp();
+};
+
+ProfilerState& getState()
+{
+	static ProfilerState state;
+	return state;
+}
+
+thread_local ThreadBuffer* currentThreadBuffer = nullptr;
+
+ThreadBuffer& getThreadBuffer()
+{
+	if (!currentThreadBuffer)
+	{
+		ProfilerState& state = getState();
+		std::lock_guard lock(state.mutex);
+		auto buffer = std::make_unique<ThreadBuffer>();
+		buffer->events.resize(RING_CAPACITY);
+		buffer->threadIndex = static_cast<uint32_t>(state.threads.size());
+		currentThreadBuffer = buffer.get();
+		state.threads.push_back(std::move(buffer));
+	}
+	return *currentThreadBuffer;
+}
+
+ProfileZone::ProfileZone(const char* name) : name(name), begin(profilerTimestamp())
+{
+}
+
+ProfileZone::~ProfileZone()
+{
+	ThreadBuffer& buffer = getThreadBuffer();
+	buffer.events[buffer.writtenCount % RING_CAPACITY] = { name, begin, profilerTimestamp() };
+	++buffer.writtenCount;
+}
+
+void ProfilerSetThreadName(const char* name)
+{
+	getThreadBuffer().name = name;
+}
+
+void ProfilerMarkFrame(uint64_t frame)
+{
+	ProfilerState& state = getState();
+	std::lock_guard lock(state.mutex);
+	assert(frame == state.frameStarts.size());
+	state.frameStarts.push_back(profilerTimestamp());
+}
+
+// Chrome expects microseconds
+double toMicroseconds(uint64_t timestamp, uint64_t epoch)
+{
+	return (static_cast<int64_t>(timestamp) - static_cast<int64_t>(epoch)) / 1000.0;
+}
+
+std::string escapeJson(const char* text)
+{
+	std::string escaped;
+	for (; *text; ++text)
+	{
+		if (*text == '"' || *text == '\\')
+			escaped += '\\';
+		escaped += *text;
+	}
+	return escaped;
+}
+
+bool ProfilerExportChromeTrace(const std::string& path, uint64_t firstFrame, uint64_t lastFrame)
+{
+	ProfilerState& state = getState();
+	std::lock_guard lock(state.mutex);
+	if (firstFrame > lastFrame || lastFrame + 1 >= state.frameStarts.size())
+		return false;
+
+	std::ofstream file(path);
+	if (!file)
+		return false;
+
+	const uint64_t rangeBegin = firstFrame == 0 ? 0 : state.frameStarts[firstFrame];
+	const uint64_t rangeEnd = state.frameStarts[lastFrame + 1];
+
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool firstEvent = true;
+	auto beginEvent = [&]() -> std::ofstream& {
+		if (!firstEvent)
+			file << ",\n";
+		firstEvent = false;
+		return file;
+	};
+
+	for (uint64_t frame = firstFrame; frame <= lastFrame; ++frame)
+	{
+		beginEvent() << "{\"name\":\"Frame " << frame << "\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,"
+			<< "\"tid\":0,\"ts\":" << toMicroseconds(state.frameStarts[frame], state.epoch) << "}";
+	}
+
+	for (const auto& thread : state.threads)
+	{
+		std::string threadName = thread->name ? escapeJson(thread->name)
+			: "Thread " + std::to_string(thread->threadIndex);
+		beginEvent() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":"
+			<< thread->threadIndex << ",\"args\":{\"name\":\"" << threadName << "\"}}";
+
+		const uint64_t oldest = thread->writtenCount > RING_CAPACITY
+			? thread->writtenCount - RING_CAPACITY : 0;
+		for (uint64_t i = oldest; i < thread->writtenCount; ++i)
+		{
+			const ZoneEvent& event = thread->events[i % RING_CAPACITY];
+			if (event.begin < rangeBegin || event.begin >= rangeEnd)
+				continue;
+
+			beginEvent() << "{\"name\":\"" << escapeJson(event.name) << "\",\"ph\":\"X\","
+				<< "\"pid\":0,\"tid\":" << thread->threadIndex
+				<< ",\"ts\":" << toMicroseconds(event.begin, state.epoch)
+				<< ",\"dur\":" << (event.end - event.begin) / 1000.0 << "}";
+		}
+	}
+	file << "\n]}\n";
+
+	return static_cast<bool>(file);
+}
+
+#endif
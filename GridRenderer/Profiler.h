@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Scoped CPU zones, compiled out of release builds unless ENABLE_PROFILER is defined. Every thread
+// writes into a ring buffer of its own, so a zone costs two clock reads and no locking. Only the
+// most recent zones of every thread are kept, see ProfilerExportChromeTrace
+#if !defined(NDEBUG) || defined(ENABLE_PROFILER)
+#define PROFILER_ENABLED
+#endif
+
+#ifdef PROFILER_ENABLED
+
+class ProfileZone
+{
+private:
+	const char* name;
+	uint64_t begin;
+
+public:
+	// The name must outlive the profiler, in practice a string literal
+	ProfileZone(const char* name);
+	~ProfileZone();
+	ProfileZone(const ProfileZone& other) = delete;
+	ProfileZone& operator=(const ProfileZone& other) = delete;
+	ProfileZone(ProfileZone&& other) = delete;
+	ProfileZone& operator=(ProfileZone&& other) = delete;
+};
+
+// Shown instead of the thread's index in the trace
+void ProfilerSetThreadName(const char* name);
+// Marks the start of a frame. Frames are numbered from 0 and marked in order
+void ProfilerMarkFrame(uint64_t frame);
+// Writes every zone that began in frames first to last, inclusive, as Chrome trace-event JSON
+// that chrome://tracing and Perfetto open. Frame 0 also covers everything before it, which is
+// startup. The last frame has to have ended, i.e. the next one has been marked. Zones older than
+// the ring buffers are lost, so export soon after the range. No other thread may be inside a zone
+bool ProfilerExportChromeTrace(const std::string& path, uint64_t firstFrame, uint64_t lastFrame);
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+// Measures the rest of the enclosing scope
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_THREAD_NAME(name) ProfilerSetThreadName(name)
+#define PROFILE_FRAME(frame) ProfilerMarkFrame(frame)
+
+#else
+
+#define PROFILE_ZONE(name)
+#define PROFILE_THREAD_NAME(name)
+#define PROFILE_FRAME(frame)
+
+#endif
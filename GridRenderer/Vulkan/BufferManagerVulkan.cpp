@@ -1,7 +1,12 @@
 #include "BufferManagerVulkan.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iterator>
 #include <optional>
 
+#include "../Profiler.h"
 #include "StlHelpers/EntireCollection.h"
 
 BackingBuffer createWriteOnceBackingBuffer(
@@ -51,6 +56,7 @@ BackingBuffer createWriteOnceBackingBuffer(
         .memory = std::move(memory),
         .buffer = std::move(buffer),
         .size = BACKING_BUFFER_SIZE,
+        .usedSize = 0,
     };
 }
 
@@ -101,17 +107,68 @@ BackingBuffer createDynamicBackingBuffer(
         .memory = std::move(memory),
         .buffer = std::move(buffer),
         .size = BACKING_BUFFER_SIZE,
+        .usedSize = 0,
     };
 }
 
-RoundRobinBuffer createRoundRobinBuffer(
+BackingBuffer createGeometryBackingBuffer(
     const vk::UniqueDevice& device,
     const vk::PhysicalDevice& physicalDevice)
 {
     auto buffer = device->createBufferUnique({
-        .size = BACKING_BUFFER_SIZE * BACKBUFFER_COUNT,
-        .usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eUniformBuffer
-                 | vk::BufferUsageFlagBits::eTransferDst,
+        .size = BACKING_BUFFER_SIZE,
+        // Vertices are pulled from a storage buffer, indices go through the index buffer
+        .usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndexBuffer,
+        .sharingMode = vk::SharingMode::eExclusive,
+        // Not used since eExclusive is used
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = nullptr,
+    });
+
+    vk::MemoryRequirements memoryRequirements = device->getBufferMemoryRequirements(*buffer);
+    vk::PhysicalDeviceMemoryProperties memoryProperties = physicalDevice.getMemoryProperties();
+
+    std::optional<uint32_t> memoryIndexOpt;
+    for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+    {
+        bool memoryTypeSupported = memoryRequirements.memoryTypeBits & (1 << i);
+
+        if(memoryTypeSupported
+           && memoryProperties.memoryTypes[i].propertyFlags
+                  & vk::MemoryPropertyFlagBits::eHostCoherent) // Coherent for map functionality
+        {
+            memoryIndexOpt = i;
+            break;
+        }
+    }
+    assert(memoryIndexOpt.has_value());
+    uint32_t memoryIndex = memoryIndexOpt.value();
+
+    auto memory = device->allocateMemoryUnique({
+        .allocationSize = memoryRequirements.size,
+        .memoryTypeIndex = memoryIndex,
+    });
+
+    device->bindBufferMemory(*buffer, *memory, 0);
+
+    return BackingBuffer{
+        .memory = std::move(memory),
+        .buffer = std::move(buffer),
+        .size = BACKING_BUFFER_SIZE,
+        .usedSize = 0,
+    };
+}
+
+RoundRobinBuffer createRoundRobinBuffer(
+    const vk::UniqueDevice& device,
+    const vk::PhysicalDevice& physicalDevice,
+    uint32_t chunkSize,
+    uint32_t chunkCount,
+    vk::BufferUsageFlags usage)
+{
+    auto buffer = device->createBufferUnique({
+        .size = chunkSize * chunkCount,
+        .usage = usage,
         .sharingMode = vk::SharingMode::eExclusive,
         // Not used since eExclusive is used
         .queueFamilyIndexCount = 0,
@@ -149,18 +206,57 @@ RoundRobinBuffer createRoundRobinBuffer(
     return RoundRobinBuffer{
         .memory = std::move(memory),
         .buffer = std::move(buffer),
-        .totalSize = BACKING_BUFFER_SIZE * BACKBUFFER_COUNT,
-        .chunkSize = BACKING_BUFFER_SIZE,
+        .totalSize = chunkSize * chunkCount,
+        .chunkSize = chunkSize,
     };
 }
 
 BufferManagerVulkan::BufferManagerVulkan(
     const vk::UniqueDevice& device,
-    const vk::PhysicalDevice& physicalDevice)
+    const vk::PhysicalDevice& physicalDevice,
+    uint32_t framesInFlight)
     : device(device)
     , writeOnceBackingBuffer(createWriteOnceBackingBuffer(device, physicalDevice))
     , dynamicBackingBuffer(createDynamicBackingBuffer(device, physicalDevice))
-    , roundRobinBuffer(createRoundRobinBuffer(device, physicalDevice))
+    , geometryBackingBuffer(createGeometryBackingBuffer(device, physicalDevice))
+    , roundRobinBuffer(createRoundRobinBuffer(
+          device,
+          physicalDevice,
+          BACKING_BUFFER_SIZE,
+          framesInFlight,
+          vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eUniformBuffer
+              | vk::BufferUsageFlagBits::eTransferDst))
+    , indirectBuffer(createRoundRobinBuffer(
+          device,
+          physicalDevice,
+          MAX_INDIRECT_COMMANDS * sizeof(vk::DrawIndexedIndirectCommand),
+          framesInFlight,
+          // Written by compute shaders, read by indirect draws
+          vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer))
+    , cullingDataBuffer(createRoundRobinBuffer(
+          device,
+          physicalDevice,
+          CULLING_DATA_CHUNK_SIZE,
+          framesInFlight,
+          vk::BufferUsageFlagBits::eStorageBuffer))
+    , cameraDataBuffer(createRoundRobinBuffer(
+          device,
+          physicalDevice,
+          CAMERA_DATA_CHUNK_SIZE,
+          framesInFlight,
+          vk::BufferUsageFlagBits::eUniformBuffer))
+    , instanceMaterialBuffer(createRoundRobinBuffer(
+          device,
+          physicalDevice,
+          BACKING_BUFFER_SIZE / (16 * sizeof(float)) * sizeof(uint32_t),
+          framesInFlight,
+          vk::BufferUsageFlagBits::eStorageBuffer))
+    , materialTableBuffer(createRoundRobinBuffer(
+          device,
+          physicalDevice,
+          MAX_MATERIALS * 2 * sizeof(uint32_t),
+          1,
+          vk::BufferUsageFlagBits::eStorageBuffer))
 {
 }
 
@@ -172,50 +268,75 @@ ResourceIndex BufferManagerVulkan::AddBuffer(
     PerFrameWritePattern gpuWrite,
     unsigned int bindingFlags)
 {
+    PROFILE_ZONE("AddBuffer");
     (void)gpuWrite;
 
     auto backingBufferType = cpuWrite == PerFrameWritePattern::NEVER ? BackingBufferType::WRITE_ONCE
                                                                      : BackingBufferType::DYNAMIC;
-
+    if(bindingFlags & (BufferBinding::VERTEX_BUFFER | BufferBinding::INDEX_BUFFER))
     {
-        auto lastMatchingBuffer =
-            std::find_if(buffers.rbegin(), buffers.rend(), [=](const Buffer& buffer) {
-                return buffer.backingBufferType == backingBufferType;
-            });
+        assert(cpuWrite == PerFrameWritePattern::NEVER);
+        backingBufferType = BackingBufferType::GEOMETRY;
+    }
 
-        uint32_t bufferOffset = 0;
-        if(lastMatchingBuffer != buffers.rend())
-        {
-            bufferOffset =
-                lastMatchingBuffer->backingBufferOffset + lastMatchingBuffer->sizeWithPadding;
-        }
+    BackingBuffer& backingBuffer = getBackingBuffer(backingBufferType);
+    const uint32_t bufferSizeWithoutPadding = elementSize * nrOfElements;
+    const uint32_t bufferSizeWithPadding =
+        (bufferSizeWithoutPadding + BACKING_BUFFER_ALIGNMENT - 1) / BACKING_BUFFER_ALIGNMENT
+        * BACKING_BUFFER_ALIGNMENT;
 
-        const uint32_t bufferSizeWithoutPadding = elementSize * nrOfElements;
-        const uint32_t bufferSizeWithPadding =
-            (bufferSizeWithoutPadding + BACKING_BUFFER_ALIGNMENT - 1) / BACKING_BUFFER_ALIGNMENT
-            * BACKING_BUFFER_ALIGNMENT;
-
-        buffers.push_back({
-            .elementCount = nrOfElements,
-            .sizeWithoutPadding = bufferSizeWithoutPadding,
-            .sizeWithPadding = bufferSizeWithPadding,
-            .backingBufferOffset = bufferOffset,
-            .backingBufferType = backingBufferType,
-        });
+    // Removed write-once buffers are reused first, the first range that fits is taken
+    auto freeRange = std::find_if(entire_collection(writeOnceFreeRanges), [&](const auto& range) {
+        return range.size >= bufferSizeWithPadding;
+    });
+    uint32_t bufferOffset = backingBuffer.usedSize;
+    if(backingBufferType == BackingBufferType::WRITE_ONCE
+       && freeRange != writeOnceFreeRanges.end())
+    {
+        bufferOffset = freeRange->offset;
+        freeRange->offset += bufferSizeWithPadding;
+        freeRange->size -= bufferSizeWithPadding;
+        if(freeRange->size == 0)
+            writeOnceFreeRanges.erase(freeRange);
+    }
+    else
+    {
+        // Meshes are addressed in whole elements (vertex offset and first index), so the offset
+        // has to be a multiple of the element size as well
+        if(backingBufferType == BackingBufferType::GEOMETRY)
+            bufferOffset = (bufferOffset + elementSize - 1) / elementSize * elementSize;
+
+        assert(bufferOffset + bufferSizeWithPadding <= backingBuffer.size);
+        backingBuffer.usedSize = bufferOffset + bufferSizeWithPadding;
     }
+
+    buffers.push_back({
+        .elementSize = elementSize,
+        .elementCount = nrOfElements,
+        .sizeWithoutPadding = bufferSizeWithoutPadding,
+        .sizeWithPadding = bufferSizeWithPadding,
+        .backingBufferOffset = bufferOffset,
+        .backingBufferType = backingBufferType,
+    });
     const Buffer& buffer = buffers.back();
 
     // TODO: Use staging buffer instead of map for immediate performance gains
     // Don't forget to change the memory type from eHostCoherent!
     void* dataPtr = device->mapMemory(
-        (backingBufferType == BackingBufferType::WRITE_ONCE ? *writeOnceBackingBuffer.memory
-                                                            : *dynamicBackingBuffer.memory),
+        *backingBuffer.memory,
         buffer.backingBufferOffset,
         buffer.sizeWithoutPadding);
     std::memcpy(dataPtr, data, buffer.sizeWithoutPadding);
-    device->unmapMemory(
-        (backingBufferType == BackingBufferType::WRITE_ONCE ? *writeOnceBackingBuffer.memory
-                                                            : *dynamicBackingBuffer.memory));
+    device->unmapMemory(*backingBuffer.memory);
+
+    if(backingBufferType != BackingBufferType::WRITE_ONCE)
+    {
+        std::vector<char>& shadow = backingBufferType == BackingBufferType::DYNAMIC
+                                        ? dynamicBufferShadow
+                                        : geometryBufferShadow;
+        shadow.resize(buffer.backingBufferOffset + buffer.sizeWithPadding);
+        std::memcpy(shadow.data() + buffer.backingBufferOffset, data, buffer.sizeWithoutPadding);
+    }
 
     return buffers.size() - 1;
 }
@@ -234,9 +355,46 @@ void BufferManagerVulkan::UpdateBuffer(ResourceIndex index, void* data)
     device->unmapMemory(*backingBuffer.memory);
 }
 
+void BufferManagerVulkan::RemoveBuffer(ResourceIndex index)
+{
+    Buffer& buffer = buffers[index];
+    assert(buffer.backingBufferType == BackingBufferType::WRITE_ONCE);
+    assert(buffer.sizeWithPadding > 0);
+    FreeRange removed = {
+        .offset = buffer.backingBufferOffset,
+        .size = buffer.sizeWithPadding,
+    };
+    // Catches a second removal of the same index
+    buffer.sizeWithPadding = 0;
+
+    auto next = std::find_if(entire_collection(writeOnceFreeRanges), [&](const auto& range) {
+        return range.offset > removed.offset;
+    });
+    if(next != writeOnceFreeRanges.begin())
+    {
+        auto previous = std::prev(next);
+        if(previous->offset + previous->size == removed.offset)
+        {
+            removed.offset = previous->offset;
+            removed.size += previous->size;
+            next = writeOnceFreeRanges.erase(previous);
+        }
+    }
+    if(next != writeOnceFreeRanges.end() && removed.offset + removed.size == next->offset)
+    {
+        removed.size += next->size;
+        next = writeOnceFreeRanges.erase(next);
+    }
+
+    if(removed.offset + removed.size == writeOnceBackingBuffer.usedSize)
+        writeOnceBackingBuffer.usedSize = removed.offset;
+    else
+        writeOnceFreeRanges.insert(next, removed);
+}
+
 unsigned int BufferManagerVulkan::GetElementSize(ResourceIndex index)
 {
-    return -1;
+    return buffers[index].elementSize;
 }
 
 unsigned int BufferManagerVulkan::GetElementCount(ResourceIndex index)
@@ -254,6 +412,11 @@ vk::Buffer BufferManagerVulkan::GetDynamicBackingBuffer()
     return *dynamicBackingBuffer.buffer;
 }
 
+vk::Buffer BufferManagerVulkan::GetGeometryBackingBuffer()
+{
+    return *geometryBackingBuffer.buffer;
+}
+
 vk::Buffer BufferManagerVulkan::GetRoundRobinBuffer()
 {
     return *roundRobinBuffer.buffer;
@@ -264,14 +427,125 @@ uint32_t BufferManagerVulkan::GetRoundRobinChunkSize()
     return roundRobinBuffer.chunkSize;
 }
 
+vk::Buffer BufferManagerVulkan::GetIndirectBuffer()
+{
+    return *indirectBuffer.buffer;
+}
+
+uint32_t BufferManagerVulkan::GetIndirectChunkSize()
+{
+    return indirectBuffer.chunkSize;
+}
+
+vk::Buffer BufferManagerVulkan::GetCullingDataBuffer()
+{
+    return *cullingDataBuffer.buffer;
+}
+
+uint32_t BufferManagerVulkan::GetCullingDataChunkSize()
+{
+    return cullingDataBuffer.chunkSize;
+}
+
+void BufferManagerVulkan::WriteCullingData(uint32_t offset, const void* data, uint32_t size)
+{
+    assert(offset + size <= cullingDataBuffer.totalSize);
+    void* dataPtr = device->mapMemory(*cullingDataBuffer.memory, offset, size);
+    std::memcpy(dataPtr, data, size);
+    device->unmapMemory(*cullingDataBuffer.memory);
+}
+
+void BufferManagerVulkan::ReadCullingData(uint32_t offset, void* data, uint32_t size)
+{
+    assert(offset + size <= cullingDataBuffer.totalSize);
+    void* dataPtr = device->mapMemory(*cullingDataBuffer.memory, offset, size);
+    std::memcpy(data, dataPtr, size);
+    device->unmapMemory(*cullingDataBuffer.memory);
+}
+
+vk::Buffer BufferManagerVulkan::GetCameraDataBuffer()
+{
+    return *cameraDataBuffer.buffer;
+}
+
+uint32_t BufferManagerVulkan::GetCameraDataChunkSize()
+{
+    return cameraDataBuffer.chunkSize;
+}
+
+void BufferManagerVulkan::WriteCameraData(uint32_t offset, const void* data, uint32_t size)
+{
+    assert(offset + size <= cameraDataBuffer.totalSize);
+    void* dataPtr = device->mapMemory(*cameraDataBuffer.memory, offset, size);
+    std::memcpy(dataPtr, data, size);
+    device->unmapMemory(*cameraDataBuffer.memory);
+}
+
+vk::Buffer BufferManagerVulkan::GetInstanceMaterialBuffer()
+{
+    return *instanceMaterialBuffer.buffer;
+}
+
+uint32_t BufferManagerVulkan::GetInstanceMaterialChunkSize()
+{
+    return instanceMaterialBuffer.chunkSize;
+}
+
+uint32_t* BufferManagerVulkan::MapInstanceMaterials(uint32_t offset, uint32_t count)
+{
+    assert(offset + count * sizeof(uint32_t) <= instanceMaterialBuffer.totalSize);
+    return (uint32_t*)device->mapMemory(
+        *instanceMaterialBuffer.memory,
+        offset,
+        count * sizeof(uint32_t));
+}
+
+void BufferManagerVulkan::UnmapInstanceMaterials()
+{
+    device->unmapMemory(*instanceMaterialBuffer.memory);
+}
+
+vk::Buffer BufferManagerVulkan::GetMaterialTableBuffer()
+{
+    return *materialTableBuffer.buffer;
+}
+
+void BufferManagerVulkan::WriteMaterialTable(uint32_t offset, const void* data, uint32_t size)
+{
+    assert(offset + size <= materialTableBuffer.totalSize);
+    void* dataPtr = device->mapMemory(*materialTableBuffer.memory, offset, size);
+    std::memcpy(dataPtr, data, size);
+    device->unmapMemory(*materialTableBuffer.memory);
+}
+
 const Buffer& BufferManagerVulkan::GetBuffer(ResourceIndex index)
 {
     return buffers[index];
 }
 
+const void* BufferManagerVulkan::GetBufferData(ResourceIndex index)
+{
+    const Buffer& buffer = buffers[index];
+    assert(buffer.backingBufferType != BackingBufferType::WRITE_ONCE);
+    if(buffer.backingBufferType == BackingBufferType::GEOMETRY)
+        return geometryBufferShadow.data() + buffer.backingBufferOffset;
+    return dynamicBufferShadow.data() + buffer.backingBufferOffset;
+}
+
 vk::Buffer BufferManagerVulkan::GetBackingBuffer(ResourceIndex index)
 {
-    return buffers[index].backingBufferType == BackingBufferType::WRITE_ONCE
-               ? *writeOnceBackingBuffer.buffer
-               : *dynamicBackingBuffer.buffer;
+    return *getBackingBuffer(buffers[index].backingBufferType).buffer;
+}
+
+BackingBuffer& BufferManagerVulkan::getBackingBuffer(BackingBufferType type)
+{
+    switch(type)
+    {
+        case BackingBufferType::WRITE_ONCE: return writeOnceBackingBuffer;
+        case BackingBufferType::DYNAMIC: return dynamicBackingBuffer;
+        case BackingBufferType::GEOMETRY: return geometryBackingBuffer;
+    }
+
+    assert(false);
+    return writeOnceBackingBuffer;
 }
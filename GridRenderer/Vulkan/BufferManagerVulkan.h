@@ -7,17 +7,16 @@
 
 #include "../BufferManager.h"
 
-// TODO: Move info config.h or something to deduplicate
-static constexpr uint32_t BACKBUFFER_COUNT = 2;
-
 enum class BackingBufferType
 {
     WRITE_ONCE,
-    DYNAMIC
+    DYNAMIC,
+    GEOMETRY, // Vertices and indices of every mesh
 };
 
 struct Buffer
 {
+    uint32_t elementSize;
     uint32_t elementCount;
     uint32_t sizeWithoutPadding;
     uint32_t sizeWithPadding;
@@ -27,12 +26,31 @@ struct Buffer
 
 constexpr uint32_t BACKING_BUFFER_SIZE = 1024 * 1024 * 16;
 constexpr uint32_t BACKING_BUFFER_ALIGNMENT = 64; // TODO: Look up at runtime
+// Indirect draw commands that one frame can generate on the GPU
+constexpr uint32_t MAX_INDIRECT_COMMANDS = 1024 * 64;
+// Room for the culling input and statistics of one frame, a multiple of every storage buffer
+// offset alignment
+constexpr uint32_t CULLING_DATA_CHUNK_SIZE = 256;
+// Room for the view-projection matrix and the camera position of one frame. Both are bound as
+// uniform buffers, so each starts at a multiple of every uniform buffer offset alignment
+constexpr uint32_t CAMERA_DATA_CHUNK_SIZE = 512;
+constexpr uint32_t CAMERA_POSITION_OFFSET = 256;
+// Distinct diffuse and specular texture pairs
+constexpr uint32_t MAX_MATERIALS = 4096;
 
 struct BackingBuffer
 {
     vk::UniqueDeviceMemory memory;
     vk::UniqueBuffer buffer;
     uint32_t size;
+    // Everything past this has never been handed out
+    uint32_t usedSize;
+};
+
+struct FreeRange
+{
+    uint32_t offset;
+    uint32_t size;
 };
 
 struct RoundRobinBuffer
@@ -50,11 +68,33 @@ class BufferManagerVulkan: public BufferManager
 
     BackingBuffer writeOnceBackingBuffer;
     BackingBuffer dynamicBackingBuffer;
+    BackingBuffer geometryBackingBuffer;
     RoundRobinBuffer roundRobinBuffer;
+    RoundRobinBuffer indirectBuffer;
+    RoundRobinBuffer cullingDataBuffer;
+    RoundRobinBuffer cameraDataBuffer;
+    // One material ID per transform in the round-robin buffer
+    RoundRobinBuffer instanceMaterialBuffer;
+    // A single chunk that every frame shares. Materials are only ever appended, so frames in
+    // flight never read an entry that changes
+    RoundRobinBuffer materialTableBuffer;
     std::vector<Buffer> buffers;
+    // Memory of removed write-once buffers, sorted by offset. Adjacent ranges are merged, and a
+    // range that reaches usedSize is given back to it instead
+    std::vector<FreeRange> writeOnceFreeRanges;
+    // CPU copies of the dynamic and geometry backing buffers so that the CPU never has to read
+    // mapped memory
+    std::vector<char> dynamicBufferShadow;
+    std::vector<char> geometryBufferShadow;
+
+    BackingBuffer& getBackingBuffer(BackingBufferType type);
 
   public:
-    BufferManagerVulkan(const vk::UniqueDevice& device, const vk::PhysicalDevice& physicalDevice);
+    // The round-robin and indirect buffers get one chunk per frame in flight
+    BufferManagerVulkan(
+        const vk::UniqueDevice& device,
+        const vk::PhysicalDevice& physicalDevice,
+        uint32_t framesInFlight);
     BufferManagerVulkan(const BufferManagerVulkan& other) = delete;
     BufferManagerVulkan& operator=(const BufferManagerVulkan& other) = delete;
     BufferManagerVulkan(BufferManagerVulkan&& other) = default;
@@ -69,14 +109,40 @@ class BufferManagerVulkan: public BufferManager
         unsigned int bindingFlags) override;
 
     void UpdateBuffer(ResourceIndex index, void* data) override;
+    // Hands the memory of a write-once buffer back to AddBuffer. The index must not be used
+    // afterwards, and the GPU must be done with the buffer
+    void RemoveBuffer(ResourceIndex index);
     unsigned int GetElementSize(ResourceIndex index) override;
     unsigned int GetElementCount(ResourceIndex index) override;
 
     vk::Buffer GetWriteOnceBackingBuffer();
     vk::Buffer GetDynamicBackingBuffer();
+    vk::Buffer GetGeometryBackingBuffer();
     vk::Buffer GetRoundRobinBuffer();
     uint32_t GetRoundRobinChunkSize();
+    vk::Buffer GetIndirectBuffer();
+    uint32_t GetIndirectChunkSize();
+    vk::Buffer GetCullingDataBuffer();
+    uint32_t GetCullingDataChunkSize();
+    // The culling data is written by the CPU before a frame is submitted and read back once the
+    // frame has finished, so the GPU never uses it at the same time
+    void WriteCullingData(uint32_t offset, const void* data, uint32_t size);
+    void ReadCullingData(uint32_t offset, void* data, uint32_t size);
+    vk::Buffer GetCameraDataBuffer();
+    uint32_t GetCameraDataChunkSize();
+    // Only the chunk of the frame that is being recorded is written, which no frame in flight
+    // reads
+    void WriteCameraData(uint32_t offset, const void* data, uint32_t size);
+    vk::Buffer GetInstanceMaterialBuffer();
+    uint32_t GetInstanceMaterialChunkSize();
+    // The returned memory stays mapped until UnmapInstanceMaterials
+    uint32_t* MapInstanceMaterials(uint32_t offset, uint32_t count);
+    void UnmapInstanceMaterials();
+    vk::Buffer GetMaterialTableBuffer();
+    void WriteMaterialTable(uint32_t offset, const void* data, uint32_t size);
 
     const Buffer& GetBuffer(ResourceIndex index);
+    // Only available for dynamic and geometry buffers
+    const void* GetBufferData(ResourceIndex index);
     vk::Buffer GetBackingBuffer(ResourceIndex index);
 };
\ No newline at end of file
@@ -8,27 +8,16 @@
     #error GLM compile flags are not set
 #endif
 
-CameraVulkan::CameraVulkan(
-    BufferManagerVulkan& bufferManager,
-    float minDepth,
-    float maxDepth,
-    float aspectRatio)
+CameraVulkan::CameraVulkan(float minDepth, float maxDepth, float aspectRatio)
 {
     this->projectionMatrix = glm::perspective(glm::radians(90.0f), aspectRatio, minDepth, maxDepth);
     this->projectionMatrix[1][1] *= -1.0f;
+    this->maxDepth = maxDepth;
 
     this->position = {0.0f, 0.0f, -4.0f};
     this->forward = {0.0f, 0.0f, 1.0f};
     this->up = {0.0f, 1.0f, 0.0f};
     this->right = {1.0f, 0.0f, 0.0f};
-
-    this->cameraPositionBufferIndex = bufferManager.AddBuffer(
-        &position,
-        sizeof(float),
-        4,
-        PerFrameWritePattern::NEVER,
-        PerFrameWritePattern::NEVER,
-        BufferBinding::CONSTANT_BUFFER);
 }
 
 void CameraVulkan::MoveForward(float amount)
@@ -57,12 +46,35 @@ glm::vec3 CameraVulkan::GetPosition() const
     return position;
 }
 
+glm::vec3 CameraVulkan::GetForward() const
+{
+    return forward;
+}
+
+float CameraVulkan::GetMaxDepth() const
+{
+    return maxDepth;
+}
+
 glm::mat4 CameraVulkan::GetViewProjMatrix() const
 {
     return projectionMatrix * glm::lookAt(position, position + forward, up);
 }
 
-ResourceIndex CameraVulkan::GetCameraPositionBufferIndex() const
+std::array<glm::vec4, 6> CameraVulkan::GetFrustumPlanes() const
 {
-    return cameraPositionBufferIndex;
-}
\ No newline at end of file
+    // Gribb and Hartmann. Clip space depth is [0, 1], so the near plane is the third row alone
+    glm::mat4 transposed = glm::transpose(GetViewProjMatrix());
+    std::array<glm::vec4, 6> planes = {
+        transposed[3] + transposed[0],
+        transposed[3] - transposed[0],
+        transposed[3] + transposed[1],
+        transposed[3] - transposed[1],
+        transposed[2],
+        transposed[3] - transposed[2],
+    };
+    for(glm::vec4& plane : planes)
+        plane /= glm::length(glm::vec3(plane));
+
+    return planes;
+}
@@ -1,11 +1,11 @@
 #pragma once
 
+#include <array>
+
 #include <glm/matrix.hpp>
 
 #include "../Camera.h"
 
-#include "BufferManagerVulkan.h"
-
 class CameraVulkan: public Camera
 {
   private:
@@ -15,15 +15,10 @@ class CameraVulkan: public Camera
     glm::vec3 right;
 
     glm::mat4 projectionMatrix;
-
-    ResourceIndex cameraPositionBufferIndex;
+    float maxDepth;
 
   public:
-    CameraVulkan(
-        BufferManagerVulkan& bufferManager,
-        float minDepth,
-        float maxDepth,
-        float aspectRatio);
+    CameraVulkan(float minDepth, float maxDepth, float aspectRatio);
     CameraVulkan(const CameraVulkan& other) = default;
     CameraVulkan& operator=(const CameraVulkan& other) = default;
     CameraVulkan(CameraVulkan&& other) = default;
@@ -35,7 +30,11 @@ class CameraVulkan: public Camera
     void RotateY(float radians) override;
 
     glm::vec3 GetPosition() const;
+    glm::vec3 GetForward() const;
+    float GetMaxDepth() const;
 
     glm::mat4 GetViewProjMatrix() const;
-    ResourceIndex GetCameraPositionBufferIndex() const;
+    // Left, right, bottom, top, near and far. xyz is the normalized inward-facing normal and w the
+    // distance, so a point p is inside a plane if dot(plane.xyz, p) + plane.w >= 0
+    std::array<glm::vec4, 6> GetFrustumPlanes() const;
 };
\ No newline at end of file
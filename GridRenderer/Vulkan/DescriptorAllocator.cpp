@@ -0,0 +1,85 @@
+#include "DescriptorAllocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+// Keeps a single pool from reserving an unreasonable amount of memory
+constexpr uint32_t MAX_SETS_PER_POOL = 4096;
+
+DescriptorAllocator::DescriptorAllocator(
+    vk::Device device,
+    std::vector<DescriptorTypeRatio> ratios,
+    uint32_t initialSetsPerPool)
+    : device(device)
+    , ratios(std::move(ratios))
+    , setsPerPool(initialSetsPerPool)
+{
+}
+
+vk::UniqueDescriptorPool DescriptorAllocator::createPool()
+{
+    std::vector<vk::DescriptorPoolSize> poolSizes;
+    for(const DescriptorTypeRatio& ratio : ratios)
+    {
+        poolSizes.push_back({
+            .type = ratio.type,
+            .descriptorCount = ratio.countPerSet * setsPerPool,
+        });
+    }
+
+    // Without eFreeDescriptorSet the driver never has to deal with fragmentation
+    auto pool = device.createDescriptorPoolUnique({
+        .flags = {},
+        .maxSets = setsPerPool,
+        .poolSizeCount = (uint32_t)poolSizes.size(),
+        .pPoolSizes = poolSizes.data(),
+    });
+
+    // Every pool that fills up means that the previous estimate was too low
+    setsPerPool = std::min(setsPerPool * 2, MAX_SETS_PER_POOL);
+    return pool;
+}
+
+vk::DescriptorSet DescriptorAllocator::Allocate(vk::DescriptorSetLayout layout)
+{
+    while(true)
+    {
+        const bool newPool = readyPools.empty();
+        if(newPool)
+            readyPools.push_back(createPool());
+
+        vk::DescriptorSetAllocateInfo allocateInfo = {
+            .descriptorPool = *readyPools.back(),
+            .descriptorSetCount = 1,
+            .pSetLayouts = &layout,
+        };
+        vk::DescriptorSet set;
+        vk::Result result = device.allocateDescriptorSets(&allocateInfo, &set);
+        if(result == vk::Result::eSuccess)
+            return set;
+
+        // Drivers may report a full pool either way. Anything else would fail again in every new
+        // pool, and so would a set that doesn't even fit into an empty pool, which needs larger
+        // ratios
+        if(result != vk::Result::eErrorOutOfPoolMemory
+           && result != vk::Result::eErrorFragmentedPool)
+            throw std::runtime_error("Could not allocate descriptor set");
+        if(newPool)
+            throw std::runtime_error("Descriptor set does not fit into an empty pool");
+        fullPools.push_back(std::move(readyPools.back()));
+        readyPools.pop_back();
+    }
+}
+
+void DescriptorAllocator::Reset()
+{
+    for(vk::UniqueDescriptorPool& pool : readyPools)
+        device.resetDescriptorPool(*pool);
+    for(vk::UniqueDescriptorPool& pool : fullPools)
+    {
+        device.resetDescriptorPool(*pool);
+        readyPools.push_back(std::move(pool));
+    }
+    fullPools.clear();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+// Number of descriptors of one type that a pool holds for every set it can allocate
+struct DescriptorTypeRatio
+{
+    vk::DescriptorType type;
+    uint32_t countPerSet;
+};
+
+// Allocates descriptor sets from a chain of pools. A new, larger pool is added whenever the current
+// one runs out, so there is no fixed limit on the number of sets. Sets are never freed one at a
+// time, they are released all at once with Reset. Not thread safe
+class DescriptorAllocator
+{
+  private:
+    vk::Device device;
+    std::vector<DescriptorTypeRatio> ratios;
+    uint32_t setsPerPool = 0;
+    // Pools that failed an allocation are only tried again after a reset
+    std::vector<vk::UniqueDescriptorPool> fullPools;
+    std::vector<vk::UniqueDescriptorPool> readyPools;
+
+    vk::UniqueDescriptorPool createPool();
+
+  public:
+    DescriptorAllocator() = default;
+    // No pool is created until the first allocation
+    DescriptorAllocator(
+        vk::Device device,
+        std::vector<DescriptorTypeRatio> ratios,
+        uint32_t initialSetsPerPool);
+    DescriptorAllocator(const DescriptorAllocator& other) = delete;
+    DescriptorAllocator& operator=(const DescriptorAllocator& other) = delete;
+    DescriptorAllocator(DescriptorAllocator&& other) = default;
+    DescriptorAllocator& operator=(DescriptorAllocator&& other) = default;
+
+    // Throws if the set doesn't fit into an empty pool or the driver fails for another reason
+    vk::DescriptorSet Allocate(vk::DescriptorSetLayout layout);
+    // Invalidates every set allocated so far and keeps the pools for reuse. The GPU must be done
+    // with all of them
+    void Reset();
+};
@@ -22,4 +22,15 @@ namespace FileUtils
 
         return outData;
     }
+
+    bool writeFile(const std::filesystem::path& path, const std::vector<char>& data)
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if(!out.is_open())
+            return false;
+
+        assert(data.size() <= std::numeric_limits<std::streamsize>::max());
+        out.write(data.data(), (std::streamsize)data.size());
+        return out.good();
+    }
 }
@@ -7,4 +7,6 @@
 namespace FileUtils
 {
     std::optional<std::vector<char>> readFile(const std::filesystem::path& path);
+    // Overwrites the file if it exists. Returns false if the file could not be written
+    bool writeFile(const std::filesystem::path& path, const std::vector<char>& data);
 }
\ No newline at end of file
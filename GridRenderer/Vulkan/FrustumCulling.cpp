@@ -0,0 +1,211 @@
+#include "FrustumCulling.h"
+
+#include <algorithm>
+#include <bit>
+
+#if defined(CULLING_AVX2) || defined(CULLING_SSE)
+    #include <immintrin.h>
+#endif
+#if defined(CULLING_AVX2) && defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+// The AVX2 path is compiled for AVX2 on its own, so the rest of the executable still runs on CPUs
+// without it. MSVC allows AVX2 intrinsics in any function
+#if defined(CULLING_AVX2) && defined(_MSC_VER)
+    #define TARGET_AVX2
+#elif defined(CULLING_AVX2)
+    #define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Lane count of the widest path, so that blocks start on a whole number of lanes for every path
+constexpr uint32_t BLOCK_ALIGNMENT = 8;
+// Smaller blocks cost more to hand out to the workers than testing them saves
+constexpr uint32_t MIN_SPHERES_PER_BLOCK = 4096;
+
+// Writes the indices of the visible spheres in [first, end) to visible and returns how many there
+// are
+using CullSpheres = uint32_t (*)(
+    const SphereBounds& bounds,
+    const std::array<glm::vec4, 6>& planes,
+    uint32_t first,
+    uint32_t end,
+    uint32_t* visible);
+
+bool isSphereVisible(
+    const SphereBounds& bounds,
+    const std::array<glm::vec4, 6>& planes,
+    uint32_t index)
+{
+    for(const glm::vec4& plane : planes)
+    {
+        float distance = plane.x * bounds.centerX[index] + plane.y * bounds.centerY[index]
+                         + plane.z * bounds.centerZ[index] + plane.w;
+        if(distance < -bounds.radius[index])
+            return false;
+    }
+    return true;
+}
+
+uint32_t cullSpheresScalar(
+    const SphereBounds& bounds,
+    const std::array<glm::vec4, 6>& planes,
+    uint32_t first,
+    uint32_t end,
+    uint32_t* visible)
+{
+    uint32_t visibleCount = 0;
+    for(; first < end; ++first)
+    {
+        if(isSphereVisible(bounds, planes, first))
+            visible[visibleCount++] = first;
+    }
+    return visibleCount;
+}
+
+#if defined(CULLING_SSE)
+uint32_t cullSpheresSse(
+    const SphereBounds& bounds,
+    const std::array<glm::vec4, 6>& planes,
+    uint32_t first,
+    uint32_t end,
+    uint32_t* visible)
+{
+    uint32_t visibleCount = 0;
+    for(; first + 4 <= end; first += 4)
+    {
+        const __m128 x = _mm_loadu_ps(bounds.centerX.data() + first);
+        const __m128 y = _mm_loadu_ps(bounds.centerY.data() + first);
+        const __m128 z = _mm_loadu_ps(bounds.centerZ.data() + first);
+        const __m128 negativeRadius =
+            _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(bounds.radius.data() + first));
+
+        __m128 inside = _mm_cmpeq_ps(x, x);
+        for(const glm::vec4& plane : planes)
+        {
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(
+                    _mm_mul_ps(x, _mm_set1_ps(plane.x)),
+                    _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+        }
+
+        for(uint32_t mask = (uint32_t)_mm_movemask_ps(inside); mask != 0; mask &= mask - 1)
+            visible[visibleCount++] = first + std::countr_zero(mask);
+    }
+    return visibleCount + cullSpheresScalar(bounds, planes, first, end, visible + visibleCount);
+}
+#endif
+
+#if defined(CULLING_AVX2)
+TARGET_AVX2 uint32_t cullSpheresAvx2(
+    const SphereBounds& bounds,
+    const std::array<glm::vec4, 6>& planes,
+    uint32_t first,
+    uint32_t end,
+    uint32_t* visible)
+{
+    uint32_t visibleCount = 0;
+    for(; first + 8 <= end; first += 8)
+    {
+        const __m256 x = _mm256_loadu_ps(bounds.centerX.data() + first);
+        const __m256 y = _mm256_loadu_ps(bounds.centerY.data() + first);
+        const __m256 z = _mm256_loadu_ps(bounds.centerZ.data() + first);
+        const __m256 negativeRadius =
+            _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(bounds.radius.data() + first));
+
+        // Multiply and add separately since FMA is a separate extension from AVX2
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for(const glm::vec4& plane : planes)
+        {
+            __m256 distance = _mm256_add_ps(
+                _mm256_add_ps(
+                    _mm256_mul_ps(x, _mm256_set1_ps(plane.x)),
+                    _mm256_mul_ps(y, _mm256_set1_ps(plane.y))),
+                _mm256_add_ps(
+                    _mm256_mul_ps(z, _mm256_set1_ps(plane.z)),
+                    _mm256_set1_ps(plane.w)));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+        }
+
+        for(uint32_t mask = (uint32_t)_mm256_movemask_ps(inside); mask != 0; mask &= mask - 1)
+            visible[visibleCount++] = first + std::countr_zero(mask);
+    }
+    return visibleCount + cullSpheresScalar(bounds, planes, first, end, visible + visibleCount);
+}
+
+bool cpuSupportsAvx2()
+{
+#if defined(_MSC_VER)
+    // AVX2 also needs the OS to save the upper halves of the registers, see the Intel SDM
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const bool osSavesAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28))
+                            && (_xgetbv(0) & 0x6) == 0x6;
+    __cpuidex(info, 7, 0);
+    return osSavesAvx && (info[1] & (1 << 5));
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// The widest path that both the build and the CPU support
+CullSpheres selectCullSpheres()
+{
+#if defined(CULLING_AVX2)
+    if(cpuSupportsAvx2())
+        return cullSpheresAvx2;
+#endif
+#if defined(CULLING_SSE)
+    return cullSpheresSse;
+#else
+    return cullSpheresScalar;
+#endif
+}
+
+uint32_t frustumCull(
+    WorkerPool& workerPool,
+    const SphereBounds& bounds,
+    const std::array<glm::vec4, 6>& planes,
+    uint32_t* visible)
+{
+    const uint32_t sphereCount = (uint32_t)bounds.radius.size();
+    if(sphereCount == 0)
+        return 0;
+
+    static const CullSpheres cullSpheres = selectCullSpheres();
+
+    // Blocks start on a whole number of lanes so that only the last block has a partial group
+    const uint32_t blockCount =
+        std::clamp(sphereCount / MIN_SPHERES_PER_BLOCK, 1u, workerPool.GetWorkerCount());
+    const uint32_t spheresPerBlock = ((sphereCount + blockCount - 1) / blockCount
+                                      + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+
+    // Every block writes its visible spheres to the start of its own range, which are then moved
+    // next to each other
+    std::vector<uint32_t> blockVisibleCounts(blockCount);
+    auto cullBlock = [&](uint32_t block, uint32_t) {
+        const uint32_t begin = std::min(block * spheresPerBlock, sphereCount);
+        const uint32_t end = std::min(begin + spheresPerBlock, sphereCount);
+        blockVisibleCounts[block] = cullSpheres(bounds, planes, begin, end, visible + begin);
+    };
+    if(blockCount == 1)
+        cullBlock(0, 0);
+    else
+        workerPool.Run(blockCount, cullBlock);
+
+    uint32_t totalVisible = blockVisibleCounts[0];
+    for(uint32_t block = 1; block < blockCount; ++block)
+    {
+        const uint32_t* blockVisible = visible + std::min(block * spheresPerBlock, sphereCount);
+        std::copy(blockVisible, blockVisible + blockVisibleCounts[block], visible + totalVisible);
+        totalVisible += blockVisibleCounts[block];
+    }
+
+    return totalVisible;
+}
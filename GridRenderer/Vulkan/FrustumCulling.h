@@ -0,0 +1,30 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <glm/vec4.hpp>
+
+#include "WorkerPool.h"
+
+// Bounding spheres in structure-of-arrays layout, so that consecutive spheres load straight into
+// SIMD registers. All four arrays have the same size
+struct SphereBounds
+{
+    std::vector<float> centerX;
+    std::vector<float> centerY;
+    std::vector<float> centerZ;
+    std::vector<float> radius;
+};
+
+// Writes the indices of the spheres that are at least partially inside all six planes to visible,
+// in increasing order, and returns how many there are. visible needs room for every sphere. Planes
+// are in the format returned by CameraVulkan::GetFrustumPlanes. Blocks of spheres are tested in
+// parallel, 8 at a time with CULLING_AVX2 on CPUs that support it, 4 with CULLING_SSE and one at a
+// time otherwise. Must not be called from inside a worker pool task
+uint32_t frustumCull(
+    WorkerPool& workerPool,
+    const SphereBounds& bounds,
+    const std::array<glm::vec4, 6>& planes,
+    uint32_t* visible);
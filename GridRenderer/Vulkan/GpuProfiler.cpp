@@ -0,0 +1,220 @@
+#include "GpuProfiler.h"
+
+#include <cassert>
+#include <tuple>
+
+// Plenty for the handful of regions a frame has, every region uses two timestamps
+constexpr uint32_t MAX_REGIONS_PER_FRAME = 32;
+constexpr vk::QueryPipelineStatisticFlags PIPELINE_STATISTICS =
+    vk::QueryPipelineStatisticFlagBits::eVertexShaderInvocations
+    | vk::QueryPipelineStatisticFlagBits::eClippingInvocations
+    | vk::QueryPipelineStatisticFlagBits::eClippingPrimitives
+    | vk::QueryPipelineStatisticFlagBits::eFragmentShaderInvocations;
+static_assert(sizeof(GpuPipelineStatistics) == 4 * sizeof(uint64_t));
+
+// Extension functions are not exported by the loader, see vkCreateDebugUtilsMessengerEXT in
+// RendererVulkan.cpp
+PFN_vkCmdBeginDebugUtilsLabelEXT pfnVkCmdBeginDebugUtilsLabelEXT;
+PFN_vkCmdEndDebugUtilsLabelEXT pfnVkCmdEndDebugUtilsLabelEXT;
+VKAPI_ATTR void VKAPI_CALL vkCmdBeginDebugUtilsLabelEXT(
+    VkCommandBuffer commandBuffer,
+    const VkDebugUtilsLabelEXT* pLabelInfo)
+{
+    pfnVkCmdBeginDebugUtilsLabelEXT(commandBuffer, pLabelInfo);
+}
+VKAPI_ATTR void VKAPI_CALL vkCmdEndDebugUtilsLabelEXT(VkCommandBuffer commandBuffer)
+{
+    pfnVkCmdEndDebugUtilsLabelEXT(commandBuffer);
+}
+
+GpuProfiler::GpuProfiler(
+    vk::Instance instance,
+    vk::PhysicalDevice physicalDevice,
+    vk::Device device,
+    uint32_t queueFamilyIndex,
+    uint32_t framesInFlight,
+    bool pipelineStatistics,
+    bool debugLabels)
+    : device(device)
+    , statisticsSupported(pipelineStatistics)
+    , labelsEnabled(debugLabels)
+{
+    // Queues without valid bits don't write timestamps at all
+    const auto queueProperties = physicalDevice.getQueueFamilyProperties()[queueFamilyIndex];
+    this->timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+    this->timestampsSupported = queueProperties.timestampValidBits > 0 && timestampPeriod > 0.0f;
+
+    if(labelsEnabled)
+    {
+        pfnVkCmdBeginDebugUtilsLabelEXT = (PFN_vkCmdBeginDebugUtilsLabelEXT)instance.getProcAddr(
+            "vkCmdBeginDebugUtilsLabelEXT");
+        pfnVkCmdEndDebugUtilsLabelEXT =
+            (PFN_vkCmdEndDebugUtilsLabelEXT)instance.getProcAddr("vkCmdEndDebugUtilsLabelEXT");
+        labelsEnabled = pfnVkCmdBeginDebugUtilsLabelEXT && pfnVkCmdEndDebugUtilsLabelEXT;
+    }
+
+    for(uint32_t i = 0; i < framesInFlight; ++i)
+    {
+        FrameQueries queries;
+        if(timestampsSupported)
+        {
+            queries.timestamps = device.createQueryPoolUnique({
+                .queryType = vk::QueryType::eTimestamp,
+                .queryCount = MAX_REGIONS_PER_FRAME * 2,
+            });
+        }
+        if(statisticsSupported)
+        {
+            queries.statistics = device.createQueryPoolUnique({
+                .queryType = vk::QueryType::ePipelineStatistics,
+                .queryCount = 1,
+                .pipelineStatistics = PIPELINE_STATISTICS,
+            });
+        }
+        queries.usedTimestamps = 0;
+        queries.statisticsWritten = false;
+        queries.frame = 0;
+        frames.push_back(std::move(queries));
+    }
+}
+
+void GpuProfiler::readResults(FrameQueries& queries)
+{
+    lastStatistics.frame = queries.frame;
+    lastStatistics.regions.clear();
+    lastStatistics.hasPipelineStatistics = queries.statisticsWritten;
+    lastStatistics.pipelineStatistics = {};
+
+    // The frame has completed, so waiting only makes sure that the results are complete
+    constexpr vk::QueryResultFlags resultFlags =
+        vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait;
+    if(queries.usedTimestamps > 0)
+    {
+        vk::Result result;
+        std::vector<uint64_t> timestamps;
+        std::tie(result, timestamps) = device.getQueryPoolResults<uint64_t>(
+            *queries.timestamps,
+            0,
+            queries.usedTimestamps,
+            queries.usedTimestamps * sizeof(uint64_t),
+            sizeof(uint64_t),
+            resultFlags);
+        assert(result == vk::Result::eSuccess);
+
+        for(const Region& region : queries.regions)
+        {
+            const uint64_t ticks = timestamps[region.endQuery] - timestamps[region.beginQuery];
+            lastStatistics.regions.push_back({
+                .name = region.name,
+                .depth = region.depth,
+                .milliseconds = ticks * (double)timestampPeriod / 1e6,
+            });
+        }
+    }
+
+    if(queries.statisticsWritten)
+    {
+        vk::Result result = device.getQueryPoolResults(
+            *queries.statistics,
+            0,
+            1,
+            sizeof(GpuPipelineStatistics),
+            &lastStatistics.pipelineStatistics,
+            sizeof(GpuPipelineStatistics),
+            resultFlags);
+        assert(result == vk::Result::eSuccess);
+    }
+}
+
+void GpuProfiler::BeginFrame(vk::CommandBuffer commandBuffer, uint32_t slot, uint64_t frame)
+{
+    assert(openRegions.empty());
+    currentSlot = slot;
+    FrameQueries& queries = frames[slot];
+    if(!queries.regions.empty() || queries.statisticsWritten)
+        readResults(queries);
+
+    if(timestampsSupported)
+        commandBuffer.resetQueryPool(*queries.timestamps, 0, MAX_REGIONS_PER_FRAME * 2);
+    if(statisticsSupported)
+        commandBuffer.resetQueryPool(*queries.statistics, 0, 1);
+    queries.regions.clear();
+    queries.usedTimestamps = 0;
+    queries.statisticsWritten = false;
+    queries.frame = frame;
+}
+
+void GpuProfiler::BeginRegion(vk::CommandBuffer commandBuffer, const char* name)
+{
+    FrameQueries& queries = frames[currentSlot];
+    assert(queries.regions.size() < MAX_REGIONS_PER_FRAME);
+
+    if(labelsEnabled)
+        commandBuffer.beginDebugUtilsLabelEXT({.pLabelName = name});
+
+    Region region = {
+        .name = name,
+        .depth = (uint32_t)openRegions.size(),
+        .beginQuery = 0,
+        .endQuery = 0,
+    };
+    if(timestampsSupported)
+    {
+        region.beginQuery = queries.usedTimestamps++;
+        commandBuffer.writeTimestamp(
+            vk::PipelineStageFlagBits::eTopOfPipe,
+            *queries.timestamps,
+            region.beginQuery);
+    }
+    openRegions.push_back((uint32_t)queries.regions.size());
+    queries.regions.push_back(region);
+}
+
+void GpuProfiler::EndRegion(vk::CommandBuffer commandBuffer)
+{
+    assert(!openRegions.empty());
+    FrameQueries& queries = frames[currentSlot];
+    Region& region = queries.regions[openRegions.back()];
+    openRegions.pop_back();
+
+    // Once everything before it has finished
+    if(timestampsSupported)
+    {
+        region.endQuery = queries.usedTimestamps++;
+        commandBuffer.writeTimestamp(
+            vk::PipelineStageFlagBits::eBottomOfPipe,
+            *queries.timestamps,
+            region.endQuery);
+    }
+
+    if(labelsEnabled)
+        commandBuffer.endDebugUtilsLabelEXT();
+}
+
+void GpuProfiler::BeginPipelineStatistics(vk::CommandBuffer commandBuffer)
+{
+    FrameQueries& queries = frames[currentSlot];
+    assert(!queries.statisticsWritten);
+    if(statisticsSupported)
+        commandBuffer.beginQuery(*queries.statistics, 0, {});
+}
+
+void GpuProfiler::EndPipelineStatistics(vk::CommandBuffer commandBuffer)
+{
+    FrameQueries& queries = frames[currentSlot];
+    if(statisticsSupported)
+    {
+        commandBuffer.endQuery(*queries.statistics, 0);
+        queries.statisticsWritten = true;
+    }
+}
+
+vk::QueryPipelineStatisticFlags GpuProfiler::GetPipelineStatisticFlags() const
+{
+    return statisticsSupported ? PIPELINE_STATISTICS : vk::QueryPipelineStatisticFlags();
+}
+
+const GpuFrameStatistics& GpuProfiler::GetLastFrameStatistics() const
+{
+    return lastStatistics;
+}
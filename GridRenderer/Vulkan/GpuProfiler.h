@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+struct GpuRegionTiming
+{
+    std::string name;
+    // 0 for regions that are not inside any other region
+    uint32_t depth;
+    double milliseconds;
+};
+
+// In the order of the flag bits, which is the order the query returns them in
+struct GpuPipelineStatistics
+{
+    uint64_t vertexShaderInvocations;
+    // Primitives that reached clipping, and primitives that came out of it
+    uint64_t clippingInvocations;
+    uint64_t clippingPrimitives;
+    uint64_t fragmentShaderInvocations;
+};
+
+struct GpuFrameStatistics
+{
+    uint64_t frame;
+    // In the order the regions began
+    std::vector<GpuRegionTiming> regions;
+    // False when the device doesn't support pipeline statistics or inherited queries
+    bool hasPipelineStatistics;
+    GpuPipelineStatistics pipelineStatistics;
+};
+
+// Measures named regions of a frame with timestamp queries and labels them with debug utils so
+// that they show up in external captures. Every frame in flight has its own queries, which are read
+// back when its slot is reused, so reading never waits for the GPU. Not thread safe
+class GpuProfiler
+{
+  private:
+    struct Region
+    {
+        const char* name;
+        uint32_t depth;
+        uint32_t beginQuery;
+        uint32_t endQuery;
+    };
+
+    struct FrameQueries
+    {
+        vk::UniqueQueryPool timestamps;
+        vk::UniqueQueryPool statistics;
+        std::vector<Region> regions;
+        uint32_t usedTimestamps;
+        bool statisticsWritten;
+        uint64_t frame;
+    };
+
+    vk::Device device;
+    std::vector<FrameQueries> frames;
+    uint32_t currentSlot = 0;
+    // Nanoseconds per timestamp tick
+    float timestampPeriod = 0.0f;
+    bool timestampsSupported = false;
+    bool statisticsSupported = false;
+    bool labelsEnabled = false;
+    // Indices into the current frame's regions
+    std::vector<uint32_t> openRegions;
+    GpuFrameStatistics lastStatistics = {};
+
+    void readResults(FrameQueries& queries);
+
+  public:
+    GpuProfiler() = default;
+    // Pipeline statistics require both the pipelineStatisticsQuery and the inheritedQueries
+    // features, since the draws are recorded into secondary command buffers. Labels require
+    // VK_EXT_debug_utils to be enabled on the instance
+    GpuProfiler(
+        vk::Instance instance,
+        vk::PhysicalDevice physicalDevice,
+        vk::Device device,
+        uint32_t queueFamilyIndex,
+        uint32_t framesInFlight,
+        bool pipelineStatistics,
+        bool debugLabels);
+    GpuProfiler(const GpuProfiler& other) = delete;
+    GpuProfiler& operator=(const GpuProfiler& other) = delete;
+    GpuProfiler(GpuProfiler&& other) = default;
+    GpuProfiler& operator=(GpuProfiler&& other) = default;
+
+    // Reads the results of the frame that last used slot, which the GPU must have completed, and
+    // resets its queries. Has to be recorded outside of a render pass
+    void BeginFrame(vk::CommandBuffer commandBuffer, uint32_t slot, uint64_t frame);
+    // Regions nest, and each one begins and ends in the same primary command buffer. The name must
+    // outlive the frame
+    void BeginRegion(vk::CommandBuffer commandBuffer, const char* name);
+    void EndRegion(vk::CommandBuffer commandBuffer);
+    // Counted over everything in between, at most once per frame. Both have to be recorded
+    // outside of a render pass
+    void BeginPipelineStatistics(vk::CommandBuffer commandBuffer);
+    void EndPipelineStatistics(vk::CommandBuffer commandBuffer);
+    // Secondary command buffers executed while the statistics are counted have to inherit these
+    vk::QueryPipelineStatisticFlags GetPipelineStatisticFlags() const;
+
+    // Of the last frame whose results have been read, see BeginFrame
+    const GpuFrameStatistics& GetLastFrameStatistics() const;
+};
@@ -1,23 +1,60 @@
 #include "GraphicsRenderPassVulkan.h"
 
+#include <cassert>
 #include <fstream>
 #include <stdexcept>
 
 GraphicsRenderPassVulkan::GraphicsRenderPassVulkan(
-    const vk::UniqueShaderModule& vsShader,
-    const vk::UniqueShaderModule& fsShader,
+    vk::Pipeline pipeline,
+    vk::Pipeline depthPrepassPipeline,
+    vk::Pipeline depthEqualPipeline,
+    vk::PipelineLayout pipelineLayout,
     std::vector<PipelineBinding> objectBindings,
     std::vector<PipelineBinding> globalBindings)
-    : vsShader(vsShader)
-    , fsShader(fsShader)
+    : pipeline(pipeline)
+    , depthPrepassPipeline(depthPrepassPipeline)
+    , depthEqualPipeline(depthEqualPipeline)
+    , pipelineLayout(pipelineLayout)
     , objectBindings(objectBindings)
     , globalBindings(globalBindings)
 {
 }
 
+vk::Pipeline GraphicsRenderPassVulkan::GetPipeline() const
+{
+    return pipeline;
+}
+
+vk::Pipeline GraphicsRenderPassVulkan::GetDepthPrepassPipeline() const
+{
+    return depthPrepassPipeline;
+}
+
+vk::Pipeline GraphicsRenderPassVulkan::GetDepthEqualPipeline() const
+{
+    return depthEqualPipeline;
+}
+
+bool GraphicsRenderPassVulkan::HasDepthPrepass() const
+{
+    return depthPrepassPipeline != VK_NULL_HANDLE;
+}
+
+vk::PipelineLayout GraphicsRenderPassVulkan::GetPipelineLayout() const
+{
+    return pipelineLayout;
+}
+
 void GraphicsRenderPassVulkan::SetGlobalSampler(
     PipelineShaderStage shader,
     std::uint8_t slot,
     ResourceIndex index)
 {
+    assert(shader == PipelineShaderStage::PS && slot == 0);
+    globalSampler = index;
+}
+
+ResourceIndex GraphicsRenderPassVulkan::GetGlobalSampler() const
+{
+    return globalSampler;
 }
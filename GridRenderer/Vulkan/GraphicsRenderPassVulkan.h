@@ -8,15 +8,23 @@
 class GraphicsRenderPassVulkan: public GraphicsRenderPass
 {
   private:
-    const vk::UniqueShaderModule& vsShader;
-    const vk::UniqueShaderModule& fsShader;
+    // Owned by the renderer's pipeline cache, which may share them between several passes
+    vk::Pipeline pipeline;
+    // Null if the pass has no depth-only vertex shader
+    vk::Pipeline depthPrepassPipeline;
+    vk::Pipeline depthEqualPipeline;
+    vk::PipelineLayout pipelineLayout;
     std::vector<PipelineBinding> objectBindings;
     std::vector<PipelineBinding> globalBindings;
+    // Bound with the pass, see BindingFrequency::PER_PASS. Only fragment slot 0 exists
+    ResourceIndex globalSampler = ResourceIndex(-1);
 
   public:
     GraphicsRenderPassVulkan(
-        const vk::UniqueShaderModule& vsShader,
-        const vk::UniqueShaderModule& fsShader,
+        vk::Pipeline pipeline,
+        vk::Pipeline depthPrepassPipeline,
+        vk::Pipeline depthEqualPipeline,
+        vk::PipelineLayout pipelineLayout,
         std::vector<PipelineBinding> objectBindings,
         std::vector<PipelineBinding> globalBindings);
     GraphicsRenderPassVulkan(const GraphicsRenderPassVulkan& other) = delete;
@@ -24,9 +32,16 @@ class GraphicsRenderPassVulkan: public GraphicsRenderPass
     GraphicsRenderPassVulkan(GraphicsRenderPassVulkan&& other) = default;
     GraphicsRenderPassVulkan& operator=(GraphicsRenderPassVulkan&& other) = delete;
 
+    vk::Pipeline GetPipeline() const;
+    vk::Pipeline GetDepthPrepassPipeline() const;
+    // Shades the fragments that are left after the depth prepass
+    vk::Pipeline GetDepthEqualPipeline() const;
+    bool HasDepthPrepass() const;
+    vk::PipelineLayout GetPipelineLayout() const;
     const std::vector<PipelineBinding>& GetObjectBindings();
     const std::vector<PipelineBinding>& GetGlobalBindings();
 
     void SetGlobalSampler(PipelineShaderStage shader, std::uint8_t slot, ResourceIndex index)
         override;
+    ResourceIndex GetGlobalSampler() const;
 };
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace HashUtils
+{
+    constexpr uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+    constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+    // 64-bit FNV-1a. Pass a previous hash as seed to hash several pieces of data in sequence
+    inline uint64_t fnv1a(const void* data, size_t size, uint64_t seed = FNV_OFFSET_BASIS)
+    {
+        const uint8_t* bytes = (const uint8_t*)data;
+        uint64_t hash = seed;
+        for(size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= FNV_PRIME;
+        }
+        return hash;
+    }
+
+    // Only for single values such as integers and enums, structs may contain padding
+    template<typename T>
+    uint64_t hashValue(const T& value, uint64_t seed = FNV_OFFSET_BASIS)
+    {
+        static_assert(std::is_integral_v<T> || std::is_enum_v<T>);
+        return fnv1a(&value, sizeof(T), seed);
+    }
+}
@@ -0,0 +1,79 @@
+#include "RadixSort.h"
+
+#include <algorithm>
+#include <array>
+
+constexpr uint32_t DIGIT_BITS = 8;
+constexpr uint32_t BUCKET_COUNT = 1 << DIGIT_BITS;
+constexpr uint32_t PASS_COUNT = 64 / DIGIT_BITS;
+// Smaller blocks cost more to hand out to the workers than sorting them saves
+constexpr uint32_t MIN_ITEMS_PER_BLOCK = 4096;
+
+void radixSort(
+    WorkerPool& workerPool,
+    std::vector<SortItem>& items,
+    std::vector<SortItem>& scratch)
+{
+    const uint32_t itemCount = (uint32_t)items.size();
+    if(itemCount < 2)
+        return;
+
+    const uint32_t blockCount =
+        std::clamp(itemCount / MIN_ITEMS_PER_BLOCK, 1u, workerPool.GetWorkerCount());
+    const uint32_t itemsPerBlock = (itemCount + blockCount - 1) / blockCount;
+    auto runBlocks = [&](const std::function<void(uint32_t, uint32_t)>& task) {
+        if(blockCount == 1)
+            task(0, 0);
+        else
+            workerPool.Run(blockCount, task);
+    };
+
+    scratch.resize(itemCount);
+    // First the number of items per bucket in every block, then where the block writes each bucket
+    std::vector<std::array<uint32_t, BUCKET_COUNT>> blockOffsets(blockCount);
+
+    for(uint32_t pass = 0; pass < PASS_COUNT; ++pass)
+    {
+        const uint32_t shift = pass * DIGIT_BITS;
+
+        runBlocks([&](uint32_t block, uint32_t) {
+            std::array<uint32_t, BUCKET_COUNT>& histogram = blockOffsets[block];
+            histogram.fill(0);
+
+            const uint32_t begin = block * itemsPerBlock;
+            const uint32_t end = std::min(begin + itemsPerBlock, itemCount);
+            for(uint32_t i = begin; i < end; ++i)
+                ++histogram[(items[i].key >> shift) & (BUCKET_COUNT - 1)];
+        });
+
+        // Buckets are written in order, and within a bucket blocks are written in order, which
+        // keeps the sort stable
+        bool singleBucket = false;
+        uint32_t nextOffset = 0;
+        for(uint32_t bucket = 0; bucket < BUCKET_COUNT; ++bucket)
+        {
+            const uint32_t bucketStart = nextOffset;
+            for(uint32_t block = 0; block < blockCount; ++block)
+            {
+                uint32_t count = blockOffsets[block][bucket];
+                blockOffsets[block][bucket] = nextOffset;
+                nextOffset += count;
+            }
+
+            if(nextOffset - bucketStart == itemCount)
+                singleBucket = true;
+        }
+        if(singleBucket)
+            continue;
+
+        runBlocks([&](uint32_t block, uint32_t) {
+            std::array<uint32_t, BUCKET_COUNT>& offsets = blockOffsets[block];
+
+            const uint32_t begin = block * itemsPerBlock;
+            const uint32_t end = std::min(begin + itemsPerBlock, itemCount);
+            for(uint32_t i = begin; i < end; ++i)
+                scratch[offsets[(items[i].key >> shift) & (BUCKET_COUNT - 1)]++] = items[i];
+        });
+        items.swap(scratch);
+    }
+}
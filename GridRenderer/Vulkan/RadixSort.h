@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "WorkerPool.h"
+
+struct SortItem
+{
+    uint64_t key;
+    uint32_t value;
+};
+
+// Stable LSD radix sort on the keys, 8 bits per pass. Every pass histograms and scatters blocks of
+// items in parallel. Passes where all keys share the same digit are skipped, so unused high bits
+// are almost free. Must not be called from inside a worker pool task
+void radixSort(
+    WorkerPool& workerPool,
+    std::vector<SortItem>& items,
+    std::vector<SortItem>& scratch);
@@ -0,0 +1,608 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+#include <cassert>
+#include <optional>
+
+#include "../Profiler.h"
+#include "StlHelpers/EntireCollection.h"
+
+// Everything else only reads. Layout transitions count as writes too, see addBarrier
+constexpr vk::AccessFlags2 WRITE_ACCESS =
+    vk::AccessFlagBits2::eShaderWrite | vk::AccessFlagBits2::eShaderStorageWrite
+    | vk::AccessFlagBits2::eColorAttachmentWrite
+    | vk::AccessFlagBits2::eDepthStencilAttachmentWrite | vk::AccessFlagBits2::eTransferWrite
+    | vk::AccessFlagBits2::eHostWrite | vk::AccessFlagBits2::eMemoryWrite;
+
+vk::ImageAspectFlags getAspectMask(vk::Format format)
+{
+    switch(format)
+    {
+        case vk::Format::eD16Unorm:
+        case vk::Format::eX8D24UnormPack32:
+        case vk::Format::eD32Sfloat: return vk::ImageAspectFlagBits::eDepth;
+        case vk::Format::eD16UnormS8Uint:
+        case vk::Format::eD24UnormS8Uint:
+        case vk::Format::eD32SfloatS8Uint:
+            return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+        default: return vk::ImageAspectFlagBits::eColor;
+    }
+}
+
+vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+RenderGraph::PassBuilder::PassBuilder(Pass& pass) : pass(pass) {}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::Read(
+    RenderGraphResource resource,
+    vk::PipelineStageFlags2 stages,
+    vk::AccessFlags2 access,
+    vk::ImageLayout layout)
+{
+    // Every access of a pass is synchronized with the same barrier, so one per resource is enough
+    assert(std::none_of(entire_collection(pass.accesses), [&](const Access& other) {
+        return other.resource == resource;
+    }));
+    pass.accesses.push_back({
+        .resource = resource,
+        .stages = stages,
+        .access = access,
+        .layout = layout,
+        .write = false,
+    });
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::Write(
+    RenderGraphResource resource,
+    vk::PipelineStageFlags2 stages,
+    vk::AccessFlags2 access,
+    vk::ImageLayout layout)
+{
+    Read(resource, stages, access, layout);
+    pass.accesses.back().write = true;
+    return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::SideEffects()
+{
+    pass.sideEffects = true;
+    return *this;
+}
+
+RenderGraph::RenderGraph(
+    vk::Device device,
+    vk::PhysicalDevice physicalDevice,
+    uint32_t framesInFlight)
+    : device(device)
+    , physicalDevice(physicalDevice)
+    , framesInFlight(framesInFlight)
+{
+}
+
+RenderGraphResource RenderGraph::ImportBuffer(
+    const char* name,
+    vk::Buffer buffer,
+    vk::DeviceSize offset,
+    vk::DeviceSize size,
+    RenderGraphResourceState* state)
+{
+    assert(!compiled);
+    resources.push_back({
+        .name = name,
+        .buffer = buffer,
+        .offset = offset,
+        .size = size,
+        .image = VK_NULL_HANDLE,
+        .range = {},
+        .state = {},
+        .importedState = state,
+        .transientIndex = UINT32_MAX,
+        .exported = false,
+    });
+    return (RenderGraphResource)resources.size() - 1;
+}
+
+RenderGraphResource RenderGraph::ImportImage(
+    const char* name,
+    vk::Image image,
+    const vk::ImageSubresourceRange& range,
+    RenderGraphResourceState* state)
+{
+    assert(!compiled);
+    resources.push_back({
+        .name = name,
+        .buffer = VK_NULL_HANDLE,
+        .offset = 0,
+        .size = 0,
+        .image = image,
+        .range = range,
+        .state = {},
+        .importedState = state,
+        .transientIndex = UINT32_MAX,
+        .exported = false,
+    });
+    return (RenderGraphResource)resources.size() - 1;
+}
+
+RenderGraphResource RenderGraph::CreateTransientImage(
+    const char* name,
+    const vk::ImageCreateInfo& info)
+{
+    assert(!compiled);
+    vk::ImageCreateInfo createInfo = info;
+    createInfo.sharingMode = vk::SharingMode::eExclusive;
+    createInfo.queueFamilyIndexCount = 0;
+    createInfo.pQueueFamilyIndices = nullptr;
+    createInfo.initialLayout = vk::ImageLayout::eUndefined;
+    transientImages.push_back({
+        .createInfo = createInfo,
+        .firstPass = UINT32_MAX,
+        .lastPass = UINT32_MAX,
+    });
+
+    // The image is only known once the graph is compiled
+    resources.push_back({
+        .name = name,
+        .buffer = VK_NULL_HANDLE,
+        .offset = 0,
+        .size = 0,
+        .image = VK_NULL_HANDLE,
+        .range =
+            {
+                .aspectMask = getAspectMask(createInfo.format),
+                .baseMipLevel = 0,
+                .levelCount = createInfo.mipLevels,
+                .baseArrayLayer = 0,
+                .layerCount = createInfo.arrayLayers,
+            },
+        .state = {},
+        .importedState = nullptr,
+        .transientIndex = (uint32_t)transientImages.size() - 1,
+        .exported = false,
+    });
+    return (RenderGraphResource)resources.size() - 1;
+}
+
+void RenderGraph::Export(
+    RenderGraphResource resource,
+    vk::PipelineStageFlags2 stages,
+    vk::AccessFlags2 access,
+    vk::ImageLayout layout)
+{
+    // Transient images don't outlive the frame
+    assert(resources[resource].transientIndex == UINT32_MAX);
+    resources[resource].exported = true;
+    if(stages || layout != vk::ImageLayout::eUndefined)
+    {
+        exports.push_back({
+            .resource = resource,
+            .stages = stages,
+            .access = access,
+            .layout = layout,
+            .write = false,
+        });
+    }
+}
+
+RenderGraph::PassBuilder RenderGraph::AddPass(
+    const char* name,
+    std::function<void(vk::CommandBuffer)> record)
+{
+    assert(!compiled);
+    passes.push_back({
+        .name = name,
+        .record = std::move(record),
+        .accesses = {},
+        .sideEffects = false,
+        .culled = false,
+    });
+    return PassBuilder(passes.back());
+}
+
+void RenderGraph::cullPasses()
+{
+    // Walks backwards, so a pass is kept once a kept pass after it uses what it writes. A pass
+    // that overwrites a resource without reading it still keeps the writes before it, which only
+    // errs on the side of recording too much
+    std::vector<bool> used(resources.size());
+    for(size_t i = 0; i < resources.size(); ++i)
+        used[i] = resources[i].exported;
+
+    for(auto pass = passes.rbegin(); pass != passes.rend(); ++pass)
+    {
+        const bool writesUsed =
+            std::any_of(entire_collection(pass->accesses), [&](const Access& access) {
+                return access.write && used[access.resource];
+            });
+        pass->culled = !pass->sideEffects && !writesUsed;
+        if(pass->culled)
+            continue;
+
+        for(const Access& access : pass->accesses)
+            used[access.resource] = true;
+    }
+}
+
+void RenderGraph::placeTransientImages(uint64_t frame)
+{
+    for(uint32_t passIndex = 0; passIndex < passes.size(); ++passIndex)
+    {
+        if(passes[passIndex].culled)
+            continue;
+
+        for(const Access& access : passes[passIndex].accesses)
+        {
+            const uint32_t transientIndex = resources[access.resource].transientIndex;
+            if(transientIndex == UINT32_MAX)
+                continue;
+
+            TransientImageDescription& description = transientImages[transientIndex];
+            if(description.firstPass == UINT32_MAX)
+                description.firstPass = passIndex;
+            description.lastPass = passIndex;
+        }
+    }
+
+    // Largest first, each at the lowest offset that doesn't overlap an image placed before it
+    // whose passes overlap its own. Images that are never alive at the same time share memory
+    std::vector<uint32_t> order;
+    std::vector<vk::MemoryRequirements> requirements(transientImages.size());
+    for(uint32_t i = 0; i < transientImages.size(); ++i)
+    {
+        if(transientImages[i].firstPass == UINT32_MAX)
+            continue;
+
+        order.push_back(i);
+        vk::DeviceImageMemoryRequirements requirementsInfo = {
+            .pCreateInfo = &transientImages[i].createInfo,
+            .planeAspect = {},
+        };
+        requirements[i] = device.getImageMemoryRequirements(requirementsInfo).memoryRequirements;
+    }
+    std::stable_sort(entire_collection(order), [&](uint32_t first, uint32_t second) {
+        return requirements[first].size > requirements[second].size;
+    });
+
+    std::vector<vk::DeviceSize> offsets(transientImages.size());
+    std::vector<uint32_t> placed;
+    std::vector<uint32_t> overlapping;
+    vk::DeviceSize heapSize = 0;
+    uint32_t memoryTypeBits = ~0u;
+    for(uint32_t i : order)
+    {
+        const TransientImageDescription& description = transientImages[i];
+        overlapping.clear();
+        for(uint32_t other : placed)
+        {
+            if(transientImages[other].firstPass <= description.lastPass
+               && description.firstPass <= transientImages[other].lastPass)
+                overlapping.push_back(other);
+        }
+        std::sort(entire_collection(overlapping), [&](uint32_t first, uint32_t second) {
+            return offsets[first] < offsets[second];
+        });
+
+        vk::DeviceSize offset = 0;
+        for(uint32_t other : overlapping)
+        {
+            if(offset + requirements[i].size <= offsets[other])
+                break;
+            offset = std::max(
+                offset,
+                alignUp(offsets[other] + requirements[other].size, requirements[i].alignment));
+        }
+
+        offsets[i] = offset;
+        placed.push_back(i);
+        heapSize = std::max(heapSize, offset + requirements[i].size);
+        memoryTypeBits &= requirements[i].memoryTypeBits;
+    }
+
+    // Images and memory are only recreated when something changed, e.g. after a resize
+    std::vector<PlacedImage> placements;
+    placedImages.assign(transientImages.size(), UINT32_MAX);
+    for(uint32_t i = 0; i < transientImages.size(); ++i)
+    {
+        if(transientImages[i].firstPass == UINT32_MAX)
+            continue;
+
+        const vk::ImageCreateInfo& info = transientImages[i].createInfo;
+        placedImages[i] = (uint32_t)placements.size();
+        placements.push_back({
+            .imageType = info.imageType,
+            .format = info.format,
+            .extent = info.extent,
+            .mipLevels = info.mipLevels,
+            .arrayLayers = info.arrayLayers,
+            .samples = info.samples,
+            .usage = info.usage,
+            .offset = offsets[i],
+            .size = requirements[i].size,
+        });
+    }
+
+    const bool heapMatches = std::equal(
+        entire_collection(placements),
+        entire_collection(heap.images),
+        [](const PlacedImage& placement, const TransientImage& image) {
+            return placement == image.placement;
+        });
+    if(!heapMatches)
+    {
+        // Earlier frames may still be using the old images
+        if(heap.memory)
+            retiredHeaps.push_back(std::move(heap));
+        heap = {};
+
+        if(!placements.empty())
+        {
+            vk::PhysicalDeviceMemoryProperties memoryProperties =
+                physicalDevice.getMemoryProperties();
+            std::optional<uint32_t> memoryIndexOpt;
+            for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+            {
+                bool memoryTypeSupported = memoryTypeBits & (1 << i);
+
+                if(memoryTypeSupported
+                   && memoryProperties.memoryTypes[i].propertyFlags
+                          & vk::MemoryPropertyFlagBits::eDeviceLocal)
+                {
+                    memoryIndexOpt = i;
+                    break;
+                }
+            }
+            assert(memoryIndexOpt.has_value());
+
+            heap.memory = device.allocateMemoryUnique({
+                .allocationSize = heapSize,
+                .memoryTypeIndex = memoryIndexOpt.value(),
+            });
+        }
+
+        for(uint32_t i = 0; i < transientImages.size(); ++i)
+        {
+            if(placedImages[i] == UINT32_MAX)
+                continue;
+
+            const PlacedImage& placement = placements[placedImages[i]];
+            vk::UniqueImage image = device.createImageUnique(transientImages[i].createInfo);
+            device.bindImageMemory(*image, *heap.memory, placement.offset);
+            heap.images.push_back({
+                .placement = placement,
+                .image = std::move(image),
+                .views = {},
+                .state = {},
+            });
+        }
+    }
+    heap.lastFrame = frame;
+
+    std::erase_if(retiredHeaps, [&](const TransientHeap& retired) {
+        return retired.lastFrame + framesInFlight <= frame;
+    });
+
+    for(Resource& resource : resources)
+    {
+        if(resource.transientIndex == UINT32_MAX)
+            continue;
+
+        const uint32_t imageIndex = placedImages[resource.transientIndex];
+        if(imageIndex != UINT32_MAX)
+            resource.image = *heap.images[imageIndex].image;
+    }
+}
+
+void RenderGraph::Compile(uint64_t frame)
+{
+    PROFILE_ZONE("Compile render graph");
+    assert(!compiled);
+    cullPasses();
+    placeTransientImages(frame);
+    compiled = true;
+}
+
+RenderGraphResourceState& RenderGraph::getState(RenderGraphResource resource)
+{
+    Resource& entry = resources[resource];
+    if(entry.transientIndex != UINT32_MAX)
+        return heap.images[placedImages[entry.transientIndex]].state;
+    return entry.importedState ? *entry.importedState : entry.state;
+}
+
+RenderGraphResourceState RenderGraph::getAliasedState(uint32_t imageIndex) const
+{
+    // Every earlier access of the memory is treated as a write, so the first access waits for all
+    // of them. The layout is undefined, which discards the content
+    const PlacedImage& placement = heap.images[imageIndex].placement;
+    RenderGraphResourceState state;
+    for(const TransientImage& other : heap.images)
+    {
+        if(other.placement.offset < placement.offset + placement.size
+           && placement.offset < other.placement.offset + other.placement.size)
+        {
+            state.writeStages |= other.state.writeStages | other.state.readStages;
+            state.writeAccess |= other.state.writeAccess;
+        }
+    }
+    return state;
+}
+
+void RenderGraph::addBarrier(const Access& access)
+{
+    const Resource& resource = resources[access.resource];
+    RenderGraphResourceState& state = getState(access.resource);
+    // Images keep their layout when the access doesn't name one
+    const vk::ImageLayout oldLayout = state.layout;
+    const vk::ImageLayout newLayout =
+        access.layout == vk::ImageLayout::eUndefined ? oldLayout : access.layout;
+    const bool changesLayout = resource.image && newLayout != oldLayout;
+
+    vk::PipelineStageFlags2 srcStages;
+    vk::AccessFlags2 srcAccess;
+    bool needsBarrier;
+    if(access.write || changesLayout)
+    {
+        // Waits for the last write and every read after it. Only the write has to be made
+        // available, the reads only have to be done
+        srcStages = state.writeStages | state.readStages;
+        srcAccess = state.writeAccess;
+        needsBarrier = srcStages || changesLayout;
+        state = {
+            .writeStages = access.stages,
+            .writeAccess = access.access & WRITE_ACCESS,
+            .readStages = vk::PipelineStageFlagBits2::eNone,
+            .visibleAccess = access.access,
+            .layout = resource.image ? newLayout : vk::ImageLayout::eUndefined,
+        };
+    }
+    else
+    {
+        // Reads after the same write share its barrier when an earlier read already covered them
+        const bool visible = !(access.stages & ~state.readStages)
+                             && !(access.access & ~state.visibleAccess);
+        srcStages = state.writeStages;
+        srcAccess = state.writeAccess;
+        needsBarrier = srcStages && !visible;
+        state.readStages |= access.stages;
+        if(needsBarrier)
+            state.visibleAccess |= access.access;
+    }
+
+    if(!needsBarrier)
+        return;
+
+    if(resource.image)
+    {
+        imageBarriers.push_back({
+            .srcStageMask = srcStages,
+            .srcAccessMask = srcAccess,
+            .dstStageMask = access.stages,
+            .dstAccessMask = access.access,
+            .oldLayout = oldLayout,
+            .newLayout = newLayout,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = resource.image,
+            .subresourceRange = resource.range,
+        });
+    }
+    else
+    {
+        bufferBarriers.push_back({
+            .srcStageMask = srcStages,
+            .srcAccessMask = srcAccess,
+            .dstStageMask = access.stages,
+            .dstAccessMask = access.access,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = resource.buffer,
+            .offset = resource.offset,
+            .size = resource.size,
+        });
+    }
+}
+
+void RenderGraph::flushBarriers(vk::CommandBuffer commandBuffer)
+{
+    if(bufferBarriers.empty() && imageBarriers.empty())
+        return;
+
+    commandBuffer.pipelineBarrier2({
+        .dependencyFlags = vk::DependencyFlags(),
+        .memoryBarrierCount = 0,
+        .pMemoryBarriers = nullptr,
+        .bufferMemoryBarrierCount = (uint32_t)bufferBarriers.size(),
+        .pBufferMemoryBarriers = bufferBarriers.data(),
+        .imageMemoryBarrierCount = (uint32_t)imageBarriers.size(),
+        .pImageMemoryBarriers = imageBarriers.data(),
+    });
+    bufferBarriers.clear();
+    imageBarriers.clear();
+}
+
+vk::Image RenderGraph::GetImage(RenderGraphResource resource) const
+{
+    assert(compiled && resources[resource].image);
+    return resources[resource].image;
+}
+
+vk::ImageView RenderGraph::GetImageView(
+    RenderGraphResource resource,
+    uint32_t baseMipLevel,
+    uint32_t levelCount)
+{
+    // Imported images come with views of their own
+    assert(compiled && resources[resource].transientIndex != UINT32_MAX);
+    const uint32_t transientIndex = resources[resource].transientIndex;
+    assert(placedImages[transientIndex] != UINT32_MAX);
+    TransientImage& image = heap.images[placedImages[transientIndex]];
+
+    auto cached = std::find_if(entire_collection(image.views), [&](const TransientView& view) {
+        return view.baseMipLevel == baseMipLevel && view.levelCount == levelCount;
+    });
+    if(cached != image.views.end())
+        return *cached->view;
+
+    const vk::ImageCreateInfo& info = transientImages[transientIndex].createInfo;
+    vk::ImageSubresourceRange range = resources[resource].range;
+    range.baseMipLevel = baseMipLevel;
+    range.levelCount = levelCount;
+    image.views.push_back({
+        .baseMipLevel = baseMipLevel,
+        .levelCount = levelCount,
+        .view = device.createImageViewUnique({
+            .image = *image.image,
+            .viewType =
+                info.arrayLayers == 1 ? vk::ImageViewType::e2D : vk::ImageViewType::e2DArray,
+            .format = info.format,
+            .components =
+                {
+                    .r = vk::ComponentSwizzle::eIdentity,
+                    .g = vk::ComponentSwizzle::eIdentity,
+                    .b = vk::ComponentSwizzle::eIdentity,
+                    .a = vk::ComponentSwizzle::eIdentity,
+                },
+            .subresourceRange = range,
+        }),
+    });
+    return *image.views.back().view;
+}
+
+void RenderGraph::Execute(vk::CommandBuffer commandBuffer, GpuProfiler& profiler)
+{
+    assert(compiled);
+    for(uint32_t passIndex = 0; passIndex < passes.size(); ++passIndex)
+    {
+        Pass& pass = passes[passIndex];
+        if(pass.culled)
+            continue;
+
+        for(const Access& access : pass.accesses)
+        {
+            const uint32_t transientIndex = resources[access.resource].transientIndex;
+            if(transientIndex != UINT32_MAX
+               && transientImages[transientIndex].firstPass == passIndex)
+                getState(access.resource) = getAliasedState(placedImages[transientIndex]);
+            addBarrier(access);
+        }
+        flushBarriers(commandBuffer);
+
+        profiler.BeginRegion(commandBuffer, pass.name);
+        pass.record(commandBuffer);
+        profiler.EndRegion(commandBuffer);
+    }
+
+    for(const Access& access : exports)
+        addBarrier(access);
+    flushBarriers(commandBuffer);
+
+    passes.clear();
+    resources.clear();
+    exports.clear();
+    transientImages.clear();
+    compiled = false;
+}
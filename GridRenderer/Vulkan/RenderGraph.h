@@ -0,0 +1,221 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+#include "GpuProfiler.h"
+
+// Index of a resource in the frame's graph, only valid until the graph is executed
+using RenderGraphResource = uint32_t;
+
+// How a resource was last accessed. Imported resources can keep theirs between frames, so that the
+// first pass of a frame waits for the last pass of the one before
+struct RenderGraphResourceState
+{
+    vk::PipelineStageFlags2 writeStages = vk::PipelineStageFlagBits2::eNone;
+    vk::AccessFlags2 writeAccess = vk::AccessFlagBits2::eNone;
+    // Every stage that read the resource since the last write, and what the write has already
+    // been made visible to
+    vk::PipelineStageFlags2 readStages = vk::PipelineStageFlagBits2::eNone;
+    vk::AccessFlags2 visibleAccess = vk::AccessFlagBits2::eNone;
+    vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+};
+
+// Records a frame's GPU work from passes that declare which buffers and images they read and
+// write. Every pass gets one batched barrier with exactly the dependencies and layout transitions
+// its accesses need, passes whose writes are never read are culled, and transient images whose
+// passes don't overlap share memory. Rebuilt every frame. Not thread safe
+class RenderGraph
+{
+  private:
+    struct Access
+    {
+        RenderGraphResource resource;
+        vk::PipelineStageFlags2 stages;
+        vk::AccessFlags2 access;
+        vk::ImageLayout layout;
+        bool write;
+    };
+
+    struct Pass
+    {
+        const char* name;
+        std::function<void(vk::CommandBuffer)> record;
+        std::vector<Access> accesses;
+        bool sideEffects;
+        bool culled;
+    };
+
+    struct Resource
+    {
+        const char* name;
+        vk::Buffer buffer;
+        vk::DeviceSize offset;
+        vk::DeviceSize size;
+        vk::Image image;
+        vk::ImageSubresourceRange range;
+        // Only used by imported resources that don't keep their state between frames, see
+        // getState
+        RenderGraphResourceState state;
+        RenderGraphResourceState* importedState;
+        // Index into transientImages, or UINT32_MAX
+        uint32_t transientIndex;
+        bool exported;
+    };
+
+    struct TransientImageDescription
+    {
+        vk::ImageCreateInfo createInfo;
+        // First and last pass that survived culling and use the image. UINT32_MAX if none did, in
+        // which case it gets no memory
+        uint32_t firstPass;
+        uint32_t lastPass;
+    };
+
+    // Images are kept between frames as long as the same descriptions end up at the same offsets
+    struct PlacedImage
+    {
+        vk::ImageType imageType;
+        vk::Format format;
+        vk::Extent3D extent;
+        uint32_t mipLevels;
+        uint32_t arrayLayers;
+        vk::SampleCountFlagBits samples;
+        vk::ImageUsageFlags usage;
+        vk::DeviceSize offset;
+        vk::DeviceSize size;
+
+        bool operator==(const PlacedImage& other) const = default;
+    };
+
+    struct TransientView
+    {
+        uint32_t baseMipLevel;
+        uint32_t levelCount;
+        vk::UniqueImageView view;
+    };
+
+    struct TransientImage
+    {
+        PlacedImage placement;
+        vk::UniqueImage image;
+        std::vector<TransientView> views;
+        // Carried over between frames, and shared with whatever is placed in the same memory
+        RenderGraphResourceState state;
+    };
+
+    struct TransientHeap
+    {
+        vk::UniqueDeviceMemory memory;
+        std::vector<TransientImage> images;
+        // Last frame that used the heap, it is destroyed once that frame has completed
+        uint64_t lastFrame = 0;
+    };
+
+    vk::Device device;
+    vk::PhysicalDevice physicalDevice;
+    uint32_t framesInFlight = 1;
+
+    std::vector<Pass> passes;
+    std::vector<Resource> resources;
+    // Accesses after the graph, see Export
+    std::vector<Access> exports;
+    std::vector<TransientImageDescription> transientImages;
+    // Indices into heap.images of the current frame's transient images, by transientIndex
+    std::vector<uint32_t> placedImages;
+    TransientHeap heap;
+    // Heaps that no longer match the frame's transient images, kept until the GPU is done
+    std::vector<TransientHeap> retiredHeaps;
+    bool compiled = false;
+
+    // Kept between frames to avoid reallocating them every frame
+    std::vector<vk::BufferMemoryBarrier2> bufferBarriers;
+    std::vector<vk::ImageMemoryBarrier2> imageBarriers;
+
+    void cullPasses();
+    void placeTransientImages(uint64_t frame);
+    RenderGraphResourceState& getState(RenderGraphResource resource);
+    // Starts the state of a transient image after everything that used its memory before
+    RenderGraphResourceState getAliasedState(uint32_t imageIndex) const;
+    // Adds the barrier the access needs, if any, and moves the resource's state past it
+    void addBarrier(const Access& access);
+    void flushBarriers(vk::CommandBuffer commandBuffer);
+
+  public:
+    class PassBuilder
+    {
+      private:
+        Pass& pass;
+
+      public:
+        PassBuilder(Pass& pass);
+
+        // Images are accessed in the given layout, or in whatever layout they are in without one.
+        // Buffers ignore it
+        PassBuilder& Read(
+            RenderGraphResource resource,
+            vk::PipelineStageFlags2 stages,
+            vk::AccessFlags2 access,
+            vk::ImageLayout layout = vk::ImageLayout::eUndefined);
+        // Also covers reading and writing the same resource, in which case access has both
+        PassBuilder& Write(
+            RenderGraphResource resource,
+            vk::PipelineStageFlags2 stages,
+            vk::AccessFlags2 access,
+            vk::ImageLayout layout = vk::ImageLayout::eUndefined);
+        // Never culled, e.g. because it renders into something outside of the graph
+        PassBuilder& SideEffects();
+    };
+
+    RenderGraph() = default;
+    RenderGraph(vk::Device device, vk::PhysicalDevice physicalDevice, uint32_t framesInFlight);
+    RenderGraph(const RenderGraph& other) = delete;
+    RenderGraph& operator=(const RenderGraph& other) = delete;
+    RenderGraph(RenderGraph&& other) = default;
+    RenderGraph& operator=(RenderGraph&& other) = default;
+
+    // Names must outlive the frame, in practice string literals. Imported resources are owned by
+    // the caller. Without a state, they are assumed to be idle when the frame begins, e.g. the
+    // frame's own chunk of a round-robin buffer
+    RenderGraphResource ImportBuffer(
+        const char* name,
+        vk::Buffer buffer,
+        vk::DeviceSize offset,
+        vk::DeviceSize size,
+        RenderGraphResourceState* state = nullptr);
+    RenderGraphResource ImportImage(
+        const char* name,
+        vk::Image image,
+        const vk::ImageSubresourceRange& range,
+        RenderGraphResourceState* state = nullptr);
+    // Owned by the graph and only alive between the first and the last pass that use it. Its
+    // content is undefined at the first one. Sharing mode and initial layout are ignored
+    RenderGraphResource CreateTransientImage(const char* name, const vk::ImageCreateInfo& info);
+    // Keeps the passes that write the resource, and makes their writes available to the stages
+    // and access that use it after the graph. Without any, only the state is kept
+    void Export(
+        RenderGraphResource resource,
+        vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eNone,
+        vk::AccessFlags2 access = vk::AccessFlagBits2::eNone,
+        vk::ImageLayout layout = vk::ImageLayout::eUndefined);
+
+    // Records into the primary command buffer when the graph is executed. The builder is only
+    // valid until the next pass is added
+    PassBuilder AddPass(const char* name, std::function<void(vk::CommandBuffer)> record);
+
+    // Culls passes and places transient images, after which their images and views exist.
+    // frame is the frame the graph is executed in, see RendererVulkan::GetCurrentFrame. Any
+    // frame framesInFlight before it has to have completed
+    void Compile(uint64_t frame);
+    // Only between Compile and the end of Execute
+    vk::Image GetImage(RenderGraphResource resource) const;
+    vk::ImageView GetImageView(
+        RenderGraphResource resource,
+        uint32_t baseMipLevel = 0,
+        uint32_t levelCount = VK_REMAINING_MIP_LEVELS);
+    // Records every pass that survived culling in the order they were added, each in a profiler
+    // region of its name. Has to be recorded outside of a render pass. Clears the graph
+    void Execute(vk::CommandBuffer commandBuffer, GpuProfiler& profiler);
+};
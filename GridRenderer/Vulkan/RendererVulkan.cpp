@@ -1,15 +1,25 @@
 #include "RendererVulkan.h"
 
+#include <algorithm>
 #include <array>
-#include <iostream> // Only used for cerr in the debug callback
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
 #include <map>
 #include <memory>
+#include <numeric>
 #include <optional>
+#include <thread>
 
 #include <SDL2/SDL_video.h>
 #include <SDL2/SDL_vulkan.h>
+#include <glm/geometric.hpp>
 
+#include "../Profiler.h"
 #include "FileUtils.h"
+#include "HashUtils.h"
 #include "StlHelpers/EntireCollection.h"
 
 // Small macro to avoid typos when typing the function name
@@ -50,13 +60,33 @@ VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     return false;
 }
 
+bool hasInstanceExtension(const char* name)
+{
+    std::vector<vk::ExtensionProperties> extensions = vk::enumerateInstanceExtensionProperties();
+    return std::find_if(
+               entire_collection(extensions),
+               [&](const auto& extension) { return strcmp(extension.extensionName, name) == 0; })
+           != extensions.end();
+}
+
 vk::UniqueInstance createInstance(std::vector<const char*> requiredExtensions)
 {
+    std::map<std::string, bool> requiredLayers;
+#ifndef NDEBUG
     // Required for the validation layers
     requiredExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+#else
+    // Lets capture tools show the labels of GpuProfiler. Without a tool attached they cost nothing
+    if(hasInstanceExtension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME))
+        requiredExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+#endif
+
+#ifndef NDEBUG
 
-    // Enable validation layer, otherwise no error checking will be done
-    std::map<std::string, bool> requiredLayers = {{"VK_LAYER_KHRONOS_validation", false}};
+    // Enable validation layer, otherwise no error checking will be done. Release builds skip it
+    // so that they run at full speed, and so that they run on machines without the SDK installed
+    requiredLayers.emplace("VK_LAYER_KHRONOS_validation", false);
+#endif
 
     // Make sure all required layers are available
     std::vector<vk::LayerProperties> properties = vk::enumerateInstanceLayerProperties();
@@ -126,13 +156,45 @@ vk::UniqueSurfaceKHR createSurface(SDL_Window* handle, const vk::UniqueInstance&
     return vk::UniqueSurfaceKHR(surfaceRaw, *instance);
 }
 
-std::tuple<vk::UniqueDevice, vk::PhysicalDevice, uint32_t> createDevice(
+// Prefers a family that can only copy, which is usually backed by the GPU's copy engines, then one
+// without graphics. Graphics and compute families can copy even without the transfer flag. Falls
+// back to the graphics family, in which case uploads are submitted to the graphics queue. Textures
+// are copied whole, which every image transfer granularity allows
+uint32_t pickTransferQueueIndex(
+    const std::vector<vk::QueueFamilyProperties>& queueProperties,
+    uint32_t graphicsQueueIndex)
+{
+    std::optional<uint32_t> computeQueueIndexOpt;
+    for(uint32_t i = 0; i < (uint32_t)queueProperties.size(); ++i)
+    {
+        const vk::QueueFlags flags = queueProperties[i].queueFlags;
+        if(i == graphicsQueueIndex || flags & vk::QueueFlagBits::eGraphics)
+            continue;
+
+        if(flags & vk::QueueFlagBits::eCompute)
+        {
+            if(!computeQueueIndexOpt.has_value())
+                computeQueueIndexOpt = i;
+            continue;
+        }
+
+        if(flags & vk::QueueFlagBits::eTransfer)
+            return i;
+    }
+    return computeQueueIndexOpt.value_or(graphicsQueueIndex);
+}
+
+// surface is empty when rendering headless, in which case presentation support is not required.
+// Returns the graphics queue family, then the family uploads are submitted to
+std::tuple<vk::UniqueDevice, vk::PhysicalDevice, uint32_t, uint32_t> createDevice(
     const vk::UniqueInstance& instance,
     const vk::UniqueSurfaceKHR& surface)
 {
     std::vector<vk::PhysicalDevice> pDevices = instance->enumeratePhysicalDevices();
     std::optional<vk::PhysicalDevice> pickedPDeviceOpt;
-    uint32_t graphicsQueueIndex = 0; // Will be set if pickedPDeviceOpt is set
+    // Will be set if pickedPDeviceOpt is set
+    uint32_t graphicsQueueIndex = 0;
+    uint32_t transferQueueIndex = 0;
     std::for_each(entire_collection(pDevices), [&](const vk::PhysicalDevice& pDevice) {
         std::vector<vk::ExtensionProperties> extensions =
             pDevice.enumerateDeviceExtensionProperties();
@@ -144,7 +206,24 @@ std::tuple<vk::UniqueDevice, vk::PhysicalDevice, uint32_t> createDevice(
                     return strcmp(extension.extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0;
                 })
             != extensions.end();
-        if(!hasSwapchainSupport)
+        if(surface && !hasSwapchainSupport)
+            return;
+
+        // Materials index one array of every texture, see TextureManagerVulkan. The render graph
+        // records its barriers with synchronization2
+        auto features = pDevice.getFeatures2<
+            vk::PhysicalDeviceFeatures2,
+            vk::PhysicalDeviceVulkan12Features,
+            vk::PhysicalDeviceVulkan13Features>();
+        const auto& vulkan12Features = features.get<vk::PhysicalDeviceVulkan12Features>();
+        const auto& vulkan13Features = features.get<vk::PhysicalDeviceVulkan13Features>();
+        if(pDevice.getProperties().apiVersion < VK_API_VERSION_1_3
+           || !vulkan12Features.shaderSampledImageArrayNonUniformIndexing
+           || !vulkan12Features.descriptorBindingSampledImageUpdateAfterBind
+           || !vulkan12Features.descriptorBindingUpdateUnusedWhilePending
+           || !vulkan12Features.descriptorBindingPartiallyBound
+           || !vulkan12Features.timelineSemaphore
+           || !vulkan13Features.synchronization2)
             return;
 
         std::vector<vk::QueueFamilyProperties> queueProperties = pDevice.getQueueFamilyProperties();
@@ -153,10 +232,13 @@ std::tuple<vk::UniqueDevice, vk::PhysicalDevice, uint32_t> createDevice(
         {
             const auto& properties = queueProperties[i];
 
-            if(!(properties.queueFlags & vk::QueueFlagBits::eGraphics))
+            // GPU-driven rendering dispatches compute work on the same queue as the draws
+            constexpr vk::QueueFlags requiredFlags =
+                vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute;
+            if((properties.queueFlags & requiredFlags) != requiredFlags)
                 continue;
 
-            if(!pDevice.getSurfaceSupportKHR(i, *surface))
+            if(surface && !pDevice.getSurfaceSupportKHR(i, *surface))
                 continue;
 
             graphicsQueueIndexOpt = i;
@@ -170,6 +252,7 @@ std::tuple<vk::UniqueDevice, vk::PhysicalDevice, uint32_t> createDevice(
         {
             pickedPDeviceOpt = pDevice;
             graphicsQueueIndex = *graphicsQueueIndexOpt;
+            transferQueueIndex = pickTransferQueueIndex(queueProperties, graphicsQueueIndex);
         }
     });
 
@@ -178,30 +261,65 @@ std::tuple<vk::UniqueDevice, vk::PhysicalDevice, uint32_t> createDevice(
     auto pickedPDevice = *pickedPDeviceOpt;
 
     float queuePriorities = 1.0f;
-    vk::DeviceQueueCreateInfo queueCreateInfo = {
+    std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos = {{
         .queueFamilyIndex = graphicsQueueIndex,
         .queueCount = 1,
         .pQueuePriorities = &queuePriorities,
-    };
+    }};
+    if(transferQueueIndex != graphicsQueueIndex)
+    {
+        queueCreateInfos.push_back({
+            .queueFamilyIndex = transferQueueIndex,
+            .queueCount = 1,
+            .pQueuePriorities = &queuePriorities,
+        });
+    }
 
-    const char* requiredExtensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+    std::vector<const char*> requiredExtensions;
+    if(surface)
+        requiredExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+    // Optional, GPU-driven rendering falls back to one indirect draw per batch without it. Pipeline
+    // statistics are only counted when the secondary command buffers can inherit the query
+    const vk::PhysicalDeviceFeatures supportedFeatures = pickedPDevice.getFeatures();
+    const bool pipelineStatistics =
+        supportedFeatures.pipelineStatisticsQuery && supportedFeatures.inheritedQueries;
+    vk::PhysicalDeviceFeatures enabledFeatures = {
+        .multiDrawIndirect = supportedFeatures.multiDrawIndirect,
+        .pipelineStatisticsQuery = pipelineStatistics,
+        .inheritedQueries = pipelineStatistics,
+    };
+    vk::PhysicalDeviceVulkan13Features enabledVulkan13Features = {
+        .synchronization2 = true,
+    };
+    vk::PhysicalDeviceVulkan12Features enabledVulkan12Features = {
+        .pNext = &enabledVulkan13Features,
+        .shaderSampledImageArrayNonUniformIndexing = true,
+        .descriptorBindingSampledImageUpdateAfterBind = true,
+        .descriptorBindingUpdateUnusedWhilePending = true,
+        .descriptorBindingPartiallyBound = true,
+        .timelineSemaphore = true,
+    };
     vk::DeviceCreateInfo deviceCreateInfo{
-        .queueCreateInfoCount = 1,
-        .pQueueCreateInfos = &queueCreateInfo,
+        .pNext = &enabledVulkan12Features,
+        .queueCreateInfoCount = (uint32_t)queueCreateInfos.size(),
+        .pQueueCreateInfos = queueCreateInfos.data(),
         .enabledLayerCount = 0,
         .ppEnabledLayerNames = nullptr,
-        .enabledExtensionCount = (uint32_t)std::size(requiredExtensions),
-        .ppEnabledExtensionNames = requiredExtensions,
-        .pEnabledFeatures = nullptr,
+        .enabledExtensionCount = (uint32_t)requiredExtensions.size(),
+        .ppEnabledExtensionNames = requiredExtensions.data(),
+        .pEnabledFeatures = &enabledFeatures,
     };
 
     return std::make_tuple(
         pickedPDevice.createDeviceUnique(deviceCreateInfo),
         pickedPDevice,
-        graphicsQueueIndex);
+        graphicsQueueIndex,
+        transferQueueIndex);
 }
 
-vk::UniqueRenderPass createRenderPass(const vk::UniqueDevice& device)
+// finalLayout is the layout the back buffer is left in, i.e. ready for presenting or for copying
+vk::UniqueRenderPass createRenderPass(const vk::UniqueDevice& device, vk::ImageLayout finalLayout)
 {
     vk::AttachmentDescription backBufferAttachmentDescription = {
         .format = vk::Format::eB8G8R8A8Srgb,
@@ -213,7 +331,7 @@ vk::UniqueRenderPass createRenderPass(const vk::UniqueDevice& device)
         .stencilStoreOp =
             vk::AttachmentStoreOp::eDontCare, // Not used since format does not define stencil
         .initialLayout = vk::ImageLayout::eUndefined,
-        .finalLayout = vk::ImageLayout::ePresentSrcKHR,
+        .finalLayout = finalLayout,
     };
     vk::AttachmentReference backBufferAttachment = {
         .attachment = 0,
@@ -279,22 +397,66 @@ vk::UniqueRenderPass createRenderPass(const vk::UniqueDevice& device)
     return device->createRenderPassUnique(renderPassInfo);
 }
 
-std::tuple<vk::UniquePipeline, vk::UniquePipelineLayout> createPipeline(
+// Every graphics pipeline shares this layout, so frame state survives pipeline changes
+vk::UniquePipelineLayout createPipelineLayout(
+    const vk::UniqueDevice& device,
+    const DescriptorSetLayouts& descriptorSetLayouts)
+{
+    std::array<vk::DescriptorSetLayout, (size_t)BindingFrequency::COUNT> allBindings;
+    for(size_t i = 0; i < allBindings.size(); ++i)
+        allBindings[i] = *descriptorSetLayouts.graphics[i];
+    vk::PushConstantRange drawPushConstants = {
+        .stageFlags = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+        .offset = 0,
+        .size = sizeof(GpuDrawParameters),
+    };
+    return device->createPipelineLayoutUnique({
+        .setLayoutCount = (uint32_t)allBindings.size(),
+        .pSetLayouts = allBindings.data(),
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &drawPushConstants,
+    });
+}
+
+void pushDrawParameters(
+    vk::CommandBuffer commandBuffer,
+    vk::PipelineLayout pipelineLayout,
+    const GpuDrawParameters& parameters)
+{
+    commandBuffer.pushConstants(
+        pipelineLayout,
+        vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+        0,
+        sizeof(parameters),
+        &parameters);
+}
+
+// How a graphics pipeline uses the depth buffer, see RendererVulkan::SetDepthPrepass
+enum class DepthMode
+{
+    TEST_AND_WRITE,
+    PREPASS, // Depth only, without fragment shader
+    EQUAL,   // After the prepass, which leaves only the visible fragments at equal depth
+};
+
+vk::UniquePipeline createPipeline(
     const vk::UniqueDevice& device,
     const vk::UniqueRenderPass& renderPass,
-    const DescriptorSetLayouts& descriptorSetLayouts,
-    const vk::UniqueShaderModule& vertexShader,
-    const vk::UniqueShaderModule& fragmentShader)
+    const vk::UniquePipelineLayout& pipelineLayout,
+    const vk::UniquePipelineCache& pipelineCache,
+    vk::ShaderModule vertexShader,
+    vk::ShaderModule fragmentShader,
+    DepthMode depthMode)
 {
     vk::PipelineShaderStageCreateInfo vertexStageInfo = {
         .stage = vk::ShaderStageFlagBits::eVertex,
-        .module = *vertexShader,
+        .module = vertexShader,
         .pName = "main",
         .pSpecializationInfo = nullptr,
     };
     vk::PipelineShaderStageCreateInfo fragmentStageInfo = {
         .stage = vk::ShaderStageFlagBits::eFragment,
-        .module = *fragmentShader,
+        .module = fragmentShader,
         .pName = "main",
         .pSpecializationInfo = nullptr,
     };
@@ -313,33 +475,21 @@ std::tuple<vk::UniquePipeline, vk::UniquePipelineLayout> createPipeline(
         .primitiveRestartEnable = false,
     };
 
-    vk::Viewport viewport = {
-        .x = 0.0f,
-        .y = 0.0f,
-        .width = 1280.0f, // TODO
-        .height = 720.0f, // TODO
-        .minDepth = 0.0f,
-        .maxDepth = 1.0f,
-    };
-
-    vk::Rect2D scissor = {
-        .offset =
-            {
-                .x = 0,
-                .y = 0,
-            },
-        .extent =
-            {
-                .width = 1280, // TODO
-                .height = 720, // TODO
-            },
-    };
-
+    // Viewport and scissor are dynamic so that pipelines survive swapchain recreation
     vk::PipelineViewportStateCreateInfo viewportInfo = {
         .viewportCount = 1,
-        .pViewports = &viewport,
+        .pViewports = nullptr,
         .scissorCount = 1,
-        .pScissors = &scissor,
+        .pScissors = nullptr,
+    };
+
+    auto dynamicStates = std::to_array({
+        vk::DynamicState::eViewport,
+        vk::DynamicState::eScissor,
+    });
+    vk::PipelineDynamicStateCreateInfo dynamicStateInfo = {
+        .dynamicStateCount = (uint32_t)dynamicStates.size(),
+        .pDynamicStates = dynamicStates.data(),
     };
 
     vk::PipelineRasterizationStateCreateInfo rasterizeInfo = {
@@ -366,8 +516,9 @@ std::tuple<vk::UniquePipeline, vk::UniquePipelineLayout> createPipeline(
 
     vk::PipelineDepthStencilStateCreateInfo depthStencilInfo = {
         .depthTestEnable = true,
-        .depthWriteEnable = true,
-        .depthCompareOp = vk::CompareOp::eLessOrEqual,
+        .depthWriteEnable = depthMode != DepthMode::EQUAL,
+        .depthCompareOp =
+            depthMode == DepthMode::EQUAL ? vk::CompareOp::eEqual : vk::CompareOp::eLessOrEqual,
         .depthBoundsTestEnable = false,
         .stencilTestEnable = false,
         .front = {},
@@ -384,8 +535,11 @@ std::tuple<vk::UniquePipeline, vk::UniquePipelineLayout> createPipeline(
         .srcAlphaBlendFactor = vk::BlendFactor::eOne,
         .dstAlphaBlendFactor = vk::BlendFactor::eZero,
         .alphaBlendOp = vk::BlendOp::eAdd,
-        .colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG
-                          | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA,
+        .colorWriteMask = depthMode == DepthMode::PREPASS
+                              ? vk::ColorComponentFlags()
+                              : vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG
+                                    | vk::ColorComponentFlagBits::eB
+                                    | vk::ColorComponentFlagBits::eA,
     };
 
     std::array<float, 4> blendConstants = {0.0f, 0.0f, 0.0f, 0.0f};
@@ -397,25 +551,9 @@ std::tuple<vk::UniquePipeline, vk::UniquePipelineLayout> createPipeline(
         .blendConstants = blendConstants,
     };
 
-    auto allBindings = std::to_array({
-        *descriptorSetLayouts.vertexIndex,
-        *descriptorSetLayouts.transformBuffer,
-        *descriptorSetLayouts.viewProjection,
-        *descriptorSetLayouts.sampler,
-        *descriptorSetLayouts.textures, // diffuse
-        *descriptorSetLayouts.textures, // specular
-        *descriptorSetLayouts.lights,
-        *descriptorSetLayouts.cameraPosition,
-    });
-    auto pipelineLayout = device->createPipelineLayoutUnique({
-        .setLayoutCount = (uint32_t)allBindings.size(),
-        .pSetLayouts = allBindings.data(),
-        .pushConstantRangeCount = 0,
-        .pPushConstantRanges = nullptr,
-    });
-
     vk::GraphicsPipelineCreateInfo pipelineInfo = {
-        .stageCount = 2,
+        // The prepass only writes depth, so it has no fragment shader
+        .stageCount = depthMode == DepthMode::PREPASS ? 1u : 2u,
         .pStages = stages,
         .pVertexInputState = &vertexInputInfo,
         .pInputAssemblyState = &inputAssemblyInfo,
@@ -425,31 +563,114 @@ std::tuple<vk::UniquePipeline, vk::UniquePipelineLayout> createPipeline(
         .pMultisampleState = &multisampleInfo,
         .pDepthStencilState = &depthStencilInfo,
         .pColorBlendState = &blendInfo,
-        .pDynamicState = nullptr,
+        .pDynamicState = &dynamicStateInfo,
         .layout = *pipelineLayout,
         .renderPass = *renderPass,
         .subpass = 0,
         .basePipelineHandle = nullptr,
         .basePipelineIndex = -1,
     };
-    auto [error, pipeline] = device->createGraphicsPipelineUnique(VK_NULL_HANDLE, pipelineInfo);
+    auto [error, pipeline] = device->createGraphicsPipelineUnique(*pipelineCache, pipelineInfo);
+    assert(error == vk::Result::eSuccess);
+
+    return std::move(pipeline);
+}
+
+vk::UniquePipeline createComputePipeline(
+    const vk::UniqueDevice& device,
+    const vk::UniquePipelineLayout& pipelineLayout,
+    const vk::UniquePipelineCache& pipelineCache,
+    vk::ShaderModule computeShader)
+{
+    vk::ComputePipelineCreateInfo pipelineInfo = {
+        .stage =
+            {
+                .stage = vk::ShaderStageFlagBits::eCompute,
+                .module = computeShader,
+                .pName = "main",
+                .pSpecializationInfo = nullptr,
+            },
+        .layout = *pipelineLayout,
+        .basePipelineHandle = nullptr,
+        .basePipelineIndex = -1,
+    };
+    auto [error, pipeline] = device->createComputePipelineUnique(*pipelineCache, pipelineInfo);
     assert(error == vk::Result::eSuccess);
 
-    return std::make_tuple(std::move(pipeline), std::move(pipelineLayout));
+    return std::move(pipeline);
+}
+
+vk::PresentModeKHR choosePresentMode(
+    const vk::UniqueSurfaceKHR& surface,
+    const vk::PhysicalDevice& physicalDevice,
+    PresentMode preferredPresentMode)
+{
+    // Fall back to modes that are as close as possible to the preferred one. FIFO is the only mode
+    // that is guaranteed to be supported
+    std::vector<vk::PresentModeKHR> candidates;
+    switch(preferredPresentMode)
+    {
+        case PresentMode::IMMEDIATE:
+            candidates = {vk::PresentModeKHR::eImmediate, vk::PresentModeKHR::eMailbox};
+            break;
+        case PresentMode::MAILBOX: candidates = {vk::PresentModeKHR::eMailbox}; break;
+        case PresentMode::FIFO: break;
+    }
+
+    std::vector<vk::PresentModeKHR> supportedModes =
+        physicalDevice.getSurfacePresentModesKHR(*surface);
+    for(vk::PresentModeKHR candidate : candidates)
+    {
+        if(std::find(entire_collection(supportedModes), candidate) != supportedModes.end())
+            return candidate;
+    }
+
+    return vk::PresentModeKHR::eFifo;
 }
 
-vk::UniqueSwapchainKHR createSwapchain(
+// Returns an empty swapchain if the surface has no area, e.g. when the window is minimized
+std::tuple<vk::UniqueSwapchainKHR, vk::Extent2D> createSwapchain(
+    SDL_Window* windowHandle,
     const vk::UniqueSurfaceKHR& surface,
     const vk::UniqueDevice& device,
-    const vk::PhysicalDevice& physicalDevice)
+    const vk::PhysicalDevice& physicalDevice,
+    PresentMode preferredPresentMode,
+    vk::SwapchainKHR oldSwapchain)
 {
-    auto formats = physicalDevice.getSurfaceFormatsKHR(*surface);
-    return device->createSwapchainKHRUnique({
+    vk::SurfaceCapabilitiesKHR capabilities = physicalDevice.getSurfaceCapabilitiesKHR(*surface);
+    vk::Extent2D extent = capabilities.currentExtent;
+    // Some platforms let the swapchain decide the size of the surface
+    if(extent.width == UINT32_MAX)
+    {
+        int width, height;
+        SDL_Vulkan_GetDrawableSize(windowHandle, &width, &height);
+        extent.width = std::clamp(
+            (uint32_t)width,
+            capabilities.minImageExtent.width,
+            capabilities.maxImageExtent.width);
+        extent.height = std::clamp(
+            (uint32_t)height,
+            capabilities.minImageExtent.height,
+            capabilities.maxImageExtent.height);
+    }
+    if(extent.width == 0 || extent.height == 0)
+        return std::make_tuple(vk::UniqueSwapchainKHR(), extent);
+
+    vk::PresentModeKHR presentMode =
+        choosePresentMode(surface, physicalDevice, preferredPresentMode);
+
+    // One extra image so that the CPU never waits for the presentation engine to release one.
+    // maxImageCount is 0 if there is no limit
+    uint32_t imageCount = capabilities.minImageCount + 1;
+    if(capabilities.maxImageCount != 0)
+        imageCount = std::min(imageCount, capabilities.maxImageCount);
+
+    auto swapchain = device->createSwapchainKHRUnique({
         .surface = *surface,
-        .minImageCount = 2,
+        .minImageCount = imageCount,
         .imageFormat = vk::Format::eB8G8R8A8Srgb,
         .imageColorSpace = vk::ColorSpaceKHR::eSrgbNonlinear,
-        .imageExtent = physicalDevice.getSurfaceCapabilitiesKHR(*surface).currentExtent,
+        .imageExtent = extent,
         .imageArrayLayers = 1,
         .imageUsage = vk::ImageUsageFlagBits::eColorAttachment,
         .imageSharingMode = vk::SharingMode::eExclusive,
@@ -457,24 +678,27 @@ vk::UniqueSwapchainKHR createSwapchain(
         .pQueueFamilyIndices = nullptr,
         .preTransform = vk::SurfaceTransformFlagBitsKHR::eIdentity,
         .compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque,
-        .presentMode = vk::PresentModeKHR::eFifo,
+        .presentMode = presentMode,
         .clipped = true,
-        .oldSwapchain = VK_NULL_HANDLE,
+        .oldSwapchain = oldSwapchain,
     });
+
+    return std::make_tuple(std::move(swapchain), extent);
 }
 
+// backBufferImages are either the swapchain images or the offscreen images
 std::tuple<std::vector<vk::UniqueFramebuffer>, std::vector<vk::UniqueImageView>> createFramebuffers(
     const vk::UniqueDevice& device,
-    const vk::UniqueSwapchainKHR& swapchain,
+    const std::vector<vk::Image>& backBufferImages,
     const vk::UniqueRenderPass& renderPass,
-    const vk::UniqueImageView& depthBuffer)
+    const vk::UniqueImageView& depthBuffer,
+    vk::Extent2D extent)
 {
-    std::vector<vk::Image> swapchainImages = device->getSwapchainImagesKHR(*swapchain);
-    std::vector<vk::UniqueImageView> swapchainImageViews;
+    std::vector<vk::UniqueImageView> backBufferImageViews;
     std::vector<vk::UniqueFramebuffer> framebuffers;
     std::transform(
-        entire_collection(swapchainImages),
-        std::back_inserter(swapchainImageViews),
+        entire_collection(backBufferImages),
+        std::back_inserter(backBufferImageViews),
         [&](const vk::Image& image) {
             vk::ImageViewCreateInfo imageViewInfo = {
                 .image = image,
@@ -500,7 +724,7 @@ std::tuple<std::vector<vk::UniqueFramebuffer>, std::vector<vk::UniqueImageView>>
             return device->createImageViewUnique(imageViewInfo);
         });
     std::transform(
-        entire_collection(swapchainImageViews),
+        entire_collection(backBufferImageViews),
         std::back_inserter(framebuffers),
         [&](const vk::UniqueImageView& imageView) {
             std::array<vk::ImageView, 2> attachments = {
@@ -511,170 +735,425 @@ std::tuple<std::vector<vk::UniqueFramebuffer>, std::vector<vk::UniqueImageView>>
                 .renderPass = *renderPass,
                 .attachmentCount = (uint32_t)attachments.size(),
                 .pAttachments = attachments.data(),
-                .width = 1280, // TODO
-                .height = 720, // TODO
+                .width = extent.width,
+                .height = extent.height,
                 .layers = 1,
             };
 
             return device->createFramebufferUnique(framebufferInfo);
         });
 
-    return std::make_tuple(std::move(framebuffers), std::move(swapchainImageViews));
-}
-
-vk::UniqueDescriptorPool createDescriptorPool(const vk::UniqueDevice& device)
-{
-    std::array<vk::DescriptorPoolSize, 3> poolSizes = {
-        vk::DescriptorPoolSize{
-            .type = vk::DescriptorType::eStorageBuffer,
-            .descriptorCount = 2,
-        },
-        vk::DescriptorPoolSize{
-            .type = vk::DescriptorType::eStorageBuffer,
-            .descriptorCount = 1,
-        },
-        vk::DescriptorPoolSize{
-            .type = vk::DescriptorType::eUniformBuffer,
-            .descriptorCount = 1,
-        },
-    };
-    vk::DescriptorPoolCreateInfo poolInfo = {
-        .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
-        .maxSets = 10,
-        .poolSizeCount = (uint32_t)poolSizes.size(),
-        .pPoolSizes = poolSizes.data(),
-    };
-
-    return device->createDescriptorPoolUnique(poolInfo);
+    return std::make_tuple(std::move(framebuffers), std::move(backBufferImageViews));
 }
 
-DescriptorSetLayouts createDescriptorSetlayouts(const vk::UniqueDevice& device)
+// Where a descriptor of the graphics pipelines lives. Sets are grouped by how often they change
+// instead of by what they hold, so each is bound once at its scope and every pipeline stays within
+// four sets, the minimum of maxBoundDescriptorSets
+struct GraphicsBinding
 {
-    vk::DescriptorSetLayoutBinding vertexBufferBinding = {
+    // The declared pass binding this descriptor serves
+    PipelineDataType dataType;
+    BindingFrequency frequency;
+    uint32_t binding;
+    vk::DescriptorType descriptorType;
+    uint32_t descriptorCount;
+    vk::ShaderStageFlags stages;
+    vk::DescriptorBindingFlags flags;
+};
+
+// Must match Standard.vert, StandardDepth.vert and Standard.frag, see validateShaderDescriptors
+const std::array<GraphicsBinding, 9> GRAPHICS_BINDINGS = {
+    // Indices are read through the index buffer, so only the vertices need a descriptor
+    GraphicsBinding{
+        .dataType = PipelineDataType::VERTEX,
+        .frequency = BindingFrequency::PER_FRAME,
         .binding = 0,
         .descriptorType = vk::DescriptorType::eStorageBuffer,
         .descriptorCount = 1,
-        .stageFlags = vk::ShaderStageFlagBits::eVertex,
-        .pImmutableSamplers = nullptr,
-    };
-    vk::DescriptorSetLayoutBinding indexBufferBinding = {
+        .stages = vk::ShaderStageFlagBits::eVertex,
+        .flags = {},
+    },
+    // This frame's transforms and the material ID of every transform
+    GraphicsBinding{
+        .dataType = PipelineDataType::TRANSFORM,
+        .frequency = BindingFrequency::PER_FRAME,
         .binding = 1,
         .descriptorType = vk::DescriptorType::eStorageBuffer,
         .descriptorCount = 1,
-        .stageFlags = vk::ShaderStageFlagBits::eVertex,
-        .pImmutableSamplers = nullptr,
-    };
-    vk::DescriptorSetLayoutBinding vertexIndexDescriptorInfo[2] = {
-        vertexBufferBinding,
-        indexBufferBinding,
-    };
-    auto vertexIndexLayout = device->createDescriptorSetLayoutUnique({
-        .bindingCount = 2,
-        .pBindings = vertexIndexDescriptorInfo,
-    });
-
-    vk::DescriptorSetLayoutBinding transformBinding = {
-        .binding = 0,
+        .stages = vk::ShaderStageFlagBits::eVertex,
+        .flags = {},
+    },
+    GraphicsBinding{
+        .dataType = PipelineDataType::MATERIAL_ID,
+        .frequency = BindingFrequency::PER_FRAME,
+        .binding = 2,
         .descriptorType = vk::DescriptorType::eStorageBuffer,
         .descriptorCount = 1,
-        .stageFlags = vk::ShaderStageFlagBits::eVertex,
-        .pImmutableSamplers = nullptr,
-    };
-    auto transformLayout = device->createDescriptorSetLayoutUnique({
-        .bindingCount = 1,
-        .pBindings = &transformBinding,
-    });
-
-    vk::DescriptorSetLayoutBinding viewProjection = {
-        .binding = 0,
+        .stages = vk::ShaderStageFlagBits::eVertex,
+        .flags = {},
+    },
+    GraphicsBinding{
+        .dataType = PipelineDataType::VIEW_PROJECTION,
+        .frequency = BindingFrequency::PER_FRAME,
+        .binding = 3,
         .descriptorType = vk::DescriptorType::eUniformBuffer,
         .descriptorCount = 1,
-        .stageFlags = vk::ShaderStageFlagBits::eVertex,
-        .pImmutableSamplers = nullptr,
-    };
-    auto viewProjectionLayout = device->createDescriptorSetLayoutUnique({
-        .bindingCount = 1,
-        .pBindings = &viewProjection,
-    });
-
-    vk::DescriptorSetLayoutBinding sampler = {
+        .stages = vk::ShaderStageFlagBits::eVertex,
+        .flags = {},
+    },
+    GraphicsBinding{
+        .dataType = PipelineDataType::CAMERA_POS,
+        .frequency = BindingFrequency::PER_FRAME,
+        .binding = 4,
+        .descriptorType = vk::DescriptorType::eUniformBuffer,
+        .descriptorCount = 1,
+        .stages = vk::ShaderStageFlagBits::eFragment,
+        .flags = {},
+    },
+    GraphicsBinding{
+        .dataType = PipelineDataType::LIGHT,
+        .frequency = BindingFrequency::PER_FRAME,
+        .binding = 5,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .descriptorCount = 1,
+        .stages = vk::ShaderStageFlagBits::eFragment,
+        .flags = {},
+    },
+    GraphicsBinding{
+        .dataType = PipelineDataType::SAMPLER,
+        .frequency = BindingFrequency::PER_PASS,
         .binding = 0,
         .descriptorType = vk::DescriptorType::eSampler,
         .descriptorCount = 1,
-        .stageFlags = vk::ShaderStageFlagBits::eFragment,
-        .pImmutableSamplers = nullptr,
-    };
-    auto samplerLayout = device->createDescriptorSetLayoutUnique({
-        .bindingCount = 1,
-        .pBindings = &sampler,
-    });
-
-    vk::DescriptorSetLayoutBinding textures = {
+        .stages = vk::ShaderStageFlagBits::eFragment,
+        .flags = {},
+    },
+    // Every texture, diffuse and specular alike. Textures are added while the set is bound, and
+    // slots without a texture are never read
+    GraphicsBinding{
+        .dataType = PipelineDataType::TEXTURE_ARRAY,
+        .frequency = BindingFrequency::PER_MATERIAL,
         .binding = 0,
         .descriptorType = vk::DescriptorType::eSampledImage,
-        .descriptorCount = 1,
-        .stageFlags = vk::ShaderStageFlagBits::eFragment,
-        .pImmutableSamplers = nullptr,
-    };
-    auto texturesLayout = device->createDescriptorSetLayoutUnique({
-        .bindingCount = 1,
-        .pBindings = &textures,
-    });
-
-    vk::DescriptorSetLayoutBinding lights = {
-        .binding = 0,
+        .descriptorCount = MAX_TEXTURES,
+        .stages = vk::ShaderStageFlagBits::eFragment,
+        .flags = vk::DescriptorBindingFlagBits::ePartiallyBound
+                 | vk::DescriptorBindingFlagBits::eUpdateAfterBind
+                 | vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending,
+    },
+    // Maps material IDs to the indices of both textures
+    GraphicsBinding{
+        .dataType = PipelineDataType::MATERIAL_TABLE,
+        .frequency = BindingFrequency::PER_MATERIAL,
+        .binding = 1,
         .descriptorType = vk::DescriptorType::eStorageBuffer,
         .descriptorCount = 1,
-        .stageFlags = vk::ShaderStageFlagBits::eFragment,
-        .pImmutableSamplers = nullptr,
+        .stages = vk::ShaderStageFlagBits::eFragment,
+        .flags = {},
+    },
+};
+
+vk::ShaderStageFlags toShaderStage(PipelineShaderStage stage)
+{
+    return stage == PipelineShaderStage::VS ? vk::ShaderStageFlagBits::eVertex
+                                            : vk::ShaderStageFlagBits::eFragment;
+}
+
+// Checks that every binding a pass declares has a descriptor that its shader stage can see.
+// Vulkan decides the set and binding itself, so slotToBindTo is ignored
+void validatePassBindings(const std::vector<PipelineBinding>& bindings)
+{
+    for(const PipelineBinding& binding : bindings)
+    {
+        // Indices are bound with vkCmdBindIndexBuffer
+        if(binding.dataType == PipelineDataType::INDEX)
+            continue;
+
+        const vk::ShaderStageFlags stage = toShaderStage(binding.shaderStage);
+        const bool found = std::any_of(
+            entire_collection(GRAPHICS_BINDINGS),
+            [&](const GraphicsBinding& graphicsBinding) {
+                return graphicsBinding.dataType == binding.dataType
+                       && (graphicsBinding.stages & stage);
+            });
+        if(!found)
+            throw std::runtime_error("Pass binding has no descriptor in its shader stage");
+    }
+}
+
+struct DescriptorSlot
+{
+    uint32_t set;
+    uint32_t binding;
+};
+
+// Set and binding of every descriptor the SPIR-V module declares, read from its decorations
+std::vector<DescriptorSlot> getDescriptorSlots(const std::vector<char>& code)
+{
+    // See the SPIR-V specification. The header is five words, after which every instruction
+    // starts with its word count in the high and its opcode in the low 16 bits
+    constexpr uint32_t HEADER_WORD_COUNT = 5;
+    constexpr uint32_t OP_DECORATE = 71;
+    constexpr uint32_t DECORATION_BINDING = 33;
+    constexpr uint32_t DECORATION_DESCRIPTOR_SET = 34;
+
+    std::vector<uint32_t> words(code.size() / sizeof(uint32_t));
+    std::memcpy(words.data(), code.data(), words.size() * sizeof(uint32_t));
+
+    // Keyed by the ID of the variable. Variables without a set decoration are in set 0
+    std::map<uint32_t, DescriptorSlot> slots;
+    std::map<uint32_t, uint32_t> sets;
+    for(size_t i = HEADER_WORD_COUNT; i < words.size();)
+    {
+        const uint32_t wordCount = words[i] >> 16;
+        const uint32_t opcode = words[i] & 0xFFFF;
+        if(wordCount == 0 || i + wordCount > words.size())
+            throw std::runtime_error("Shader module is not valid SPIR-V");
+
+        if(opcode == OP_DECORATE && wordCount == 4 && words[i + 2] == DECORATION_BINDING)
+            slots[words[i + 1]].binding = words[i + 3];
+        else if(opcode == OP_DECORATE && wordCount == 4
+                && words[i + 2] == DECORATION_DESCRIPTOR_SET)
+            sets[words[i + 1]] = words[i + 3];
+        i += wordCount;
+    }
+
+    std::vector<DescriptorSlot> result;
+    for(auto& [id, slot] : slots)
+    {
+        auto set = sets.find(id);
+        slot.set = set != sets.end() ? set->second : 0;
+        result.push_back(slot);
+    }
+    return result;
+}
+
+// The other direction of validatePassBindings. Checks that every descriptor the shader uses is in
+// the set layouts for its stage, and that the pass declares a binding for it in that stage
+void validateShaderDescriptors(
+    const GraphicsRenderPassInfo& info,
+    const std::vector<char>& code,
+    vk::ShaderStageFlags stage)
+{
+    for(const DescriptorSlot& slot : getDescriptorSlots(code))
+    {
+        auto graphicsBinding = std::find_if(
+            entire_collection(GRAPHICS_BINDINGS),
+            [&](const GraphicsBinding& binding) {
+                return (uint32_t)binding.frequency == slot.set && binding.binding == slot.binding;
+            });
+        if(graphicsBinding == GRAPHICS_BINDINGS.end() || !(graphicsBinding->stages & stage))
+            throw std::runtime_error("Shader uses a descriptor that is not in the set layouts");
+
+        auto isDeclared = [&](const PipelineBinding& binding) {
+            return binding.dataType == graphicsBinding->dataType
+                   && toShaderStage(binding.shaderStage) == stage;
+        };
+        if(std::none_of(entire_collection(info.objectBindings), isDeclared)
+           && std::none_of(entire_collection(info.globalBindings), isDeclared))
+            throw std::runtime_error("Shader uses a descriptor that its pass does not declare");
+    }
+}
+
+// Pools of the descriptor allocators are sized for sets that look roughly like these. Other mixes
+// only make the pools fill up sooner
+std::vector<DescriptorTypeRatio> getDescriptorTypeRatios()
+{
+    return {
+        // Frame sets hold four and draw generation sets six
+        {.type = vk::DescriptorType::eStorageBuffer, .countPerSet = 4},
+        // View projection and camera position
+        {.type = vk::DescriptorType::eUniformBuffer, .countPerSet = 1},
+        // The depth pyramid, read by draw generation and by every pyramid level
+        {.type = vk::DescriptorType::eCombinedImageSampler, .countPerSet = 1},
+        // Source and destination of every pyramid level
+        {.type = vk::DescriptorType::eStorageImage, .countPerSet = 2},
+        {.type = vk::DescriptorType::eSampler, .countPerSet = 1},
     };
-    auto lightsLayout = device->createDescriptorSetLayoutUnique({
-        .bindingCount = 1,
-        .pBindings = &lights,
+}
+
+DescriptorSetLayouts createDescriptorSetlayouts(const vk::UniqueDevice& device)
+{
+    std::array<vk::UniqueDescriptorSetLayout, (size_t)BindingFrequency::COUNT> graphicsLayouts;
+    for(uint32_t set = 0; set < (uint32_t)graphicsLayouts.size(); ++set)
+    {
+        std::vector<vk::DescriptorSetLayoutBinding> bindings;
+        std::vector<vk::DescriptorBindingFlags> bindingFlags;
+        for(const GraphicsBinding& binding : GRAPHICS_BINDINGS)
+        {
+            if(binding.frequency != (BindingFrequency)set)
+                continue;
+
+            bindings.push_back({
+                .binding = binding.binding,
+                .descriptorType = binding.descriptorType,
+                .descriptorCount = binding.descriptorCount,
+                .stageFlags = binding.stages,
+                .pImmutableSamplers = nullptr,
+            });
+            bindingFlags.push_back(binding.flags);
+        }
+
+        vk::DescriptorSetLayoutBindingFlagsCreateInfo flagsInfo = {
+            .bindingCount = (uint32_t)bindingFlags.size(),
+            .pBindingFlags = bindingFlags.data(),
+        };
+        const bool updateAfterBind = std::any_of(
+            entire_collection(bindingFlags),
+            [](vk::DescriptorBindingFlags flags) {
+                return bool(flags & vk::DescriptorBindingFlagBits::eUpdateAfterBind);
+            });
+        graphicsLayouts[set] = device->createDescriptorSetLayoutUnique({
+            .pNext = &flagsInfo,
+            .flags = updateAfterBind ? vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool
+                                     : vk::DescriptorSetLayoutCreateFlags(),
+            .bindingCount = (uint32_t)bindings.size(),
+            .pBindings = bindings.data(),
+        });
+    }
+
+    // Tables, transforms, commands, output transforms, culling data, the depth pyramid and output
+    // material IDs, see GenerateDraws.comp
+    std::array<vk::DescriptorSetLayoutBinding, 7> drawGenerationBindings;
+    for(uint32_t i = 0; i < (uint32_t)drawGenerationBindings.size(); ++i)
+    {
+        drawGenerationBindings[i] = {
+            .binding = i,
+            .descriptorType = vk::DescriptorType::eStorageBuffer,
+            .descriptorCount = 1,
+            .stageFlags = vk::ShaderStageFlagBits::eCompute,
+            .pImmutableSamplers = nullptr,
+        };
+    }
+    drawGenerationBindings[5].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+    auto drawGenerationLayout = device->createDescriptorSetLayoutUnique({
+        .bindingCount = (uint32_t)drawGenerationBindings.size(),
+        .pBindings = drawGenerationBindings.data(),
     });
 
-    vk::DescriptorSetLayoutBinding cameraPosition = {
-        .binding = 0,
-        .descriptorType = vk::DescriptorType::eUniformBuffer,
-        .descriptorCount = 1,
-        .stageFlags = vk::ShaderStageFlagBits::eFragment,
-        .pImmutableSamplers = nullptr,
+    // Depth buffer, source level and destination level, see BuildDepthPyramid.comp
+    std::array<vk::DescriptorSetLayoutBinding, 3> depthPyramidBindings = {
+        vk::DescriptorSetLayoutBinding{
+            .binding = 0,
+            .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+            .descriptorCount = 1,
+            .stageFlags = vk::ShaderStageFlagBits::eCompute,
+            .pImmutableSamplers = nullptr,
+        },
+        vk::DescriptorSetLayoutBinding{
+            .binding = 1,
+            .descriptorType = vk::DescriptorType::eStorageImage,
+            .descriptorCount = 1,
+            .stageFlags = vk::ShaderStageFlagBits::eCompute,
+            .pImmutableSamplers = nullptr,
+        },
+        vk::DescriptorSetLayoutBinding{
+            .binding = 2,
+            .descriptorType = vk::DescriptorType::eStorageImage,
+            .descriptorCount = 1,
+            .stageFlags = vk::ShaderStageFlagBits::eCompute,
+            .pImmutableSamplers = nullptr,
+        },
     };
-    auto cameraPositionLayout = device->createDescriptorSetLayoutUnique({
-        .bindingCount = 1,
-        .pBindings = &cameraPosition,
+    auto depthPyramidLayout = device->createDescriptorSetLayoutUnique({
+        .bindingCount = (uint32_t)depthPyramidBindings.size(),
+        .pBindings = depthPyramidBindings.data(),
     });
 
     return DescriptorSetLayouts{
-        .vertexIndex = std::move(vertexIndexLayout),
-        .transformBuffer = std::move(transformLayout),
-        .viewProjection = std::move(viewProjectionLayout),
-        .sampler = std::move(samplerLayout),
-        .textures = std::move(texturesLayout),
-        .lights = std::move(lightsLayout),
-        .cameraPosition = std::move(cameraPositionLayout),
+        .graphics = std::move(graphicsLayouts),
+        .drawGeneration = std::move(drawGenerationLayout),
+        .depthPyramid = std::move(depthPyramidLayout),
     };
 }
 
+// Headless rendering renders into these instead of swapchain images. They are used round robin,
+// one per frame in flight, and are left in eTransferSrcOptimal so that they can be read back
+std::tuple<std::vector<vk::UniqueImage>, std::vector<vk::UniqueDeviceMemory>> createOffscreenImages(
+    const vk::UniqueDevice& device,
+    const vk::PhysicalDevice& physicalDevice,
+    uint32_t queueFamilyIndex,
+    vk::Extent2D extent,
+    uint32_t count)
+{
+    std::vector<vk::UniqueImage> images;
+    std::vector<vk::UniqueDeviceMemory> imageMemory;
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        vk::ImageCreateInfo imageInfo = {
+            .imageType = vk::ImageType::e2D,
+            .format = vk::Format::eB8G8R8A8Srgb,
+            .extent =
+                {
+                    .width = extent.width,
+                    .height = extent.height,
+                    .depth = 1,
+                },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = vk::SampleCountFlagBits::e1,
+            .tiling = vk::ImageTiling::eOptimal,
+            .usage = vk::ImageUsageFlagBits::eColorAttachment
+                     | vk::ImageUsageFlagBits::eTransferSrc,
+            .sharingMode = vk::SharingMode::eExclusive,
+            .queueFamilyIndexCount = 1,
+            .pQueueFamilyIndices = &queueFamilyIndex,
+            .initialLayout = vk::ImageLayout::eUndefined,
+        };
+        auto image = device->createImageUnique(imageInfo);
+
+        vk::MemoryRequirements memoryRequirements = device->getImageMemoryRequirements(*image);
+        vk::PhysicalDeviceMemoryProperties memoryProperties = physicalDevice.getMemoryProperties();
+        std::optional<uint32_t> memoryIndexOpt;
+        for(uint32_t j = 0; j < memoryProperties.memoryTypeCount; ++j)
+        {
+            bool memoryTypeSupported = memoryRequirements.memoryTypeBits & (1 << j);
+
+            if(memoryTypeSupported
+               && memoryProperties.memoryTypes[j].propertyFlags
+                      & vk::MemoryPropertyFlagBits::eDeviceLocal)
+            {
+                memoryIndexOpt = j;
+                break;
+            }
+        }
+        assert(memoryIndexOpt.has_value());
+
+        auto memory = device->allocateMemoryUnique({
+            .allocationSize = memoryRequirements.size,
+            .memoryTypeIndex = memoryIndexOpt.value(),
+        });
+        device->bindImageMemory(*image, *memory, 0);
+
+        images.push_back(std::move(image));
+        imageMemory.push_back(std::move(memory));
+    }
+
+    return std::make_tuple(std::move(images), std::move(imageMemory));
+}
+
 std::tuple<vk::UniqueImage, vk::UniqueDeviceMemory, vk::UniqueImageView> createDepthBuffer(
     const vk::UniqueDevice& device,
     const vk::PhysicalDevice& physicalDevice,
-    uint32_t queueFamilyIndex)
+    uint32_t queueFamilyIndex,
+    vk::Extent2D extent)
 {
     vk::ImageCreateInfo imageInfo = {
         .imageType = vk::ImageType::e2D,
         .format = vk::Format::eD24UnormS8Uint,
         .extent =
             {
-                .width = 1280, // TODO
-                .height = 720, // TODO
+                .width = extent.width,
+                .height = extent.height,
                 .depth = 1,
             },
         .mipLevels = 1,
         .arrayLayers = 1,
         .samples = vk::SampleCountFlagBits::e1,
         .tiling = vk::ImageTiling::eOptimal,
-        .usage = vk::ImageUsageFlagBits::eDepthStencilAttachment,
+        // Sampled when building the depth pyramid
+        .usage = vk::ImageUsageFlagBits::eDepthStencilAttachment
+                 | vk::ImageUsageFlagBits::eSampled,
         .sharingMode = vk::SharingMode::eExclusive,
         .queueFamilyIndexCount = 1,
         .pQueueFamilyIndices = &queueFamilyIndex,
@@ -737,158 +1216,661 @@ std::tuple<vk::UniqueImage, vk::UniqueDeviceMemory, vk::UniqueImageView> createD
         std::move(depthBufferView));
 }
 
-RendererVulkan::RendererVulkan(SDL_Window* windowHandle): currentFrame(0)
+FrameContext createFrameContext(
+    const vk::UniqueDevice& device,
+    uint32_t queueFamilyIndex,
+    uint32_t workerCount,
+    DescriptorAllocator& descriptorAllocator,
+    const DescriptorSetLayouts& descriptorSetLayouts,
+    BufferManagerVulkan& bufferManager,
+    uint32_t frameIndex)
 {
-    // Without vulkan.hpp this would have to be done for every vkEnumerate function
-    unsigned int extensionCount = 0;
-    SDL_Vulkan_GetInstanceExtensions(windowHandle, &extensionCount, nullptr);
-    std::vector<const char*> sdlExtensions(extensionCount);
-    SDL_Vulkan_GetInstanceExtensions(windowHandle, &extensionCount, sdlExtensions.data());
-
-    this->instance = createInstance(sdlExtensions);
-    this->debugCallback = initializeDebugCallback(instance);
-    this->surface = createSurface(windowHandle, instance);
-    std::tie(device, physicalDevice, graphicsQueueIndex) = createDevice(instance, surface);
-    this->graphicsQueue = device->getQueue(graphicsQueueIndex, 0);
-    this->swapchain = createSwapchain(surface, device, physicalDevice);
-    this->renderPass = createRenderPass(device);
-    std::tie(this->depthBuffer, this->depthBufferMemory, this->depthBufferView) =
-        createDepthBuffer(device, physicalDevice, graphicsQueueIndex);
-    std::tie(this->framebuffers, this->backBufferImageViews) =
-        createFramebuffers(device, swapchain, renderPass, depthBufferView);
-    for(auto& fence : queueDoneFences)
-        fence = device->createFenceUnique({.flags = vk::FenceCreateFlagBits::eSignaled});
-    for(auto& semaphore : imageAvailableSemaphores)
-        semaphore = device->createSemaphoreUnique({});
-    for(auto& semaphore : renderFinishedSemaphores)
-        semaphore = device->createSemaphoreUnique({});
-
-    this->descriptorSetLayouts = createDescriptorSetlayouts(device);
-
-    this->samplerManager =
-        std::make_unique<SamplerManagerVulkan>(this->device, descriptorSetLayouts.sampler);
-    this->bufferManager = std::make_unique<BufferManagerVulkan>(this->device, this->physicalDevice);
-    this->textureManager = std::make_unique<TextureManagerVulkan>(
-        this->device,
-        this->physicalDevice,
-        this->graphicsQueue,
-        this->graphicsQueueIndex,
-        descriptorSetLayouts.textures);
+    FrameContext frame;
+    frame.imageAvailableSemaphore = device->createSemaphoreUnique({});
+    frame.renderFinishedSemaphore = device->createSemaphoreUnique({});
 
-    this->commandPool = device->createCommandPoolUnique({
-        .flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
-        .queueFamilyIndex = graphicsQueueIndex,
+    frame.commandPool = device->createCommandPoolUnique({
+        .flags = vk::CommandPoolCreateFlagBits::eTransient,
+        .queueFamilyIndex = queueFamilyIndex,
     });
-    this->commandBuffers = device->allocateCommandBuffersUnique({
-        .commandPool = *commandPool,
+    frame.commandBuffer = std::move(device->allocateCommandBuffersUnique({
+        .commandPool = *frame.commandPool,
         .level = vk::CommandBufferLevel::ePrimary,
-        .commandBufferCount = 3,
-    });
-}
-
-GraphicsRenderPass* RendererVulkan::CreateGraphicsRenderPass(
-    const GraphicsRenderPassInfo& initialisationInfo)
-{
-    // Inner scopes prevents polluting function with random variables
-    {
-        auto vsDataOpt = FileUtils::readFile(initialisationInfo.vsPath);
-        assert(vsDataOpt.has_value());
-        auto vsData = vsDataOpt.value();
-        // SPIR-V specifies 32-bit words, so cast vsData.data()
-        shaderModules.push_back(device->createShaderModuleUnique(
-            {.codeSize = vsData.size(), .pCode = (uint32_t*)vsData.data()}));
-    }
-
-    {
-        // Note: called "fragment" from now on
-        auto fsDataOpt = FileUtils::readFile(initialisationInfo.psPath);
-        assert(fsDataOpt.has_value());
-        auto fsData = fsDataOpt.value();
-        shaderModules.push_back(device->createShaderModuleUnique(
-            {.codeSize = fsData.size(), .pCode = (uint32_t*)fsData.data()}));
-    }
-
-    auto& vsModule = *(shaderModules.end() - 2);
-    auto& fsModule = *(shaderModules.end() - 1);
-
-    std::tie(this->pipeline, this->pipelineLayout) = createPipeline(
-        this->device,
-        this->renderPass,
-        this->descriptorSetLayouts,
-        vsModule,
-        fsModule);
-
-    this->descriptorPool = createDescriptorPool(device);
-    vk::DescriptorSetAllocateInfo descSetInfo = {
-        .descriptorPool = *descriptorPool,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &*descriptorSetLayouts.vertexIndex,
-    };
-    this->vertexIndexDescriptorSet =
-        std::move(device->allocateDescriptorSetsUnique(descSetInfo)[0]);
+        .commandBufferCount = 1,
+    })[0]);
 
-    for(uint32_t i = 0; i < BACKBUFFER_COUNT; ++i)
+    for(uint32_t i = 0; i < workerCount; ++i)
     {
-        descSetInfo = {
-            .descriptorPool = *descriptorPool,
-            .descriptorSetCount = 1,
-            .pSetLayouts = &*descriptorSetLayouts.transformBuffer,
-        };
-        this->transformDescriptorSets[i] =
-            std::move(device->allocateDescriptorSetsUnique(descSetInfo)[0]);
+        frame.workerCommandPools.push_back(WorkerCommandPool{
+            .commandPool = device->createCommandPoolUnique({
+                .flags = vk::CommandPoolCreateFlagBits::eTransient,
+                .queueFamilyIndex = queueFamilyIndex,
+            }),
+            .commandBuffers = {},
+            .usedCommandBuffers = 0,
+        });
     }
 
-    descSetInfo = {
-        .descriptorPool = *descriptorPool,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &*descriptorSetLayouts.viewProjection,
+    const uint32_t transformBufferSize = bufferManager.GetRoundRobinChunkSize();
+    frame.transformBufferOffset = transformBufferSize * frameIndex;
+    frame.transientDescriptors = DescriptorAllocator(*device, getDescriptorTypeRatios(), 16);
+    frame.frameDescriptorSet = descriptorAllocator.Allocate(
+        *descriptorSetLayouts.graphics[(size_t)BindingFrequency::PER_FRAME]);
+
+    // Every mesh lives in the geometry buffer, so only the transforms and the camera differ
+    // between frames. The lights are written by SetLightBuffer
+    const uint32_t instanceMaterialSize = bufferManager.GetInstanceMaterialChunkSize();
+    frame.instanceMaterialOffset = instanceMaterialSize * frameIndex;
+    std::array<vk::DescriptorBufferInfo, 3> frameBufferInfos = {
+        vk::DescriptorBufferInfo{
+            .buffer = bufferManager.GetGeometryBackingBuffer(),
+            .offset = 0,
+            .range = VK_WHOLE_SIZE,
+        },
+        vk::DescriptorBufferInfo{
+            .buffer = bufferManager.GetRoundRobinBuffer(),
+            .offset = frame.transformBufferOffset,
+            .range = transformBufferSize,
+        },
+        vk::DescriptorBufferInfo{
+            .buffer = bufferManager.GetInstanceMaterialBuffer(),
+            .offset = frame.instanceMaterialOffset,
+            .range = instanceMaterialSize,
+        },
     };
-    this->viewProjectionDescriptorSet =
-        std::move(device->allocateDescriptorSetsUnique(descSetInfo)[0]);
-
-    descSetInfo = {
-        .descriptorPool = *descriptorPool,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &*descriptorSetLayouts.lights,
+    vk::WriteDescriptorSet frameWriteDescriptor = {
+        .dstSet = frame.frameDescriptorSet,
+        .dstBinding = 0,
+        .dstArrayElement = 0,
+        .descriptorCount = (uint32_t)frameBufferInfos.size(),
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .pImageInfo = nullptr,
+        .pBufferInfo = frameBufferInfos.data(),
+        .pTexelBufferView = nullptr,
     };
-    this->lightBufferDescriptorSet =
-        std::move(device->allocateDescriptorSetsUnique(descSetInfo)[0]);
+    device->updateDescriptorSets(1, &frameWriteDescriptor, 0, nullptr);
+
+    frame.cameraDataOffset = bufferManager.GetCameraDataChunkSize() * frameIndex;
+    std::array<vk::DescriptorBufferInfo, 2> cameraBufferInfos = {
+        vk::DescriptorBufferInfo{
+            .buffer = bufferManager.GetCameraDataBuffer(),
+            .offset = frame.cameraDataOffset,
+            .range = sizeof(glm::mat4),
+        },
+        vk::DescriptorBufferInfo{
+            .buffer = bufferManager.GetCameraDataBuffer(),
+            .offset = frame.cameraDataOffset + CAMERA_POSITION_OFFSET,
+            .range = sizeof(glm::vec4),
+        },
+    };
+    vk::WriteDescriptorSet cameraWriteDescriptor = {
+        .dstSet = frame.frameDescriptorSet,
+        .dstBinding = 3,
+        .dstArrayElement = 0,
+        .descriptorCount = (uint32_t)cameraBufferInfos.size(),
+        .descriptorType = vk::DescriptorType::eUniformBuffer,
+        .pImageInfo = nullptr,
+        .pBufferInfo = cameraBufferInfos.data(),
+        .pTexelBufferView = nullptr,
+    };
+    device->updateDescriptorSets(1, &cameraWriteDescriptor, 0, nullptr);
+
+    const uint32_t indirectBufferSize = bufferManager.GetIndirectChunkSize();
+    frame.indirectBufferOffset = indirectBufferSize * frameIndex;
+    frame.drawGenerationDescriptorSet =
+        descriptorAllocator.Allocate(*descriptorSetLayouts.drawGeneration);
+
+    const uint32_t cullingDataSize = bufferManager.GetCullingDataChunkSize();
+    frame.cullingDataOffset = cullingDataSize * frameIndex;
+    frame.cullingStatisticsPending = false;
+
+    // The tables and the transforms are read where they were added, so every table of every
+    // object list can be reached through the same descriptors. The depth pyramid is written by
+    // writeDepthPyramidDescriptors
+    std::array<vk::DescriptorBufferInfo, 5> drawGenerationBufferInfos = {
+        vk::DescriptorBufferInfo{
+            .buffer = bufferManager.GetWriteOnceBackingBuffer(),
+            .offset = 0,
+            .range = VK_WHOLE_SIZE,
+        },
+        vk::DescriptorBufferInfo{
+            .buffer = bufferManager.GetDynamicBackingBuffer(),
+            .offset = 0,
+            .range = VK_WHOLE_SIZE,
+        },
+        vk::DescriptorBufferInfo{
+            .buffer = bufferManager.GetIndirectBuffer(),
+            .offset = frame.indirectBufferOffset,
+            .range = indirectBufferSize,
+        },
+        vk::DescriptorBufferInfo{
+            .buffer = bufferManager.GetRoundRobinBuffer(),
+            .offset = frame.transformBufferOffset,
+            .range = transformBufferSize,
+        },
+        vk::DescriptorBufferInfo{
+            .buffer = bufferManager.GetCullingDataBuffer(),
+            .offset = frame.cullingDataOffset,
+            .range = cullingDataSize,
+        },
+    };
+    vk::WriteDescriptorSet drawGenerationWriteDescriptor = {
+        .dstSet = frame.drawGenerationDescriptorSet,
+        .dstBinding = 0,
+        .dstArrayElement = 0,
+        .descriptorCount = (uint32_t)drawGenerationBufferInfos.size(),
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .pImageInfo = nullptr,
+        .pBufferInfo = drawGenerationBufferInfos.data(),
+        .pTexelBufferView = nullptr,
+    };
+    device->updateDescriptorSets(1, &drawGenerationWriteDescriptor, 0, nullptr);
+
+    vk::DescriptorBufferInfo outputMaterialInfo = frameBufferInfos[2];
+    vk::WriteDescriptorSet outputMaterialWriteDescriptor = {
+        .dstSet = frame.drawGenerationDescriptorSet,
+        .dstBinding = 6,
+        .dstArrayElement = 0,
+        .descriptorCount = 1,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .pImageInfo = nullptr,
+        .pBufferInfo = &outputMaterialInfo,
+        .pTexelBufferView = nullptr,
+    };
+    device->updateDescriptorSets(1, &outputMaterialWriteDescriptor, 0, nullptr);
+
+    return frame;
+}
+
+// Adds a copy of transformBuffer from the dynamic backing buffer to dstOffset. Transforms that were
+// added back to back are contiguous in the backing buffer, so their copies are merged
+void appendTransformCopy(
+    std::vector<vk::BufferCopy>& copies,
+    const Buffer& transformBuffer,
+    uint32_t dstOffset)
+{
+    assert(transformBuffer.backingBufferType == BackingBufferType::DYNAMIC);
+    assert(transformBuffer.sizeWithPadding == sizeof(glm::mat4));
+
+    if(!copies.empty())
+    {
+        vk::BufferCopy& previous = copies.back();
+        if(previous.srcOffset + previous.size == transformBuffer.backingBufferOffset
+           && previous.dstOffset + previous.size == dstOffset)
+        {
+            previous.size += transformBuffer.sizeWithoutPadding;
+            return;
+        }
+    }
+
+    copies.push_back(vk::BufferCopy{
+        .srcOffset = transformBuffer.backingBufferOffset,
+        .dstOffset = dstOffset,
+        .size = transformBuffer.sizeWithoutPadding,
+    });
+}
+
+RendererVulkan::RendererVulkan(
+    SDL_Window* windowHandle,
+    uint32_t framesInFlight,
+    PresentMode preferredPresentMode)
+    : windowHandle(windowHandle)
+    , preferredPresentMode(preferredPresentMode)
+    , swapchainOutOfDate(false)
+    , skipFrame(false)
+    , activeRenderPass(nullptr)
+    , queuedTransformCount(0)
+    , gpuDrivenRendering(false)
+    , frustumCulling(true)
+    , occlusionCulling(true)
+    , depthBufferHasContent(false)
+    , cullingStatistics()
+    , depthPrepass(false)
+    , currentFrame(0)
+    , cpuRecordTime(0.0)
+{
+    assert(framesInFlight > 0);
+
+    // Without vulkan.hpp this would have to be done for every vkEnumerate function
+    unsigned int extensionCount = 0;
+    SDL_Vulkan_GetInstanceExtensions(windowHandle, &extensionCount, nullptr);
+    std::vector<const char*> sdlExtensions(extensionCount);
+    SDL_Vulkan_GetInstanceExtensions(windowHandle, &extensionCount, sdlExtensions.data());
+
+    this->instance = createInstance(sdlExtensions);
+#ifndef NDEBUG
+    this->debugCallback = initializeDebugCallback(instance);
+#endif
+    this->surface = createSurface(windowHandle, instance);
+    std::tie(device, physicalDevice, graphicsQueueIndex, transferQueueIndex) =
+        createDevice(instance, surface);
+    this->graphicsQueue = device->getQueue(graphicsQueueIndex, 0);
+    this->transferQueue = device->getQueue(transferQueueIndex, 0);
+    std::tie(this->swapchain, this->renderExtent) = createSwapchain(
+        windowHandle,
+        surface,
+        device,
+        physicalDevice,
+        preferredPresentMode,
+        VK_NULL_HANDLE);
+    if(!swapchain)
+        throw std::runtime_error("Cannot create a swapchain for a window without area");
+    this->backBufferImages = device->getSwapchainImagesKHR(*swapchain);
+    this->renderPass = createRenderPass(device, vk::ImageLayout::ePresentSrcKHR);
+
+    initialise(framesInFlight);
+}
+
+RendererVulkan::RendererVulkan(uint32_t width, uint32_t height, uint32_t framesInFlight)
+    : windowHandle(nullptr)
+    , preferredPresentMode(PresentMode::IMMEDIATE)
+    , swapchainOutOfDate(false)
+    , skipFrame(false)
+    , activeRenderPass(nullptr)
+    , queuedTransformCount(0)
+    , gpuDrivenRendering(false)
+    , frustumCulling(true)
+    , occlusionCulling(true)
+    , depthBufferHasContent(false)
+    , cullingStatistics()
+    , depthPrepass(false)
+    , currentFrame(0)
+    , cpuRecordTime(0.0)
+{
+    assert(framesInFlight > 0);
+
+    this->instance = createInstance({});
+#ifndef NDEBUG
+    this->debugCallback = initializeDebugCallback(instance);
+#endif
+    // No surface, so any device with a graphics queue will do, including software rasterizers
+    std::tie(device, physicalDevice, graphicsQueueIndex, transferQueueIndex) =
+        createDevice(instance, surface);
+    this->graphicsQueue = device->getQueue(graphicsQueueIndex, 0);
+    this->transferQueue = device->getQueue(transferQueueIndex, 0);
+    this->renderExtent = vk::Extent2D{.width = width, .height = height};
+    std::tie(this->offscreenImages, this->offscreenImageMemory) = createOffscreenImages(
+        device,
+        physicalDevice,
+        graphicsQueueIndex,
+        renderExtent,
+        framesInFlight);
+    std::transform(
+        entire_collection(offscreenImages),
+        std::back_inserter(backBufferImages),
+        [](const vk::UniqueImage& image) { return *image; });
+    this->renderPass = createRenderPass(device, vk::ImageLayout::eTransferSrcOptimal);
+
+    initialise(framesInFlight);
+}
+
+const char* const PIPELINE_CACHE_PATH = SHADER_ROOT_DIR "PipelineCache.bin";
+// Written in front of the driver's data since the driver's header doesn't include the driver
+// version, and a new driver might not reject data from an old one
+struct PipelineCacheFileHeader
+{
+    static constexpr uint32_t MAGIC = 0x43505247; // "GRPC"
+
+    uint32_t magic;
+    uint32_t driverVersion;
+    uint64_t dataSize;
+};
+
+// Checks both headers against the device so that the driver never sees data it didn't write
+bool isPipelineCacheValid(
+    const std::vector<char>& fileData,
+    const vk::PhysicalDeviceProperties& properties)
+{
+    // headerSize, headerVersion, vendorID, deviceID, pipelineCacheUUID
+    const size_t DRIVER_HEADER_SIZE = 4 * sizeof(uint32_t) + VK_UUID_SIZE;
+    if(fileData.size() < sizeof(PipelineCacheFileHeader) + DRIVER_HEADER_SIZE)
+        return false;
+
+    PipelineCacheFileHeader fileHeader;
+    std::memcpy(&fileHeader, fileData.data(), sizeof(fileHeader));
+    if(fileHeader.magic != PipelineCacheFileHeader::MAGIC
+       || fileHeader.driverVersion != properties.driverVersion
+       || fileHeader.dataSize != fileData.size() - sizeof(fileHeader))
+        return false;
+
+    const char* driverData = fileData.data() + sizeof(fileHeader);
+    uint32_t driverHeader[4];
+    std::memcpy(driverHeader, driverData, sizeof(driverHeader));
+    if(driverHeader[0] < DRIVER_HEADER_SIZE
+       || driverHeader[1] != (uint32_t)vk::PipelineCacheHeaderVersion::eOne
+       || driverHeader[2] != properties.vendorID || driverHeader[3] != properties.deviceID)
+        return false;
+
+    return std::memcmp(
+               driverData + sizeof(driverHeader),
+               properties.pipelineCacheUUID.data(),
+               VK_UUID_SIZE)
+           == 0;
+}
+
+void RendererVulkan::initialise(uint32_t framesInFlight)
+{
+    vk::PhysicalDeviceProperties properties = physicalDevice.getProperties();
+    std::optional<std::vector<char>> cacheFileOpt = FileUtils::readFile(PIPELINE_CACHE_PATH);
+    this->pipelineCacheWarm =
+        cacheFileOpt.has_value() && isPipelineCacheValid(cacheFileOpt.value(), properties);
+    if(pipelineCacheWarm)
+    {
+        const std::vector<char>& cacheFile = cacheFileOpt.value();
+        this->pipelineCache = device->createPipelineCacheUnique({
+            .initialDataSize = cacheFile.size() - sizeof(PipelineCacheFileHeader),
+            .pInitialData = cacheFile.data() + sizeof(PipelineCacheFileHeader),
+        });
+    }
+    else
+    {
+        this->pipelineCache = device->createPipelineCacheUnique({});
+    }
+    this->pipelineCreationTime = 0.0;
+
+    std::tie(this->depthBuffer, this->depthBufferMemory, this->depthBufferView) =
+        createDepthBuffer(device, physicalDevice, graphicsQueueIndex, renderExtent);
+    std::tie(this->framebuffers, this->backBufferImageViews) =
+        createFramebuffers(device, backBufferImages, renderPass, depthBufferView, renderExtent);
+
+    this->descriptorSetLayouts = createDescriptorSetlayouts(device);
+    this->graphicsPipelineLayout = createPipelineLayout(device, descriptorSetLayouts);
+    // Persistent sets are few, so the first pool is small and later ones grow
+    this->descriptorAllocator = DescriptorAllocator(*device, getDescriptorTypeRatios(), 32);
+
+    this->samplerManager = std::make_unique<SamplerManagerVulkan>(
+        this->device,
+        descriptorSetLayouts.graphics[(size_t)BindingFrequency::PER_PASS],
+        descriptorAllocator);
+    this->bufferManager = std::make_unique<BufferManagerVulkan>(
+        this->device,
+        this->physicalDevice,
+        framesInFlight);
+    this->textureManager = std::make_unique<TextureManagerVulkan>(
+        this->device,
+        this->physicalDevice,
+        this->transferQueue,
+        this->transferQueueIndex,
+        this->graphicsQueueIndex,
+        descriptorSetLayouts.graphics[(size_t)BindingFrequency::PER_MATERIAL]);
+
+    // The texture manager owns the material set since it adds the textures. Materials are
+    // appended to the table, so this never has to be written again
+    vk::DescriptorBufferInfo materialTableInfo = {
+        .buffer = bufferManager->GetMaterialTableBuffer(),
+        .offset = 0,
+        .range = VK_WHOLE_SIZE,
+    };
+    vk::WriteDescriptorSet materialTableWriteDescriptor = {
+        .dstSet = textureManager->GetDescriptorSet(),
+        .dstBinding = 1,
+        .dstArrayElement = 0,
+        .descriptorCount = 1,
+        .descriptorType = vk::DescriptorType::eStorageBuffer,
+        .pImageInfo = nullptr,
+        .pBufferInfo = &materialTableInfo,
+        .pTexelBufferView = nullptr,
+    };
+    device->updateDescriptorSets(1, &materialTableWriteDescriptor, 0, nullptr);
+
+    uint32_t workerCount = std::max(1u, std::thread::hardware_concurrency());
+    this->workerPool = std::make_unique<WorkerPool>(workerCount);
+
+    vk::SemaphoreTypeCreateInfo timelineCreateInfo = {
+        .semaphoreType = vk::SemaphoreType::eTimeline,
+        .initialValue = 0,
+    };
+    this->frameTimeline = device->createSemaphoreUnique({.pNext = &timelineCreateInfo});
+    for(uint32_t i = 0; i < framesInFlight; ++i)
+    {
+        frames.push_back(createFrameContext(
+            device,
+            graphicsQueueIndex,
+            workerCount,
+            descriptorAllocator,
+            descriptorSetLayouts,
+            *bufferManager,
+            i));
+    }
+
+    // createDevice enables these features whenever they are supported
+    const vk::PhysicalDeviceFeatures features = physicalDevice.getFeatures();
+    this->multiDrawIndirectSupported = features.multiDrawIndirect;
+    // createInstance enables debug utils whenever they are available
+    this->gpuProfiler = GpuProfiler(
+        *instance,
+        physicalDevice,
+        *device,
+        graphicsQueueIndex,
+        framesInFlight,
+        features.pipelineStatisticsQuery && features.inheritedQueries,
+        hasInstanceExtension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME));
+    this->renderGraph = RenderGraph(*device, physicalDevice, framesInFlight);
+    vk::PushConstantRange drawGenerationPushConstants = {
+        .stageFlags = vk::ShaderStageFlagBits::eCompute,
+        .offset = 0,
+        .size = sizeof(DrawGenerationParameters),
+    };
+    this->drawGenerationPipelineLayout = device->createPipelineLayoutUnique({
+        .setLayoutCount = 1,
+        .pSetLayouts = &*descriptorSetLayouts.drawGeneration,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &drawGenerationPushConstants,
+    });
+    this->resetDrawsPipeline = createComputePipeline(
+        device,
+        drawGenerationPipelineLayout,
+        pipelineCache,
+        *getShaderModule(SHADER_ROOT_DIR "shaders/ResetDraws.comp.spv").module);
+    this->generateDrawsPipeline = createComputePipeline(
+        device,
+        drawGenerationPipelineLayout,
+        pipelineCache,
+        *getShaderModule(SHADER_ROOT_DIR "shaders/GenerateDraws.comp.spv").module);
+
+    // Depth is compared per texel, so neither building nor sampling the pyramid filters
+    this->depthPyramidSampler = device->createSamplerUnique({
+        .magFilter = vk::Filter::eNearest,
+        .minFilter = vk::Filter::eNearest,
+        .mipmapMode = vk::SamplerMipmapMode::eNearest,
+        .addressModeU = vk::SamplerAddressMode::eClampToEdge,
+        .addressModeV = vk::SamplerAddressMode::eClampToEdge,
+        .addressModeW = vk::SamplerAddressMode::eClampToEdge,
+        .mipLodBias = 0,
+        .anisotropyEnable = false,
+        .maxAnisotropy = 1,
+        .compareEnable = false,
+        .compareOp = vk::CompareOp::eNever,
+        .minLod = 0,
+        .maxLod = VK_LOD_CLAMP_NONE,
+        .borderColor = vk::BorderColor::eFloatOpaqueWhite,
+        .unnormalizedCoordinates = false,
+    });
+    vk::PushConstantRange depthPyramidPushConstants = {
+        .stageFlags = vk::ShaderStageFlagBits::eCompute,
+        .offset = 0,
+        .size = sizeof(DepthPyramidParameters),
+    };
+    this->depthPyramidPipelineLayout = device->createPipelineLayoutUnique({
+        .setLayoutCount = 1,
+        .pSetLayouts = &*descriptorSetLayouts.depthPyramid,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &depthPyramidPushConstants,
+    });
+    this->depthPyramidPipeline = createComputePipeline(
+        device,
+        depthPyramidPipelineLayout,
+        pipelineCache,
+        *getShaderModule(SHADER_ROOT_DIR "shaders/BuildDepthPyramid.comp.spv").module);
+}
+
+RendererVulkan::~RendererVulkan()
+{
+    // Moved-from renderers have nothing to save
+    if(!device || !pipelineCache)
+        return;
+
+    device->waitIdle();
+
+    std::vector<uint8_t> driverData = device->getPipelineCacheData(*pipelineCache);
+    PipelineCacheFileHeader fileHeader = {
+        .magic = PipelineCacheFileHeader::MAGIC,
+        .driverVersion = physicalDevice.getProperties().driverVersion,
+        .dataSize = driverData.size(),
+    };
+
+    std::vector<char> fileData(sizeof(fileHeader) + driverData.size());
+    std::memcpy(fileData.data(), &fileHeader, sizeof(fileHeader));
+    std::memcpy(fileData.data() + sizeof(fileHeader), driverData.data(), driverData.size());
+    if(!FileUtils::writeFile(PIPELINE_CACHE_PATH, fileData))
+        std::cerr << "Could not write pipeline cache to " << PIPELINE_CACHE_PATH << std::endl;
+}
+
+const CachedShaderModule& RendererVulkan::getShaderModule(const std::string& path)
+{
+    auto dataOpt = FileUtils::readFile(path);
+    assert(dataOpt.has_value());
+    auto& data = dataOpt.value();
+
+    uint64_t hash = HashUtils::fnv1a(data.data(), data.size());
+    auto [first, last] = shaderModules.equal_range(hash);
+    auto iter = std::find_if(first, last, [&](const auto& entry) {
+        return entry.second.code == data;
+    });
+    if(iter == last)
+    {
+        // SPIR-V specifies 32-bit words, so cast data.data()
+        auto shaderModule = device->createShaderModuleUnique(
+            {.codeSize = data.size(), .pCode = (uint32_t*)data.data()});
+        iter = shaderModules.emplace(
+            hash,
+            CachedShaderModule{
+                .code = std::move(data),
+                .module = std::move(shaderModule),
+            });
+    }
+
+    return iter->second;
+}
+
+size_t PipelineKeyHash::operator()(const PipelineKey& key) const
+{
+    std::hash<vk::ShaderModule> hashModule;
+    uint64_t hash = HashUtils::hashValue(hashModule(key.vertexShader));
+    hash = HashUtils::hashValue(hashModule(key.fragmentShader), hash);
+    hash = HashUtils::hashValue(hashModule(key.depthVertexShader), hash);
+    return (size_t)hash;
+}
 
-    descSetInfo = {
-        .descriptorPool = *descriptorPool,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &*descriptorSetLayouts.cameraPosition,
+GraphicsRenderPass* RendererVulkan::CreateGraphicsRenderPass(
+    const GraphicsRenderPassInfo& initialisationInfo)
+{
+    PROFILE_ZONE("CreateGraphicsRenderPass");
+    // Every pass shares the same set layouts, so the declared bindings and the descriptors of the
+    // shaders only have to agree with them
+    validatePassBindings(initialisationInfo.objectBindings);
+    validatePassBindings(initialisationInfo.globalBindings);
+    const CachedShaderModule& vertexShader = getShaderModule(initialisationInfo.vsPath);
+    validateShaderDescriptors(
+        initialisationInfo,
+        vertexShader.code,
+        vk::ShaderStageFlagBits::eVertex);
+    vk::ShaderModule vsModule = *vertexShader.module;
+    // Note: called "fragment" from now on
+    const CachedShaderModule& fragmentShader = getShaderModule(initialisationInfo.psPath);
+    validateShaderDescriptors(
+        initialisationInfo,
+        fragmentShader.code,
+        vk::ShaderStageFlagBits::eFragment);
+    vk::ShaderModule fsModule = *fragmentShader.module;
+    const bool hasDepthPrepass = !initialisationInfo.depthVsPath.empty();
+    vk::ShaderModule depthVsModule = VK_NULL_HANDLE;
+    if(hasDepthPrepass)
+    {
+        const CachedShaderModule& depthShader = getShaderModule(initialisationInfo.depthVsPath);
+        validateShaderDescriptors(
+            initialisationInfo,
+            depthShader.code,
+            vk::ShaderStageFlagBits::eVertex);
+        depthVsModule = *depthShader.module;
+    }
+
+    // Passes with identical shaders share one pipeline, whatever bindings they declare
+    const PipelineKey pipelineKey = {
+        .vertexShader = vsModule,
+        .fragmentShader = fsModule,
+        .depthVertexShader = depthVsModule,
     };
-    this->cameraPositionDescriptorSet =
-        std::move(device->allocateDescriptorSetsUnique(descSetInfo)[0]);
+    auto iter = pipelines.find(pipelineKey);
+    if(iter == pipelines.end())
+    {
+        auto pipelineStart = std::chrono::steady_clock::now();
+        CachedPipeline cachedPipeline;
+        cachedPipeline.pipeline = createPipeline(
+            this->device,
+            this->renderPass,
+            graphicsPipelineLayout,
+            this->pipelineCache,
+            vsModule,
+            fsModule,
+            DepthMode::TEST_AND_WRITE);
+        // Created up front so that the prepass can be toggled without hitches
+        if(hasDepthPrepass)
+        {
+            cachedPipeline.depthPrepassPipeline = createPipeline(
+                this->device,
+                this->renderPass,
+                graphicsPipelineLayout,
+                this->pipelineCache,
+                depthVsModule,
+                VK_NULL_HANDLE,
+                DepthMode::PREPASS);
+            cachedPipeline.depthEqualPipeline = createPipeline(
+                this->device,
+                this->renderPass,
+                graphicsPipelineLayout,
+                this->pipelineCache,
+                vsModule,
+                fsModule,
+                DepthMode::EQUAL);
+        }
+        std::chrono::duration<double, std::milli> pipelineTime =
+            std::chrono::steady_clock::now() - pipelineStart;
+        pipelineCreationTime += pipelineTime.count();
+
+        iter = pipelines.emplace(pipelineKey, std::move(cachedPipeline)).first;
+    }
 
-    this->renderPasses.push_back(GraphicsRenderPassVulkan(
-        vsModule,
-        fsModule,
+    this->renderPasses.push_back(std::make_unique<GraphicsRenderPassVulkan>(
+        *iter->second.pipeline,
+        *iter->second.depthPrepassPipeline,
+        *iter->second.depthEqualPipeline,
+        *graphicsPipelineLayout,
         initialisationInfo.objectBindings,
         initialisationInfo.globalBindings));
-    return &this->renderPasses.back();
+    return this->renderPasses.back().get();
 }
 
 void RendererVulkan::DestroyGraphicsRenderPass(GraphicsRenderPass* pass)
 {
     device->waitIdle();
+
+    // The pipeline stays in the cache since other passes may share it
+    auto iter = std::find_if(entire_collection(renderPasses), [&](const auto& renderPass) {
+        return renderPass.get() == pass;
+    });
+    assert(iter != renderPasses.end());
+    renderPasses.erase(iter);
+
+    if(activeRenderPass == pass)
+        activeRenderPass = nullptr;
 }
 
 Camera* RendererVulkan::CreateCamera(float minDepth, float maxDepth, float aspectRatio)
 {
     assert(!this->cameraOpt);
-    this->cameraOpt = CameraVulkan(*bufferManager, minDepth, maxDepth, aspectRatio);
-
-    CameraVulkan& camera = this->cameraOpt.value();
-    auto viewProj = camera.GetViewProjMatrix();
-    cameraBufferIndex = bufferManager->AddBuffer(
-        &viewProj,
-        sizeof(float),
-        16,
-        PerFrameWritePattern::NEVER,
-        PerFrameWritePattern::NEVER,
-        0);
+    // Every frame context already points at its own copy of the camera, see PreRender
+    this->cameraOpt = CameraVulkan(minDepth, maxDepth, aspectRatio);
 
     // The &* syntax is the best
     return &*this->cameraOpt;
@@ -914,9 +1896,46 @@ SamplerManager* RendererVulkan::GetSamplerManager()
     return samplerManager.get();
 }
 
-void RendererVulkan::SetRenderPass(GraphicsRenderPass* toSet) {}
+void RendererVulkan::SetRenderPass(GraphicsRenderPass* toSet)
+{
+    this->activeRenderPass = static_cast<GraphicsRenderPassVulkan*>(toSet);
+}
+
+void RendererVulkan::SetGpuDrivenRendering(bool enabled)
+{
+    this->gpuDrivenRendering = enabled;
+}
+
+void RendererVulkan::SetFrustumCulling(bool enabled)
+{
+    this->frustumCulling = enabled;
+}
+
+void RendererVulkan::SetOcclusionCulling(bool enabled)
+{
+    this->occlusionCulling = enabled;
+}
+
+void RendererVulkan::SetDepthPrepass(bool enabled)
+{
+    this->depthPrepass = enabled;
+}
+
+CullingStatistics RendererVulkan::GetCullingStatistics() const
+{
+    return cullingStatistics;
+}
+
+const GpuFrameStatistics& RendererVulkan::GetGpuFrameStatistics() const
+{
+    return gpuProfiler.GetLastFrameStatistics();
+}
 
-void RendererVulkan::SetCamera(Camera* toSet) {}
+void RendererVulkan::SetCamera(Camera* toSet)
+{
+    // Only one camera can exist at a time, so there is nothing to switch to
+    assert(cameraOpt && toSet == &*cameraOpt);
+}
 
 void RendererVulkan::SetLightBuffer(ResourceIndex lightBufferIndexToUse)
 {
@@ -928,215 +1947,493 @@ void RendererVulkan::SetLightBuffer(ResourceIndex lightBufferIndexToUse)
         .offset = buffer.backingBufferOffset,
         .range = buffer.sizeWithoutPadding,
     };
-    vk::WriteDescriptorSet bufferDescriptor = {
-        .dstSet = *lightBufferDescriptorSet,
-        .dstBinding = 0,
-        .dstArrayElement = 0,
-        .descriptorCount = 1,
-        .descriptorType = vk::DescriptorType::eStorageBuffer,
-        .pImageInfo = nullptr,
-        .pBufferInfo = &bufferInfo,
-        .pTexelBufferView = nullptr,
-    };
-    device->updateDescriptorSets(1, &bufferDescriptor, 0, nullptr);
+    for(FrameContext& frame : frames)
+    {
+        vk::WriteDescriptorSet bufferDescriptor = {
+            .dstSet = frame.frameDescriptorSet,
+            .dstBinding = 5,
+            .dstArrayElement = 0,
+            .descriptorCount = 1,
+            .descriptorType = vk::DescriptorType::eStorageBuffer,
+            .pImageInfo = nullptr,
+            .pBufferInfo = &bufferInfo,
+            .pTexelBufferView = nullptr,
+        };
+        device->updateDescriptorSets(1, &bufferDescriptor, 0, nullptr);
+    }
 }
 
-void RendererVulkan::PreRender()
+bool RendererVulkan::recreateSwapchain()
 {
-    assert(
-        device->waitForFences(*queueDoneFences[currentFrame % BACKBUFFER_COUNT], true, UINT64_MAX)
-        == vk::Result::eSuccess);
-
-    vk::Result res;
-    std::tie(res, currentSwapchainImageIndex) = device->acquireNextImageKHR(
-        *swapchain,
-        UINT64_MAX,
-        *imageAvailableSemaphores[currentFrame % BACKBUFFER_COUNT],
-        VK_NULL_HANDLE);
-    device->resetFences(*queueDoneFences[currentFrame % BACKBUFFER_COUNT]);
-    assert(res == vk::Result::eSuccess);
+    device->waitIdle();
 
-    glm::mat4 viewProj = cameraOpt->GetViewProjMatrix();
-    bufferManager->UpdateBuffer(cameraBufferIndex, &viewProj);
-    glm::vec3 cameraPosition = cameraOpt->GetPosition();
-    bufferManager->UpdateBuffer(cameraOpt->GetCameraPositionBufferIndex(), &cameraPosition);
+    auto [newSwapchain, newExtent] = createSwapchain(
+        windowHandle,
+        surface,
+        device,
+        physicalDevice,
+        preferredPresentMode,
+        *swapchain);
+    if(!newSwapchain)
+        return false;
+
+    // Everything that references the old images has to go before the old swapchain does
+    framebuffers.clear();
+    backBufferImageViews.clear();
+    depthBufferView.reset();
+    depthBuffer.reset();
+    depthBufferMemory.reset();
+
+    this->swapchain = std::move(newSwapchain);
+    this->renderExtent = newExtent;
+    this->backBufferImages = device->getSwapchainImagesKHR(*swapchain);
+    std::tie(this->depthBuffer, this->depthBufferMemory, this->depthBufferView) =
+        createDepthBuffer(device, physicalDevice, graphicsQueueIndex, renderExtent);
+    std::tie(this->framebuffers, this->backBufferImageViews) =
+        createFramebuffers(device, backBufferImages, renderPass, depthBufferView, renderExtent);
+    depthBufferState = {};
+    depthBufferHasContent = false;
 
-    commandBuffers[currentFrame % BACKBUFFER_COUNT]->reset();
-    commandBuffers[currentFrame % BACKBUFFER_COUNT]->begin(
-        {.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    swapchainOutOfDate = false;
+    return true;
+}
 
-    commandBuffers[currentFrame % BACKBUFFER_COUNT]->bindPipeline(
-        vk::PipelineBindPoint::eGraphics,
-        *pipeline);
+FrameContext& RendererVulkan::getCurrentFrameContext()
+{
+    return frames[currentFrame % frames.size()];
+}
 
-    commandBuffers[currentFrame % BACKBUFFER_COUNT]->bindDescriptorSets(
-        vk::PipelineBindPoint::eGraphics,
-        *pipelineLayout,
-        6,
-        1,
-        &*lightBufferDescriptorSet,
-        0,
-        nullptr);
-    commandBuffers[currentFrame % BACKBUFFER_COUNT]->bindDescriptorSets(
-        vk::PipelineBindPoint::eGraphics,
-        *pipelineLayout,
-        7,
-        1,
-        &*cameraPositionDescriptorSet,
-        0,
-        nullptr);
+uint64_t RendererVulkan::GetCurrentFrame() const
+{
+    return currentFrame;
 }
 
-void RendererVulkan::Render(const std::vector<RenderObject>& objectsToRender)
+bool RendererVulkan::IsFrameComplete(uint64_t frame) const
 {
-    static bool once = false;
-    if(!once)
-    {
-        const auto& renderObject = objectsToRender[0];
+    return device->getSemaphoreCounterValue(*frameTimeline) > frame;
+}
 
-        auto vertexBuffer = bufferManager->GetBuffer(renderObject.GetMesh().GetVertexBuffer());
-        vk::DescriptorBufferInfo vertexBufferInfo = {
-            .buffer = bufferManager->GetBackingBuffer(renderObject.GetMesh().GetVertexBuffer()),
-            .offset = vertexBuffer.backingBufferOffset,
-            .range = vertexBuffer.sizeWithoutPadding,
-        };
-        vk::WriteDescriptorSet vertexWriteDescriptor = {
-            .dstSet = *vertexIndexDescriptorSet,
-            .dstBinding = 0,
-            .dstArrayElement = 0,
-            .descriptorCount = 1,
-            .descriptorType = vk::DescriptorType::eStorageBuffer,
-            .pImageInfo = nullptr,
-            .pBufferInfo = &vertexBufferInfo,
-            .pTexelBufferView = nullptr,
-        };
+void RendererVulkan::WaitForFrame(uint64_t frame) const
+{
+    const uint64_t value = frame + 1;
+    vk::Result waitResult = device->waitSemaphores(
+        {
+            .semaphoreCount = 1,
+            .pSemaphores = &*frameTimeline,
+            .pValues = &value,
+        },
+        UINT64_MAX);
+    assert(waitResult == vk::Result::eSuccess);
+}
 
-        auto indexBuffer = bufferManager->GetBuffer(renderObject.GetMesh().GetIndexBuffer());
-        vk::DescriptorBufferInfo indexBufferInfo = {
-            .buffer = bufferManager->GetBackingBuffer(renderObject.GetMesh().GetIndexBuffer()),
-            .offset = indexBuffer.backingBufferOffset,
-            .range = indexBuffer.sizeWithoutPadding,
-        };
-        vk::WriteDescriptorSet indexWriteDescriptor = {
-            .dstSet = *vertexIndexDescriptorSet,
-            .dstBinding = 1,
-            .dstArrayElement = 0,
-            .descriptorCount = 1,
-            .descriptorType = vk::DescriptorType::eStorageBuffer,
-            .pImageInfo = nullptr,
-            .pBufferInfo = &indexBufferInfo,
-            .pTexelBufferView = nullptr,
-        };
+double RendererVulkan::GetCpuRecordTime() const
+{
+    return cpuRecordTime;
+}
 
-        vk::WriteDescriptorSet descriptorSets[2] = {vertexWriteDescriptor, indexWriteDescriptor};
-        device->updateDescriptorSets(2, descriptorSets, 0, nullptr);
+bool RendererVulkan::IsPipelineCacheWarm() const
+{
+    return pipelineCacheWarm;
+}
 
-        // Transform updates every frame
-        for(uint32_t i = 0; i < BACKBUFFER_COUNT; ++i)
-        {
-            vk::DescriptorBufferInfo roundRobinBufferInfo = {
-                .buffer = bufferManager->GetRoundRobinBuffer(),
-                .offset = bufferManager->GetRoundRobinChunkSize() * i,
-                .range = bufferManager->GetRoundRobinChunkSize(),
-            };
-            vk::WriteDescriptorSet transformWriteDescriptor = {
-                .dstSet = *transformDescriptorSets[i],
-                .dstBinding = 0,
-                .dstArrayElement = 0,
-                .descriptorCount = 1,
-                .descriptorType = vk::DescriptorType::eStorageBuffer,
-                .pImageInfo = nullptr,
-                .pBufferInfo = &roundRobinBufferInfo,
-                .pTexelBufferView = nullptr,
-            };
-            device->updateDescriptorSets(1, &transformWriteDescriptor, 0, nullptr);
-        }
+double RendererVulkan::GetPipelineCreationTime() const
+{
+    return pipelineCreationTime;
+}
 
-        auto viewProjectionBuffer = bufferManager->GetBuffer(cameraBufferIndex);
-        vk::DescriptorBufferInfo viewProjectionBufferInfo = {
-            .buffer = bufferManager->GetBackingBuffer(cameraBufferIndex),
-            .offset = viewProjectionBuffer.backingBufferOffset,
-            .range = viewProjectionBuffer.sizeWithoutPadding,
-        };
-        vk::WriteDescriptorSet viewProjectionWriteDescriptor = {
-            .dstSet = *viewProjectionDescriptorSet,
-            .dstBinding = 0,
-            .dstArrayElement = 0,
-            .descriptorCount = 1,
-            .descriptorType = vk::DescriptorType::eUniformBuffer,
-            .pImageInfo = nullptr,
-            .pBufferInfo = &viewProjectionBufferInfo,
-            .pTexelBufferView = nullptr,
-        };
-        device->updateDescriptorSets(1, &viewProjectionWriteDescriptor, 0, nullptr);
-
-        const CameraVulkan& camera = *this->cameraOpt;
-        const auto& buffer = bufferManager->GetBuffer(camera.GetCameraPositionBufferIndex());
-        vk::DescriptorBufferInfo bufferInfo = {
-            .buffer = bufferManager->GetBackingBuffer(camera.GetCameraPositionBufferIndex()),
-            .offset = buffer.backingBufferOffset,
-            .range = buffer.sizeWithoutPadding,
-        };
-        vk::WriteDescriptorSet bufferDescriptor = {
-            .dstSet = *cameraPositionDescriptorSet,
-            .dstBinding = 0,
-            .dstArrayElement = 0,
-            .descriptorCount = 1,
-            .descriptorType = vk::DescriptorType::eUniformBuffer,
-            .pImageInfo = nullptr,
-            .pBufferInfo = &bufferInfo,
-            .pTexelBufferView = nullptr,
-        };
-        device->updateDescriptorSets(1, &bufferDescriptor, 0, nullptr);
+void RendererVulkan::PreRender()
+{
+    PROFILE_ZONE("PreRender");
+    FrameContext& frame = getCurrentFrameContext();
 
-        once = true;
+    // The context was last used frames.size() frames ago
+    if(currentFrame >= frames.size())
+    {
+        PROFILE_ZONE("Wait for frame");
+        WaitForFrame(currentFrame - frames.size());
     }
-    const vk::CommandBuffer& commandBuffer = *commandBuffers[currentFrame % BACKBUFFER_COUNT];
-
-    std::array<vk::DescriptorSet, 3> descriptorSets = {
-        *vertexIndexDescriptorSet,
-        *transformDescriptorSets[currentFrame % BACKBUFFER_COUNT],
-        *viewProjectionDescriptorSet,
-    };
-    commandBuffer.bindDescriptorSets(
-        vk::PipelineBindPoint::eGraphics,
-        *pipelineLayout,
-        0,
-        (uint32_t)descriptorSets.size(),
-        descriptorSets.data(),
-        0,
-        nullptr);
+    frame.transientDescriptors.Reset();
 
-    std::vector<vk::BufferCopy> copyInfo;
-    uint32_t copyOffset = 0;
-    for(size_t i = 0; i < objectsToRender.size(); ++i)
+    if(frame.cullingStatisticsPending)
     {
-        auto transformBuffer =
-            bufferManager->GetBuffer(objectsToRender[i].GetTransformBufferIndex());
-        copyInfo.push_back(vk::BufferCopy{
-            .srcOffset = transformBuffer.backingBufferOffset,
-            .dstOffset = bufferManager->GetRoundRobinChunkSize() * (currentFrame % BACKBUFFER_COUNT)
-                         + copyOffset,
-            .size = transformBuffer.sizeWithoutPadding,
+        CullingData cullingData;
+        bufferManager->ReadCullingData(frame.cullingDataOffset, &cullingData, sizeof(cullingData));
+        cullingStatistics = {
+            .instanceCount = frame.culledInstanceCount,
+            .frustumCulledCount = cullingData.frustumCulledCount,
+            .occlusionCulledCount = cullingData.occlusionCulledCount,
+        };
+        frame.cullingStatisticsPending = false;
+    }
+
+    if(swapchain)
+    {
+        // The swapchain can't be recreated while the window has no area, so skip the frame
+        skipFrame = swapchainOutOfDate && !recreateSwapchain();
+        if(skipFrame)
+            return;
+
+        try
+        {
+            vk::Result res;
+            std::tie(res, currentSwapchainImageIndex) = device->acquireNextImageKHR(
+                *swapchain,
+                UINT64_MAX,
+                *frame.imageAvailableSemaphore,
+                VK_NULL_HANDLE);
+            // The image can still be presented, so recreate after this frame
+            if(res == vk::Result::eSuboptimalKHR)
+                swapchainOutOfDate = true;
+        }
+        catch(const vk::OutOfDateKHRError&)
+        {
+            // The semaphore is not signaled, so this frame is simply tried again next time
+            swapchainOutOfDate = true;
+            skipFrame = true;
+            return;
+        }
+    }
+    else
+    {
+        // There is one offscreen image per frame in flight, so the wait above also guarantees
+        // that this image is no longer in use
+        currentSwapchainImageIndex = (uint32_t)(currentFrame % backBufferImages.size());
+    }
+
+    recordBegin = std::chrono::steady_clock::now();
+
+    // Earlier frames in flight still read their own chunks
+    frame.viewProjection = cameraOpt->GetViewProjMatrix();
+    frame.frustumPlanes = cameraOpt->GetFrustumPlanes();
+    const glm::vec4 cameraPosition = glm::vec4(cameraOpt->GetPosition(), 1.0f);
+    bufferManager->WriteCameraData(
+        frame.cameraDataOffset,
+        &frame.viewProjection,
+        sizeof(frame.viewProjection));
+    bufferManager->WriteCameraData(
+        frame.cameraDataOffset + CAMERA_POSITION_OFFSET,
+        &cameraPosition,
+        sizeof(cameraPosition));
+
+    // The wait guarantees that no command buffer from these pools is still in use
+    device->resetCommandPool(*frame.commandPool);
+    frame.commandBuffer->begin({.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    gpuProfiler.BeginFrame(*frame.commandBuffer, currentFrame % frames.size(), currentFrame);
+    gpuProfiler.BeginRegion(*frame.commandBuffer, "Frame");
+
+    for(WorkerCommandPool& pool : frame.workerCommandPools)
+    {
+        device->resetCommandPool(*pool.commandPool);
+        pool.usedCommandBuffers = 0;
+    }
+}
+
+// Most significant first: queued draw (8 bits), mesh (24) and depth (24). The draw index keeps
+// passes in the order they were rendered, and every pass has exactly one pipeline, so the pipeline
+// needs no bits of its own. Materials are read per instance, so they need none either. The mesh
+// index is truncated, which only makes different meshes interleave; batches still compare the real
+// indices
+uint64_t makeSortKey(uint32_t drawIndex, const RenderObject& object, float depth)
+{
+    const uint64_t depthBucket = (uint64_t)(std::clamp(depth, 0.0f, 1.0f) * ((1 << 24) - 1));
+
+    return (uint64_t)drawIndex << 56
+           | (uint64_t)(object.GetMesh().GetVertexBuffer() & 0xFFFFFF) << 24
+           | depthBucket;
+}
+
+// Every texture is bound at once, so only the mesh breaks a batch
+bool canBatch(const RenderObject& first, const RenderObject& second)
+{
+    return first.GetMesh().GetVertexBuffer() == second.GetMesh().GetVertexBuffer()
+           && first.GetMesh().GetIndexBuffer() == second.GetMesh().GetIndexBuffer();
+}
+
+void RendererVulkan::Render(const std::vector<RenderObject>& objectsToRender)
+{
+    PROFILE_ZONE("Render");
+    if(skipFrame)
+        return;
+
+    assert(activeRenderPass);
+
+    // Passes that draw the same objects, e.g. a depth prepass and a shading pass, share one copy
+    // of the transforms
+    auto sameObjects = std::find_if(entire_collection(queuedDraws), [&](const QueuedDraw& draw) {
+        return draw.objects == &objectsToRender && draw.uploadsTransforms;
+    });
+    bool uploadsTransforms = sameObjects == queuedDraws.end();
+    uint32_t firstTransform = queuedTransformCount;
+    if(uploadsTransforms)
+    {
+        validateObjectList(objectsToRender);
+        queuedTransformCount += (uint32_t)objectsToRender.size();
+    }
+    else
+        firstTransform = sameObjects->firstTransform;
+
+    assert(queuedTransformCount * sizeof(glm::mat4) <= bufferManager->GetRoundRobinChunkSize());
+    // The draw index has 8 bits in the sort key
+    assert(queuedDraws.size() < 256);
+    const DrawParameters& parameters = activeRenderPass->GetDrawParameters();
+    GpuDrawParameters drawParameters = {
+        .materialOverride = 0,
+        .flags = parameters.flags,
+    };
+    if(parameters.flags & DRAW_FLAG_MATERIAL_OVERRIDE)
+        drawParameters.materialOverride = getMaterialId(parameters.materialOverride);
+
+    queuedDraws.push_back({
+        .renderPass = activeRenderPass,
+        .objects = &objectsToRender,
+        .firstTransform = firstTransform,
+        .uploadsTransforms = uploadsTransforms,
+        .firstCommand = 0, // Assigned by recordIndirectDraws
+        .visibleCount = (uint32_t)objectsToRender.size(), // Reduced by recordSortedDraws
+        .drawParameters = drawParameters,
+    });
+}
+
+float RendererVulkan::getMeshRadius(ResourceIndex vertexBuffer)
+{
+    auto iter = meshRadii.find(vertexBuffer);
+    if(iter != meshRadii.end())
+        return iter->second;
+
+    // Every vertex starts with its position, see Standard.vert
+    const Buffer& buffer = bufferManager->GetBuffer(vertexBuffer);
+    assert(buffer.elementSize >= 3 * sizeof(float));
+    const char* vertices = (const char*)bufferManager->GetBufferData(vertexBuffer);
+    float radiusSquared = 0.0f;
+    for(uint32_t i = 0; i < buffer.elementCount; ++i)
+    {
+        glm::vec3 position;
+        std::memcpy(&position, vertices + i * buffer.elementSize, sizeof(position));
+        radiusSquared = std::max(radiusSquared, glm::dot(position, position));
+    }
+
+    return meshRadii.emplace(vertexBuffer, std::sqrt(radiusSquared)).first->second;
+}
+
+const SphereBounds& RendererVulkan::getCullingBounds(const std::vector<RenderObject>& objects)
+{
+    // Bounds of lists that changed were dropped by validateObjectList
+    auto iter = cullingBounds.find(&objects);
+    if(iter != cullingBounds.end())
+        return iter->second;
+
+    SphereBounds bounds;
+    bounds.centerX.resize(objects.size());
+    bounds.centerY.resize(objects.size());
+    bounds.centerZ.resize(objects.size());
+    bounds.radius.resize(objects.size());
+    for(size_t i = 0; i < objects.size(); ++i)
+    {
+        // Transforms are row major, so the translation is the last column and every other column
+        // is a scaled axis
+        const float* transform =
+            (const float*)bufferManager->GetBufferData(objects[i].GetTransformBufferIndex());
+        float scale = std::max({
+            glm::length(glm::vec3(transform[0], transform[4], transform[8])),
+            glm::length(glm::vec3(transform[1], transform[5], transform[9])),
+            glm::length(glm::vec3(transform[2], transform[6], transform[10])),
         });
 
-        copyOffset += transformBuffer.sizeWithPadding;
+        bounds.centerX[i] = transform[3];
+        bounds.centerY[i] = transform[7];
+        bounds.centerZ[i] = transform[11];
+        bounds.radius[i] = getMeshRadius(objects[i].GetMesh().GetVertexBuffer()) * scale;
+    }
 
-        commandBuffer.copyBuffer(
-            bufferManager->GetBackingBuffer(objectsToRender[i].GetTransformBufferIndex()),
-            bufferManager->GetRoundRobinBuffer(),
-            copyInfo);
-        commandBuffer.pipelineBarrier(
-            vk::PipelineStageFlagBits::eTransfer,
-            vk::PipelineStageFlagBits::eVertexInput,
-            vk::DependencyFlagBits::eByRegion,
-            0,
-            nullptr,
-            0,
-            nullptr,
-            0,
-            nullptr);
+    return cullingBounds.insert_or_assign(&objects, std::move(bounds)).first->second;
+}
+
+// Orders objects by mesh so that every mesh is one batch
+auto meshKey(const RenderObject& object)
+{
+    return std::make_tuple(object.GetMesh().GetVertexBuffer(), object.GetMesh().GetIndexBuffer());
+}
+
+void RendererVulkan::MarkObjectListChanged(const std::vector<RenderObject>& objects)
+{
+    changedObjectLists.insert(&objects);
+}
+
+void RendererVulkan::validateObjectList(const std::vector<RenderObject>& objects)
+{
+    if(changedObjectLists.erase(&objects) == 0)
+        return;
+
+    cullingBounds.erase(&objects);
+    objectMaterials.erase(&objects);
+    auto table = instanceTables.find(&objects);
+    if(table != instanceTables.end())
+    {
+        if(table->second.objectCount > 0)
+            retiredInstanceTables.push_back(table->second);
+        instanceTables.erase(table);
     }
+}
+
+uint32_t RendererVulkan::getMaterialId(const SurfaceProperty& surfaceProperty)
+{
+    const uint64_t key = (uint64_t)surfaceProperty.GetDiffuseTexture() << 32
+                         | surfaceProperty.GetSpecularTexture();
+    auto iter = materialIds.find(key);
+    if(iter != materialIds.end())
+        return iter->second;
+
+    // Earlier entries are never touched, so frames in flight are unaffected
+    const uint32_t materialId = (uint32_t)materialIds.size();
+    assert(materialId < MAX_MATERIALS);
+    GpuMaterial material = {
+        .diffuseTexture = (uint32_t)surfaceProperty.GetDiffuseTexture(),
+        .specularTexture = (uint32_t)surfaceProperty.GetSpecularTexture(),
+    };
+    bufferManager->WriteMaterialTable(
+        materialId * (uint32_t)sizeof(GpuMaterial),
+        &material,
+        (uint32_t)sizeof(GpuMaterial));
+
+    materialIds.emplace(key, materialId);
+    return materialId;
+}
+
+const std::vector<uint32_t>& RendererVulkan::getObjectMaterials(
+    const std::vector<RenderObject>& objects)
+{
+    auto iter = objectMaterials.find(&objects);
+    if(iter != objectMaterials.end())
+        return iter->second;
+
+    std::vector<uint32_t> materials(objects.size());
+    for(size_t i = 0; i < objects.size(); ++i)
+        materials[i] = getMaterialId(objects[i].GetSurfaceProperty());
+
+    return objectMaterials.insert_or_assign(&objects, std::move(materials)).first->second;
+}
+
+const InstanceTable& RendererVulkan::getInstanceTable(const std::vector<RenderObject>& objects)
+{
+    // Tables of lists that changed were dropped by validateObjectList
+    auto iter = instanceTables.find(&objects);
+    if(iter != instanceTables.end())
+    {
+        iter->second.lastUsedFrame = currentFrame;
+        return iter->second;
+    }
+
+    std::vector<uint32_t> order(objects.size());
+    std::iota(entire_collection(order), 0u);
+    std::sort(entire_collection(order), [&](uint32_t first, uint32_t second) {
+        return meshKey(objects[first]) < meshKey(objects[second]);
+    });
+
+    InstanceTable table = {
+        .objectCount = objects.size(),
+        .instanceBuffer = 0,
+        .batchBuffer = 0,
+        .batchCount = 0,
+        .lastUsedFrame = currentFrame,
+    };
+    std::vector<GpuInstance> instances(objects.size());
+    std::vector<GpuBatch> batches;
+    for(uint32_t i = 0; i < (uint32_t)order.size(); ++i)
+    {
+        const RenderObject& object = objects[order[i]];
+        if(i == 0 || !canBatch(objects[order[i - 1]], object))
+        {
+            // Both offsets are in elements, see recordDrawChunk
+            const Mesh& mesh = object.GetMesh();
+            const Buffer& vertexBuffer = bufferManager->GetBuffer(mesh.GetVertexBuffer());
+            const Buffer& indexBuffer = bufferManager->GetBuffer(mesh.GetIndexBuffer());
+            assert(vertexBuffer.backingBufferType == BackingBufferType::GEOMETRY);
+            assert(indexBuffer.backingBufferType == BackingBufferType::GEOMETRY);
+            assert(indexBuffer.elementSize == sizeof(uint32_t));
+            batches.push_back({
+                .indexCount = indexBuffer.elementCount,
+                .firstIndex = indexBuffer.backingBufferOffset / indexBuffer.elementSize,
+                .vertexOffset =
+                    (int32_t)(vertexBuffer.backingBufferOffset / vertexBuffer.elementSize),
+                .firstInstance = i,
+            });
+        }
+
+        const Buffer& transformBuffer = bufferManager->GetBuffer(object.GetTransformBufferIndex());
+        assert(transformBuffer.backingBufferType == BackingBufferType::DYNAMIC);
+        instances[order[i]] = {
+            .transformIndex = transformBuffer.backingBufferOffset / (uint32_t)sizeof(glm::mat4),
+            .batchIndex = (uint32_t)batches.size() - 1,
+            .boundingRadius = getMeshRadius(object.GetMesh().GetVertexBuffer()),
+            .materialId = getMaterialId(object.GetSurfaceProperty()),
+        };
+    }
+    table.batchCount = (uint32_t)batches.size();
+
+    // Retired tables go back to the write-once buffer once no frame in flight reads them anymore,
+    // so that the new table can use their memory. Tables still in use are left for a later call
+    std::erase_if(retiredInstanceTables, [&](const InstanceTable& retired) {
+        if(!IsFrameComplete(retired.lastUsedFrame))
+            return false;
+
+        bufferManager->RemoveBuffer(retired.instanceBuffer);
+        bufferManager->RemoveBuffer(retired.batchBuffer);
+        return true;
+    });
+
+    if(!objects.empty())
+    {
+        table.instanceBuffer = bufferManager->AddBuffer(
+            instances.data(),
+            sizeof(GpuInstance),
+            (uint32_t)instances.size(),
+            PerFrameWritePattern::NEVER,
+            PerFrameWritePattern::NEVER,
+            BufferBinding::STRUCTURED_BUFFER);
+        table.batchBuffer = bufferManager->AddBuffer(
+            batches.data(),
+            sizeof(GpuBatch),
+            (uint32_t)batches.size(),
+            PerFrameWritePattern::NEVER,
+            PerFrameWritePattern::NEVER,
+            BufferBinding::STRUCTURED_BUFFER);
+    }
+
+    return instanceTables.insert_or_assign(&objects, std::move(table)).first->second;
+}
+
+void RendererVulkan::recordQueuedDraws()
+{
+    FrameContext& frame = getCurrentFrameContext();
+
+    // The frame's chunks are idle once PreRender waited for the frame that last used them. The
+    // depth buffer is shared by every frame, so it keeps its state
+    graphResources.transforms = renderGraph.ImportBuffer(
+        "Transforms",
+        bufferManager->GetRoundRobinBuffer(),
+        frame.transformBufferOffset,
+        bufferManager->GetRoundRobinChunkSize());
+    graphResources.instanceMaterials = renderGraph.ImportBuffer(
+        "Instance materials",
+        bufferManager->GetInstanceMaterialBuffer(),
+        frame.instanceMaterialOffset,
+        bufferManager->GetInstanceMaterialChunkSize());
+    graphResources.depthBuffer = renderGraph.ImportImage(
+        "Depth buffer",
+        *depthBuffer,
+        {
+            .aspectMask = vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+        &depthBufferState);
+
+    if(gpuDrivenRendering)
+        recordIndirectDraws();
+    else
+        recordSortedDraws();
 
     std::array<vk::ClearValue, 2> clearValues = {};
     clearValues[0].color = vk::ClearColorValue{std::array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f}};
@@ -1147,76 +2444,885 @@ void RendererVulkan::Render(const std::vector<RenderObject>& objectsToRender)
         .renderArea =
             {
                 .offset = {0, 0},
-                .extent = {1280, 720} // TODO
+                .extent = renderExtent,
             },
         .clearValueCount = (uint32_t)clearValues.size(),
         .pClearValues = clearValues.data(),
     };
-    commandBuffer.beginRenderPass(info, vk::SubpassContents::eInline);
-    uint32_t startIndex = 0;
-    for(uint32_t endIndex = 1; endIndex < objectsToRender.size(); endIndex++)
+    // The render pass transitions the back buffer itself, so it isn't part of the graph
+    RenderGraph::PassBuilder renderPassBuilder =
+        renderGraph.AddPass("Render pass", [&](vk::CommandBuffer commandBuffer) {
+            // Covers the depth prepass and shading, which are all recorded into secondary command
+            // buffers
+            gpuProfiler.BeginPipelineStatistics(commandBuffer);
+            commandBuffer.beginRenderPass(info, vk::SubpassContents::eSecondaryCommandBuffers);
+            if(!chunkCommandBuffers.empty())
+                commandBuffer.executeCommands(chunkCommandBuffers);
+            commandBuffer.endRenderPass();
+            gpuProfiler.EndPipelineStatistics(commandBuffer);
+        });
+    renderPassBuilder
+        .Read(
+            graphResources.transforms,
+            vk::PipelineStageFlagBits2::eVertexShader,
+            vk::AccessFlagBits2::eShaderStorageRead)
+        .Read(
+            graphResources.instanceMaterials,
+            vk::PipelineStageFlagBits2::eVertexShader,
+            vk::AccessFlagBits2::eShaderStorageRead)
+        .Write(
+            graphResources.depthBuffer,
+            vk::PipelineStageFlagBits2::eEarlyFragmentTests
+                | vk::PipelineStageFlagBits2::eLateFragmentTests,
+            vk::AccessFlagBits2::eDepthStencilAttachmentRead
+                | vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+            vk::ImageLayout::eDepthStencilAttachmentOptimal)
+        .SideEffects();
+    if(gpuDrivenRendering)
     {
-        if(objectsToRender[endIndex].GetSurfaceProperty().GetDiffuseTexture()
-               != objectsToRender[startIndex].GetSurfaceProperty().GetDiffuseTexture()
-           || endIndex + 1 == objectsToRender.size())
+        renderPassBuilder.Read(
+            graphResources.indirectCommands,
+            vk::PipelineStageFlagBits2::eDrawIndirect,
+            vk::AccessFlagBits2::eIndirectCommandRead);
+    }
+    // Read by the next frame's depth pyramid
+    renderGraph.Export(graphResources.depthBuffer);
+
+    renderGraph.Compile(currentFrame);
+    if(gpuDrivenRendering)
+        writeDepthPyramidDescriptors();
+    renderGraph.Execute(*frame.commandBuffer, gpuProfiler);
+    depthBufferHasContent = true;
+
+    queuedDraws.clear();
+    queuedTransformCount = 0;
+}
+
+void RendererVulkan::recordSortedDraws()
+{
+    FrameContext& frame = getCurrentFrameContext();
+    const CameraVulkan& camera = *cameraOpt;
+
+    // Cull every object list once. Survivors are packed, so transforms are renumbered to only
+    // sort and upload visible objects. Draws that share objects also share the survivors
+    const std::array<glm::vec4, 6>& frustumPlanes = frame.frustumPlanes;
+    visibleObjects.resize(queuedTransformCount);
+    uint32_t visibleTransformCount = 0;
+    for(QueuedDraw& draw : queuedDraws)
+    {
+        if(!draw.uploadsTransforms)
         {
-            const RenderObject& renderObject = objectsToRender[startIndex];
-
-            auto descriptorSets = std::to_array<vk::DescriptorSet>({
-                // samplerManager->GetDescriptorSet(renderObject.GetSurfaceProperty().GetSampler()),
-                samplerManager->GetDescriptorSet(0), // TODO
-                textureManager->GetDescriptorSet(
-                    renderObject.GetSurfaceProperty().GetDiffuseTexture()),
-                textureManager->GetDescriptorSet(
-                    renderObject.GetSurfaceProperty().GetSpecularTexture()),
+            auto sameObjects = std::find_if(entire_collection(queuedDraws), [&](const auto& other) {
+                return other.objects == draw.objects && other.uploadsTransforms;
             });
-            commandBuffer.bindDescriptorSets(
-                vk::PipelineBindPoint::eGraphics,
-                *pipelineLayout,
-                3,
-                (uint32_t)descriptorSets.size(),
-                descriptorSets.data(),
-                0,
-                nullptr);
+            draw.firstTransform = sameObjects->firstTransform;
+            draw.visibleCount = sameObjects->visibleCount;
+            continue;
+        }
+
+        uint32_t* visible = visibleObjects.data() + visibleTransformCount;
+        if(frustumCulling)
+        {
+            draw.visibleCount =
+                frustumCull(*workerPool, getCullingBounds(*draw.objects), frustumPlanes, visible);
+        }
+        else
+        {
+            draw.visibleCount = (uint32_t)draw.objects->size();
+            std::iota(visible, visible + draw.visibleCount, 0u);
+        }
+        draw.firstTransform = visibleTransformCount;
+        visibleTransformCount += draw.visibleCount;
+    }
+    queuedTransformCount = visibleTransformCount;
 
-            commandBuffer.draw(
-                bufferManager->GetElementCount(renderObject.GetMesh().GetIndexBuffer()),
-                endIndex - startIndex,
+    // Split every draw into contiguous chunks that are recorded in parallel into secondary
+    // command buffers. Small draws are not split since waking workers costs more than it saves
+    constexpr uint32_t MIN_OBJECTS_PER_CHUNK = 1024;
+    drawChunks.clear();
+    for(uint32_t drawIndex = 0; drawIndex < queuedDraws.size(); ++drawIndex)
+    {
+        const uint32_t objectCount = queuedDraws[drawIndex].visibleCount;
+        const uint32_t chunkCount = std::min(
+            workerPool->GetWorkerCount(),
+            (objectCount + MIN_OBJECTS_PER_CHUNK - 1) / MIN_OBJECTS_PER_CHUNK);
+        const uint32_t objectsPerChunk =
+            chunkCount == 0 ? 0 : (objectCount + chunkCount - 1) / chunkCount;
+
+        for(uint32_t chunkIndex = 0; chunkIndex < chunkCount; ++chunkIndex)
+        {
+            const uint32_t firstObject = chunkIndex * objectsPerChunk;
+            drawChunks.push_back({
+                .drawIndex = drawIndex,
+                .firstObject = firstObject,
+                .endObject = std::min(firstObject + objectsPerChunk, objectCount),
+            });
+        }
+    }
+
+    // Sort every object list so that objects sharing a mesh end up next to each other, closest
+    // first. Draws that share objects also share the sorted order
+    const glm::vec3 cameraPosition = camera.GetPosition();
+    const glm::vec3 cameraForward = camera.GetForward();
+    const float maxDepth = camera.GetMaxDepth();
+    sortItems.resize(queuedTransformCount);
+    workerPool->Run((uint32_t)drawChunks.size(), [&](uint32_t chunkIndex, uint32_t workerIndex) {
+        const DrawChunk& chunk = drawChunks[chunkIndex];
+        const QueuedDraw& draw = queuedDraws[chunk.drawIndex];
+        if(!draw.uploadsTransforms)
+            return;
+
+        for(uint32_t i = chunk.firstObject; i < chunk.endObject; ++i)
+        {
+            const uint32_t objectIndex = visibleObjects[draw.firstTransform + i];
+            const RenderObject& object = (*draw.objects)[objectIndex];
+            // Transforms are row major, so the translation is the last column
+            const float* transform =
+                (const float*)bufferManager->GetBufferData(object.GetTransformBufferIndex());
+            glm::vec3 position = {transform[3], transform[7], transform[11]};
+            float depth = glm::dot(position - cameraPosition, cameraForward) / maxDepth;
+
+            sortItems[draw.firstTransform + i] = {
+                .key = makeSortKey(chunk.drawIndex, object, depth),
+                .value = objectIndex,
+            };
+        }
+    });
+    radixSort(*workerPool, sortItems, sortScratch);
+
+    const uint32_t chunkOffset = frame.transformBufferOffset;
+
+    // Material IDs are written next to the transforms, in the same sorted order. The table only
+    // grows on this thread
+    std::vector<const std::vector<uint32_t>*> drawMaterials(queuedDraws.size());
+    for(uint32_t drawIndex = 0; drawIndex < queuedDraws.size(); ++drawIndex)
+    {
+        if(queuedDraws[drawIndex].uploadsTransforms)
+            drawMaterials[drawIndex] = &getObjectMaterials(*queuedDraws[drawIndex].objects);
+    }
+    uint32_t* instanceMaterials = nullptr;
+    if(queuedTransformCount > 0)
+    {
+        instanceMaterials =
+            bufferManager->MapInstanceMaterials(frame.instanceMaterialOffset, queuedTransformCount);
+    }
+
+    chunkTransformCopies.resize(drawChunks.size());
+    chunkCommandBuffers.resize(drawChunks.size());
+    depthPrepassCommandBuffers.resize(drawChunks.size());
+    workerPool->Run((uint32_t)drawChunks.size(), [&](uint32_t chunkIndex, uint32_t workerIndex) {
+        const DrawChunk& chunk = drawChunks[chunkIndex];
+        const QueuedDraw& draw = queuedDraws[chunk.drawIndex];
+
+        // Transforms are uploaded in sorted order so that every batch can be drawn instanced
+        std::vector<vk::BufferCopy>& copies = chunkTransformCopies[chunkIndex];
+        copies.clear();
+        if(draw.uploadsTransforms)
+        {
+            const std::vector<uint32_t>& materials = *drawMaterials[chunk.drawIndex];
+            for(uint32_t i = chunk.firstObject; i < chunk.endObject; ++i)
+            {
+                const uint32_t objectIndex = sortItems[draw.firstTransform + i].value;
+                instanceMaterials[draw.firstTransform + i] = materials[objectIndex];
+
+                const RenderObject& object = (*draw.objects)[objectIndex];
+                const Buffer& transformBuffer =
+                    bufferManager->GetBuffer(object.GetTransformBufferIndex());
+                appendTransformCopy(
+                    copies,
+                    transformBuffer,
+                    chunkOffset + (draw.firstTransform + i) * (uint32_t)sizeof(glm::mat4));
+            }
+        }
+
+        vk::CommandBuffer chunkCommandBuffer = beginChunkCommandBuffer(workerIndex);
+        recordDrawChunk(chunkCommandBuffer, draw, chunk.firstObject, chunk.endObject, false);
+        chunkCommandBuffer.end();
+        chunkCommandBuffers[chunkIndex] = chunkCommandBuffer;
+
+        depthPrepassCommandBuffers[chunkIndex] = VK_NULL_HANDLE;
+        if(usesDepthPrepass(draw))
+        {
+            vk::CommandBuffer prepassCommandBuffer = beginChunkCommandBuffer(workerIndex);
+            recordDrawChunk(prepassCommandBuffer, draw, chunk.firstObject, chunk.endObject, true);
+            prepassCommandBuffer.end();
+            depthPrepassCommandBuffers[chunkIndex] = prepassCommandBuffer;
+        }
+    });
+
+    if(instanceMaterials)
+        bufferManager->UnmapInstanceMaterials();
+
+    // Depth has to be complete before the first chunk is shaded
+    std::erase(depthPrepassCommandBuffers, vk::CommandBuffer());
+    chunkCommandBuffers.insert(
+        chunkCommandBuffers.begin(),
+        entire_collection(depthPrepassCommandBuffers));
+
+    // Gather every transform into one copy with one barrier
+    transformCopies.clear();
+    for(const auto& copies : chunkTransformCopies)
+        transformCopies.insert(transformCopies.end(), entire_collection(copies));
+
+    // All transforms live in the dynamic backing buffer, which only the host writes. The render
+    // pass reads them as a storage buffer
+    if(!transformCopies.empty())
+    {
+        renderGraph
+            .AddPass(
+                "Transform upload",
+                [this](vk::CommandBuffer commandBuffer) {
+                    commandBuffer.copyBuffer(
+                        bufferManager->GetDynamicBackingBuffer(),
+                        bufferManager->GetRoundRobinBuffer(),
+                        transformCopies);
+                })
+            .Write(
+                graphResources.transforms,
+                vk::PipelineStageFlagBits2::eCopy,
+                vk::AccessFlagBits2::eTransferWrite);
+    }
+}
+
+vk::ImageCreateInfo getDepthPyramidInfo(vk::Extent2D extent, uint32_t levelCount)
+{
+    return {
+        .imageType = vk::ImageType::e2D,
+        .format = vk::Format::eR32Sfloat,
+        .extent =
+            {
+                .width = extent.width,
+                .height = extent.height,
+                .depth = 1,
+            },
+        .mipLevels = levelCount,
+        .arrayLayers = 1,
+        .samples = vk::SampleCountFlagBits::e1,
+        .tiling = vk::ImageTiling::eOptimal,
+        .usage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled,
+        .sharingMode = vk::SharingMode::eExclusive,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = nullptr,
+        .initialLayout = vk::ImageLayout::eUndefined,
+    };
+}
+
+void RendererVulkan::writeDepthPyramidDescriptors()
+{
+    FrameContext& frame = getCurrentFrameContext();
+    depthPyramid.levelDescriptorSets.clear();
+    for(uint32_t level = 0; depthPyramid.built && level < depthPyramid.levelCount; ++level)
+    {
+        depthPyramid.levelDescriptorSets.push_back(
+            frame.transientDescriptors.Allocate(*descriptorSetLayouts.depthPyramid));
+
+        // Level 0 has no level above it, BuildDepthPyramid.comp doesn't read the source then
+        const uint32_t sourceLevel = level == 0 ? 0 : level - 1;
+        std::array<vk::DescriptorImageInfo, 3> imageInfos = {
+            vk::DescriptorImageInfo{
+                .sampler = *depthPyramidSampler,
+                .imageView = *depthBufferView,
+                .imageLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal,
+            },
+            vk::DescriptorImageInfo{
+                .sampler = VK_NULL_HANDLE,
+                .imageView = renderGraph.GetImageView(depthPyramid.image, sourceLevel, 1),
+                .imageLayout = vk::ImageLayout::eGeneral,
+            },
+            vk::DescriptorImageInfo{
+                .sampler = VK_NULL_HANDLE,
+                .imageView = renderGraph.GetImageView(depthPyramid.image, level, 1),
+                .imageLayout = vk::ImageLayout::eGeneral,
+            },
+        };
+        std::array<vk::WriteDescriptorSet, 2> writeDescriptors = {
+            vk::WriteDescriptorSet{
+                .dstSet = depthPyramid.levelDescriptorSets[level],
+                .dstBinding = 0,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+                .pImageInfo = &imageInfos[0],
+                .pBufferInfo = nullptr,
+                .pTexelBufferView = nullptr,
+            },
+            vk::WriteDescriptorSet{
+                .dstSet = depthPyramid.levelDescriptorSets[level],
+                .dstBinding = 1,
+                .dstArrayElement = 0,
+                .descriptorCount = 2,
+                .descriptorType = vk::DescriptorType::eStorageImage,
+                .pImageInfo = &imageInfos[1],
+                .pBufferInfo = nullptr,
+                .pTexelBufferView = nullptr,
+            },
+        };
+        device->updateDescriptorSets(writeDescriptors, {});
+    }
+
+    // The set isn't bound yet, since nothing is recorded before the graph is executed
+    vk::DescriptorImageInfo pyramidInfo = {
+        .sampler = *depthPyramidSampler,
+        .imageView = renderGraph.GetImageView(depthPyramid.image),
+        .imageLayout = vk::ImageLayout::eGeneral,
+    };
+    vk::WriteDescriptorSet pyramidWriteDescriptor = {
+        .dstSet = frame.drawGenerationDescriptorSet,
+        .dstBinding = 5,
+        .dstArrayElement = 0,
+        .descriptorCount = 1,
+        .descriptorType = vk::DescriptorType::eCombinedImageSampler,
+        .pImageInfo = &pyramidInfo,
+        .pBufferInfo = nullptr,
+        .pTexelBufferView = nullptr,
+    };
+    device->updateDescriptorSets(1, &pyramidWriteDescriptor, 0, nullptr);
+}
+
+void RendererVulkan::recordDepthPyramid(vk::CommandBuffer commandBuffer)
+{
+    // The render graph has already made the previous frame's depth readable and will give the
+    // depth buffer back to the render pass
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, *depthPyramidPipeline);
+    for(uint32_t level = 0; level < depthPyramid.levelCount; ++level)
+    {
+        commandBuffer.bindDescriptorSets(
+            vk::PipelineBindPoint::eCompute,
+            *depthPyramidPipelineLayout,
+            0,
+            depthPyramid.levelDescriptorSets[level],
+            {});
+        DepthPyramidParameters parameters = {.fromDepthBuffer = level == 0};
+        commandBuffer.pushConstants(
+            *depthPyramidPipelineLayout,
+            vk::ShaderStageFlagBits::eCompute,
+            0,
+            sizeof(parameters),
+            &parameters);
+
+        // Matches local_size_x and local_size_y in BuildDepthPyramid.comp
+        constexpr uint32_t GROUP_SIZE = 8;
+        const uint32_t width = std::max(1u, depthPyramid.extent.width >> level);
+        const uint32_t height = std::max(1u, depthPyramid.extent.height >> level);
+        commandBuffer.dispatch(
+            (width + GROUP_SIZE - 1) / GROUP_SIZE,
+            (height + GROUP_SIZE - 1) / GROUP_SIZE,
+            1);
+
+        // Read by the next level. The graph orders the last one with GenerateDraws.comp, which
+        // reads every level
+        if(level + 1 == depthPyramid.levelCount)
+            break;
+        vk::ImageMemoryBarrier2 levelBarrier = {
+            .srcStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+            .srcAccessMask = vk::AccessFlagBits2::eShaderStorageWrite,
+            .dstStageMask = vk::PipelineStageFlagBits2::eComputeShader,
+            .dstAccessMask = vk::AccessFlagBits2::eShaderStorageRead,
+            .oldLayout = vk::ImageLayout::eGeneral,
+            .newLayout = vk::ImageLayout::eGeneral,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = renderGraph.GetImage(depthPyramid.image),
+            .subresourceRange =
+                {
+                    .aspectMask = vk::ImageAspectFlagBits::eColor,
+                    .baseMipLevel = level,
+                    .levelCount = 1,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+                },
+        };
+        commandBuffer.pipelineBarrier2({
+            .dependencyFlags = vk::DependencyFlags(),
+            .memoryBarrierCount = 0,
+            .pMemoryBarriers = nullptr,
+            .bufferMemoryBarrierCount = 0,
+            .pBufferMemoryBarriers = nullptr,
+            .imageMemoryBarrierCount = 1,
+            .pImageMemoryBarriers = &levelBarrier,
+        });
+    }
+}
+
+void RendererVulkan::recordIndirectDraws()
+{
+    FrameContext& frame = getCurrentFrameContext();
+
+    // Every object list gets one command per batch. Draws that share objects also share commands,
+    // the same way they share transforms
+    uint32_t commandCount = 0;
+    for(QueuedDraw& draw : queuedDraws)
+    {
+        if(draw.uploadsTransforms)
+        {
+            draw.firstCommand = commandCount;
+            commandCount += getInstanceTable(*draw.objects).batchCount;
+            continue;
+        }
+
+        auto sameObjects = std::find_if(entire_collection(queuedDraws), [&](const auto& other) {
+            return other.objects == draw.objects && other.uploadsTransforms;
+        });
+        draw.firstCommand = sameObjects->firstCommand;
+    }
+    assert(commandCount <= MAX_INDIRECT_COMMANDS);
+
+    // Every point is inside a plane of (0, 0, 0, 1), so this disables frustum culling
+    CullingData cullingData = {
+        .viewProjection = frame.viewProjection,
+        .frustumPlanes = {},
+        .occlusionCulling = occlusionCulling && depthBufferHasContent,
+        .frustumCulledCount = 0,
+        .occlusionCulledCount = 0,
+    };
+    if(frustumCulling)
+        cullingData.frustumPlanes = frame.frustumPlanes;
+    else
+        cullingData.frustumPlanes.fill(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    static_assert(sizeof(CullingData) <= CULLING_DATA_CHUNK_SIZE);
+    bufferManager->WriteCullingData(frame.cullingDataOffset, &cullingData, sizeof(cullingData));
+
+    frame.cullingStatisticsPending = true;
+    frame.culledInstanceCount = 0;
+    for(const QueuedDraw& draw : queuedDraws)
+    {
+        if(draw.uploadsTransforms)
+            frame.culledInstanceCount += (uint32_t)draw.objects->size();
+    }
+
+    graphResources.indirectCommands = renderGraph.ImportBuffer(
+        "Indirect commands",
+        bufferManager->GetIndirectBuffer(),
+        frame.indirectBufferOffset,
+        bufferManager->GetIndirectChunkSize());
+    graphResources.cullingData = renderGraph.ImportBuffer(
+        "Culling data",
+        bufferManager->GetCullingDataBuffer(),
+        frame.cullingDataOffset,
+        bufferManager->GetCullingDataChunkSize());
+
+    // GenerateDraws.comp always samples the pyramid, so it exists even when it isn't built
+    depthPyramid.extent = renderExtent;
+    depthPyramid.levelCount = std::min(
+        (uint32_t)std::bit_width(std::max(renderExtent.width, renderExtent.height)),
+        MAX_DEPTH_PYRAMID_LEVELS);
+    depthPyramid.built = cullingData.occlusionCulling;
+    depthPyramid.image = renderGraph.CreateTransientImage(
+        "Depth pyramid",
+        getDepthPyramidInfo(depthPyramid.extent, depthPyramid.levelCount));
+    if(depthPyramid.built)
+    {
+        renderGraph
+            .AddPass(
+                "Depth pyramid",
+                [this](vk::CommandBuffer commandBuffer) { recordDepthPyramid(commandBuffer); })
+            .Read(
+                graphResources.depthBuffer,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderSampledRead,
+                vk::ImageLayout::eDepthStencilReadOnlyOptimal)
+            .Write(
+                depthPyramid.image,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::ImageLayout::eGeneral);
+    }
+
+    auto dispatchPerDraw = [this, &frame](
+                               vk::CommandBuffer commandBuffer,
+                               vk::Pipeline pipeline,
+                               bool perBatch) {
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+        commandBuffer.bindDescriptorSets(
+            vk::PipelineBindPoint::eCompute,
+            *drawGenerationPipelineLayout,
+            0,
+            frame.drawGenerationDescriptorSet,
+            {});
+
+        for(const QueuedDraw& draw : queuedDraws)
+        {
+            const InstanceTable& table = instanceTables.at(draw.objects);
+            if(!draw.uploadsTransforms || table.objectCount == 0)
+                continue;
+
+            const ResourceIndex tableBuffer = perBatch ? table.batchBuffer : table.instanceBuffer;
+            const Buffer& buffer = bufferManager->GetBuffer(tableBuffer);
+            DrawGenerationParameters parameters = {
+                .tableOffset = buffer.backingBufferOffset / buffer.elementSize,
+                .count = perBatch ? table.batchCount : (uint32_t)table.objectCount,
+                .firstCommand = draw.firstCommand,
+                .firstTransform = draw.firstTransform,
+            };
+            commandBuffer.pushConstants(
+                *drawGenerationPipelineLayout,
+                vk::ShaderStageFlagBits::eCompute,
                 0,
-                startIndex);
+                sizeof(parameters),
+                &parameters);
+
+            // Matches local_size_x in both shaders
+            constexpr uint32_t GROUP_SIZE = 64;
+            commandBuffer.dispatch((parameters.count + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+        }
+    };
+
+    // Reset every command to zero instances, then let every instance add itself to its command.
+    // The commands are read by the indirect draws and the transforms by the vertex shader
+    renderGraph
+        .AddPass(
+            "Reset draws",
+            [this, dispatchPerDraw](vk::CommandBuffer commandBuffer) {
+                dispatchPerDraw(commandBuffer, *resetDrawsPipeline, true);
+            })
+        .Write(
+            graphResources.indirectCommands,
+            vk::PipelineStageFlagBits2::eComputeShader,
+            vk::AccessFlagBits2::eShaderStorageWrite);
+    renderGraph
+        .AddPass(
+            "Generate draws",
+            [this, dispatchPerDraw](vk::CommandBuffer commandBuffer) {
+                dispatchPerDraw(commandBuffer, *generateDrawsPipeline, false);
+            })
+        .Read(
+            depthPyramid.image,
+            vk::PipelineStageFlagBits2::eComputeShader,
+            vk::AccessFlagBits2::eShaderSampledRead,
+            vk::ImageLayout::eGeneral)
+        .Write(
+            graphResources.indirectCommands,
+            vk::PipelineStageFlagBits2::eComputeShader,
+            vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite)
+        .Write(
+            graphResources.transforms,
+            vk::PipelineStageFlagBits2::eComputeShader,
+            vk::AccessFlagBits2::eShaderStorageWrite)
+        .Write(
+            graphResources.instanceMaterials,
+            vk::PipelineStageFlagBits2::eComputeShader,
+            vk::AccessFlagBits2::eShaderStorageWrite)
+        .Write(
+            graphResources.cullingData,
+            vk::PipelineStageFlagBits2::eComputeShader,
+            vk::AccessFlagBits2::eShaderStorageRead | vk::AccessFlagBits2::eShaderStorageWrite);
+    // The statistics are read by PreRender once the frame has completed
+    renderGraph.Export(
+        graphResources.cullingData,
+        vk::PipelineStageFlagBits2::eHost,
+        vk::AccessFlagBits2::eHostRead);
+
+    // A handful of draws per material is cheap to record, so a single secondary command buffer
+    // recorded on this thread is enough. No worker is running, so borrowing a pool is safe
+    chunkCommandBuffers.clear();
+    if(queuedDraws.empty())
+        return;
+
+    vk::CommandBuffer drawCommandBuffer = beginChunkCommandBuffer(0);
+    bindFrameState(drawCommandBuffer, queuedDraws.front().renderPass->GetPipelineLayout());
+
+    constexpr uint32_t COMMAND_STRIDE = sizeof(vk::DrawIndexedIndirectCommand);
+    auto drawCommands = [&](uint32_t firstCommand, uint32_t count) {
+        const uint32_t offset = frame.indirectBufferOffset + firstCommand * COMMAND_STRIDE;
+        if(multiDrawIndirectSupported)
+        {
+            drawCommandBuffer.drawIndexedIndirect(
+                bufferManager->GetIndirectBuffer(),
+                offset,
+                count,
+                COMMAND_STRIDE);
+            return;
+        }
+
+        for(uint32_t i = 0; i < count; ++i)
+        {
+            drawCommandBuffer.drawIndexedIndirect(
+                bufferManager->GetIndirectBuffer(),
+                offset + i * COMMAND_STRIDE,
+                1,
+                COMMAND_STRIDE);
+        }
+    };
 
-            startIndex = endIndex;
+    // All pipeline layouts are compatible, so the frame state survives pipeline changes
+    vk::Pipeline boundPipeline = VK_NULL_HANDLE;
+    auto bindPipeline = [&](vk::Pipeline pipeline) {
+        if(pipeline != boundPipeline)
+        {
+            boundPipeline = pipeline;
+            drawCommandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, boundPipeline);
+        }
+    };
+    // Only the shading loop reads the pass's set
+    const GraphicsRenderPassVulkan* boundPass = nullptr;
+    auto bindPass = [&](const GraphicsRenderPassVulkan& pass) {
+        if(&pass != boundPass)
+        {
+            boundPass = &pass;
+            bindPassState(drawCommandBuffer, pass);
         }
+    };
+
+    // Materials are read per instance and the batches of a table are consecutive, so every table
+    // is a single draw in both loops
+    for(const QueuedDraw& draw : queuedDraws)
+    {
+        if(!usesDepthPrepass(draw))
+            continue;
+
+        bindPipeline(draw.renderPass->GetDepthPrepassPipeline());
+        pushDrawParameters(
+            drawCommandBuffer,
+            draw.renderPass->GetPipelineLayout(),
+            draw.drawParameters);
+        drawCommands(draw.firstCommand, instanceTables.at(draw.objects).batchCount);
     }
-    commandBuffer.endRenderPass();
+
+    for(const QueuedDraw& draw : queuedDraws)
+    {
+        bindPipeline(
+            usesDepthPrepass(draw) ? draw.renderPass->GetDepthEqualPipeline()
+                                   : draw.renderPass->GetPipeline());
+        bindPass(*draw.renderPass);
+        pushDrawParameters(
+            drawCommandBuffer,
+            draw.renderPass->GetPipelineLayout(),
+            draw.drawParameters);
+        drawCommands(draw.firstCommand, instanceTables.at(draw.objects).batchCount);
+    }
+
+    drawCommandBuffer.end();
+    chunkCommandBuffers.push_back(drawCommandBuffer);
 }
 
-void RendererVulkan::Present()
+vk::CommandBuffer RendererVulkan::beginChunkCommandBuffer(uint32_t workerIndex)
+{
+    WorkerCommandPool& pool = getCurrentFrameContext().workerCommandPools[workerIndex];
+    if(pool.usedCommandBuffers == pool.commandBuffers.size())
+    {
+        auto newCommandBuffers = device->allocateCommandBuffersUnique({
+            .commandPool = *pool.commandPool,
+            .level = vk::CommandBufferLevel::eSecondary,
+            .commandBufferCount = 1,
+        });
+        pool.commandBuffers.push_back(std::move(newCommandBuffers[0]));
+    }
+    vk::CommandBuffer commandBuffer = *pool.commandBuffers[pool.usedCommandBuffers++];
+
+    // Executed while the pipeline statistics of the render pass are counted
+    vk::CommandBufferInheritanceInfo inheritanceInfo = {
+        .renderPass = *renderPass,
+        .subpass = 0,
+        .framebuffer = *framebuffers[currentSwapchainImageIndex],
+        .occlusionQueryEnable = false,
+        .queryFlags = {},
+        .pipelineStatistics = gpuProfiler.GetPipelineStatisticFlags(),
+    };
+    commandBuffer.begin({
+        .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit
+                 | vk::CommandBufferUsageFlagBits::eRenderPassContinue,
+        .pInheritanceInfo = &inheritanceInfo,
+    });
+
+    return commandBuffer;
+}
+
+void RendererVulkan::bindFrameState(
+    vk::CommandBuffer commandBuffer,
+    vk::PipelineLayout pipelineLayout)
+{
+    vk::Viewport viewport = {
+        .x = 0.0f,
+        .y = 0.0f,
+        .width = (float)renderExtent.width,
+        .height = (float)renderExtent.height,
+        .minDepth = 0.0f,
+        .maxDepth = 1.0f,
+    };
+    commandBuffer.setViewport(0, viewport);
+    commandBuffer.setScissor(0, vk::Rect2D{.offset = {0, 0}, .extent = renderExtent});
+
+    // The material set holds every material, so it is bound as rarely as the frame's set
+    commandBuffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eGraphics,
+        pipelineLayout,
+        (uint32_t)BindingFrequency::PER_FRAME,
+        getCurrentFrameContext().frameDescriptorSet,
+        {});
+    commandBuffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eGraphics,
+        pipelineLayout,
+        (uint32_t)BindingFrequency::PER_MATERIAL,
+        textureManager->GetDescriptorSet(),
+        {});
+
+    commandBuffer.bindIndexBuffer(
+        bufferManager->GetGeometryBackingBuffer(),
+        0,
+        vk::IndexType::eUint32);
+}
+
+void RendererVulkan::bindPassState(
+    vk::CommandBuffer commandBuffer,
+    const GraphicsRenderPassVulkan& renderPass)
 {
-    commandBuffers[currentFrame % BACKBUFFER_COUNT]->end();
+    assert(renderPass.GetGlobalSampler() != ResourceIndex(-1));
+    commandBuffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eGraphics,
+        renderPass.GetPipelineLayout(),
+        (uint32_t)BindingFrequency::PER_PASS,
+        samplerManager->GetDescriptorSet(renderPass.GetGlobalSampler()),
+        {});
+}
+
+bool RendererVulkan::usesDepthPrepass(const QueuedDraw& draw) const
+{
+    return depthPrepass && draw.renderPass->HasDepthPrepass();
+}
+
+void RendererVulkan::recordDrawChunk(
+    vk::CommandBuffer commandBuffer,
+    const QueuedDraw& draw,
+    uint32_t firstObject,
+    uint32_t endObject,
+    bool depthOnly)
+{
+    const std::vector<RenderObject>& objectsToRender = *draw.objects;
+    // All pipelines share the same descriptor set layouts, so nothing but the pipeline itself
+    // differs between passes
+    vk::PipelineLayout pipelineLayout = draw.renderPass->GetPipelineLayout();
+
+    vk::Pipeline pipeline = draw.renderPass->GetPipeline();
+    if(depthOnly)
+        pipeline = draw.renderPass->GetDepthPrepassPipeline();
+    else if(usesDepthPrepass(draw))
+        pipeline = draw.renderPass->GetDepthEqualPipeline();
+
+    // Secondary command buffers don't inherit any state from the primary command buffer
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+    bindFrameState(commandBuffer, pipelineLayout);
+    bindPassState(commandBuffer, *draw.renderPass);
+    pushDrawParameters(commandBuffer, pipelineLayout, draw.drawParameters);
+
+    // Objects are sorted, so every run of objects that share a mesh is drawn with a single
+    // instanced draw. The vertex shader looks up the material of every instance
+    const SortItem* sortedObjects = sortItems.data() + draw.firstTransform;
+    uint32_t startIndex = firstObject;
+    for(uint32_t endIndex = firstObject + 1; endIndex <= endObject; endIndex++)
+    {
+        const RenderObject& renderObject = objectsToRender[sortedObjects[startIndex].value];
+        if(endIndex < endObject)
+        {
+            const RenderObject& nextObject = objectsToRender[sortedObjects[endIndex].value];
+            if(canBatch(renderObject, nextObject))
+                continue;
+        }
+
+        // Both offsets are in elements, the geometry buffer aligns every mesh to its element size
+        const Mesh& mesh = renderObject.GetMesh();
+        const Buffer& vertexBuffer = bufferManager->GetBuffer(mesh.GetVertexBuffer());
+        const Buffer& indexBuffer = bufferManager->GetBuffer(mesh.GetIndexBuffer());
+        assert(vertexBuffer.backingBufferType == BackingBufferType::GEOMETRY);
+        assert(indexBuffer.backingBufferType == BackingBufferType::GEOMETRY);
+        assert(indexBuffer.elementSize == sizeof(uint32_t));
+        commandBuffer.drawIndexed(
+            indexBuffer.elementCount,
+            endIndex - startIndex,
+            indexBuffer.backingBufferOffset / indexBuffer.elementSize,
+            (int32_t)(vertexBuffer.backingBufferOffset / vertexBuffer.elementSize),
+            draw.firstTransform + startIndex);
+
+        startIndex = endIndex;
+    }
+}
 
-    vk::PipelineStageFlags waitFlags = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+void RendererVulkan::Present()
+{
+    PROFILE_ZONE("Present");
+    if(skipFrame)
+        return;
+
+    FrameContext& frame = getCurrentFrameContext();
+    // Takes over every texture uploaded before this frame's draws were recorded, which includes
+    // every texture they can sample
+    const uint64_t uploadWaitValue = textureManager->AcquireUploads(*frame.commandBuffer);
+
+    recordQueuedDraws();
+
+    gpuProfiler.EndRegion(*frame.commandBuffer);
+    frame.commandBuffer->end();
+    std::chrono::duration<double, std::milli> recordTime =
+        std::chrono::steady_clock::now() - recordBegin;
+    cpuRecordTime = recordTime.count();
+
+    // Headless rendering has no swapchain to synchronize with, so only the timeline is signaled.
+    // Values for binary semaphores are ignored. Only fragment shaders sample textures, so the
+    // frame's other work overlaps with uploads that are still running
+    std::vector<vk::Semaphore> waitSemaphores;
+    std::vector<uint64_t> waitValues;
+    std::vector<vk::PipelineStageFlags> waitStages;
+    if(swapchain)
+    {
+        waitSemaphores.push_back(*frame.imageAvailableSemaphore);
+        waitValues.push_back(0);
+        waitStages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+    }
+    if(uploadWaitValue != 0)
+    {
+        waitSemaphores.push_back(textureManager->GetUploadTimeline());
+        waitValues.push_back(uploadWaitValue);
+        waitStages.push_back(vk::PipelineStageFlagBits::eFragmentShader);
+    }
+    std::vector<vk::Semaphore> signalSemaphores = {*frameTimeline};
+    std::vector<uint64_t> signalValues = {currentFrame + 1};
+    if(swapchain)
+    {
+        signalSemaphores.push_back(*frame.renderFinishedSemaphore);
+        signalValues.push_back(0);
+    }
+    vk::TimelineSemaphoreSubmitInfo timelineSubmitInfo = {
+        .waitSemaphoreValueCount = (uint32_t)waitValues.size(),
+        .pWaitSemaphoreValues = waitValues.data(),
+        .signalSemaphoreValueCount = (uint32_t)signalValues.size(),
+        .pSignalSemaphoreValues = signalValues.data(),
+    };
     vk::SubmitInfo submitInfo = {
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &*imageAvailableSemaphores[currentFrame % BACKBUFFER_COUNT],
-        .pWaitDstStageMask = &waitFlags,
+        .pNext = &timelineSubmitInfo,
+        .waitSemaphoreCount = (uint32_t)waitSemaphores.size(),
+        .pWaitSemaphores = waitSemaphores.data(),
+        .pWaitDstStageMask = waitStages.data(),
         .commandBufferCount = 1,
-        .pCommandBuffers = &*commandBuffers[currentFrame % BACKBUFFER_COUNT],
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &*renderFinishedSemaphores[currentFrame % BACKBUFFER_COUNT],
+        .pCommandBuffers = &*frame.commandBuffer,
+        .signalSemaphoreCount = (uint32_t)signalSemaphores.size(),
+        .pSignalSemaphores = signalSemaphores.data(),
     };
-    graphicsQueue.submit({submitInfo}, *queueDoneFences[currentFrame % BACKBUFFER_COUNT]);
+    graphicsQueue.submit({submitInfo});
+
+    if(!swapchain)
+    {
+        currentFrame++;
+        return;
+    }
 
     vk::PresentInfoKHR presentInfo = {
         .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &*renderFinishedSemaphores[currentFrame % BACKBUFFER_COUNT],
+        .pWaitSemaphores = &*frame.renderFinishedSemaphore,
         .swapchainCount = 1,
         .pSwapchains = &*swapchain,
         .pImageIndices = &currentSwapchainImageIndex,
         .pResults = nullptr,
     };
-    // This will _not_ return success if the window is resized
-    assert(graphicsQueue.presentKHR(presentInfo) == vk::Result::eSuccess);
+    // Resizing makes the swapchain suboptimal or out of date, either way it is recreated before
+    // the next image is acquired
+    try
+    {
+        if(graphicsQueue.presentKHR(presentInfo) == vk::Result::eSuboptimalKHR)
+            swapchainOutOfDate = true;
+    }
+    catch(const vk::OutOfDateKHRError&)
+    {
+        swapchainOutOfDate = true;
+    }
 
     currentFrame++;
 }
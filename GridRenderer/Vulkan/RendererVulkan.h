@@ -12,43 +12,285 @@
 #include <vulkan/vulkan_raii.hpp>
 
 #include <array>
+#include <chrono>
 #include <memory>
 #include <optional>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "BufferManagerVulkan.h"
 #include "CameraVulkan.h"
+#include "DescriptorAllocator.h"
+#include "FrustumCulling.h"
+#include "GpuProfiler.h"
 #include "GraphicsRenderPassVulkan.h"
+#include "RadixSort.h"
+#include "RenderGraph.h"
 #include "SamplerManagerVulkan.h"
 #include "TextureManagerVulkan.h"
+#include "WorkerPool.h"
+
+// Preferred presentation mode. Falls back to the closest supported mode, FIFO is always available
+enum class PresentMode
+{
+    FIFO, // V-synced, never tears
+    MAILBOX, // Uncapped rendering, presents the latest image at vertical blank
+    IMMEDIATE, // Uncapped rendering and presentation, may tear
+};
+
+// How often the descriptors of a graphics set change, which is also the set's index. Whatever
+// changes per draw is pushed as push constants instead, see GpuDrawParameters
+enum class BindingFrequency : uint32_t
+{
+    PER_FRAME,
+    PER_PASS,
+    PER_MATERIAL,
+    COUNT,
+};
 
 struct DescriptorSetLayouts
 {
-    vk::UniqueDescriptorSetLayout vertexIndex;
-    vk::UniqueDescriptorSetLayout transformBuffer;
-    vk::UniqueDescriptorSetLayout viewProjection;
-    vk::UniqueDescriptorSetLayout sampler;
-    vk::UniqueDescriptorSetLayout textures; // Diffuse and specular share this layout
-    vk::UniqueDescriptorSetLayout lights;
-    vk::UniqueDescriptorSetLayout cameraPosition;
+    // Graphics sets indexed by BindingFrequency, generated from the binding table in
+    // RendererVulkan.cpp
+    std::array<vk::UniqueDescriptorSetLayout, (size_t)BindingFrequency::COUNT> graphics;
+    vk::UniqueDescriptorSetLayout drawGeneration; // Compute only
+    vk::UniqueDescriptorSetLayout depthPyramid;   // Compute only
+};
+
+// Owned by a single worker thread so that it can record without synchronization
+struct WorkerCommandPool
+{
+    vk::UniqueCommandPool commandPool;
+    std::vector<vk::UniqueCommandBuffer> commandBuffers; // Secondary
+    uint32_t usedCommandBuffers;
+};
+
+// Everything that is only used by one frame in flight. Once the frame timeline reaches the frame
+// that last used a context, everything in it can be reused
+struct FrameContext
+{
+    vk::UniqueSemaphore imageAvailableSemaphore;
+    vk::UniqueSemaphore renderFinishedSemaphore;
+
+    vk::UniqueCommandPool commandPool;
+    vk::UniqueCommandBuffer commandBuffer;
+    // One pool per worker thread
+    std::vector<WorkerCommandPool> workerCommandPools;
+    // For descriptor sets that are only used by this frame. Reset once the frame has completed,
+    // so they are never freed one by one
+    DescriptorAllocator transientDescriptors;
+
+    // Transforms are copied into this frame's chunk of the round-robin buffer, and the material ID
+    // of every transform into the same index of this frame's chunk of the instance material buffer
+    uint32_t transformBufferOffset;
+    uint32_t instanceMaterialOffset;
+    // The camera as of PreRender, in this frame's chunk of the camera data buffer. Culling uses
+    // the same view, so it always agrees with what is drawn
+    uint32_t cameraDataOffset;
+    glm::mat4 viewProjection;
+    std::array<glm::vec4, 6> frustumPlanes;
+    // Everything that is bound once per frame, see BindingFrequency::PER_FRAME
+    vk::DescriptorSet frameDescriptorSet;
+
+    // GPU-driven rendering writes draws into this frame's chunk of the indirect buffer
+    uint32_t indirectBufferOffset;
+    uint32_t cullingDataOffset;
+    vk::DescriptorSet drawGenerationDescriptorSet;
+    // Set when the frame was rendered GPU-driven, so its statistics are read back once it completed
+    bool cullingStatisticsPending;
+    uint32_t culledInstanceCount;
+};
+
+// Enough for a 32768x32768 depth buffer
+constexpr uint32_t MAX_DEPTH_PYRAMID_LEVELS = 16;
+
+// Farthest depth of the previous frame, level 0 has the size of the depth buffer and every level
+// after it half the size of the one before. Used for occlusion culling. A transient image of the
+// render graph, so its memory is only taken while the draws are generated
+struct DepthPyramid
+{
+    RenderGraphResource image;
+    vk::Extent2D extent;
+    uint32_t levelCount;
+    // Only built when occlusion culling, GenerateDraws.comp samples whatever is in it otherwise
+    bool built;
+    // Allocated from the frame's transient descriptors once the graph has placed the image, since
+    // it can end up in a new one any frame
+    std::vector<vk::DescriptorSet> levelDescriptorSets;
+};
+
+// Resources that every frame imports into the render graph, the indirect ones only when rendering
+// GPU-driven
+struct FrameGraphResources
+{
+    RenderGraphResource transforms;
+    RenderGraphResource instanceMaterials;
+    RenderGraphResource depthBuffer;
+    RenderGraphResource indirectCommands;
+    RenderGraphResource cullingData;
+};
+
+// Layouts of the tables read by ResetDraws.comp and GenerateDraws.comp
+struct GpuInstance
+{
+    uint32_t transformIndex; // In whole matrices from the start of the dynamic buffer
+    uint32_t batchIndex;
+    float boundingRadius;
+    uint32_t materialId;
+};
+
+struct GpuBatch
+{
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t firstInstance; // Relative to the object list's first transform
+};
+
+struct DrawGenerationParameters
+{
+    uint32_t tableOffset; // In elements from the start of the write-once buffer
+    uint32_t count;
+    uint32_t firstCommand;
+    uint32_t firstTransform;
+};
+
+// Matches DrawParameters in Standard.vert and Standard.frag. The override is already a material
+// table index
+struct GpuDrawParameters
+{
+    uint32_t materialOverride;
+    uint32_t flags;
+};
+
+struct DepthPyramidParameters
+{
+    uint32_t fromDepthBuffer; // Boolean
+};
+
+struct CullingStatistics
+{
+    uint32_t instanceCount;
+    uint32_t frustumCulledCount;
+    uint32_t occlusionCulledCount;
+};
+
+// Written before every GPU-driven frame, GenerateDraws.comp adds the culled counts
+struct CullingData
+{
+    glm::mat4 viewProjection;
+    std::array<glm::vec4, 6> frustumPlanes;
+    uint32_t occlusionCulling; // Boolean
+    uint32_t frustumCulledCount;
+    uint32_t occlusionCulledCount;
+};
+
+// Entry of the material table read by Standard.frag, indices into the texture array
+struct GpuMaterial
+{
+    uint32_t diffuseTexture;
+    uint32_t specularTexture;
+};
+
+// Everything the GPU needs to generate the draws of one object list. Built once per list and
+// rebuilt when the list changes. There is one batch per mesh, so the whole list is drawn with one
+// multi-draw
+struct InstanceTable
+{
+    size_t objectCount;
+    ResourceIndex instanceBuffer;
+    ResourceIndex batchBuffer;
+    uint32_t batchCount;
+    // The buffers must not be removed before this frame has completed
+    uint64_t lastUsedFrame;
+};
+
+// A list of objects drawn with one pass. Recording is deferred until Present so that every pass of
+// a frame shares one transform upload and one render pass instance
+struct QueuedDraw
+{
+    GraphicsRenderPassVulkan* renderPass;
+    // Must stay alive and unchanged until Present. Changes in later frames have to be passed to
+    // MarkObjectListChanged
+    const std::vector<RenderObject>* objects;
+    // Index of the first object's transform in the frame's chunk of the round-robin buffer. Also
+    // the index of the draw's first sort item
+    uint32_t firstTransform;
+    // False if an earlier draw already uploads the transforms of the same objects
+    bool uploadsTransforms;
+    // First indirect command when rendering GPU-driven
+    uint32_t firstCommand;
+    // Objects left after frustum culling on the CPU, the rest of the transforms are unused
+    uint32_t visibleCount;
+    GpuDrawParameters drawParameters;
+};
+
+// Part of a QueuedDraw that is recorded into one secondary command buffer. Objects are indexed in
+// sorted order
+struct DrawChunk
+{
+    uint32_t drawIndex;
+    uint32_t firstObject;
+    uint32_t endObject;
+};
+
+// The code is compared on a hash hit, so a collision can't hand out the wrong module
+struct CachedShaderModule
+{
+    std::vector<char> code;
+    vk::UniqueShaderModule module;
+};
+
+// Modules are deduplicated by their code, so equal handles mean equal shaders. Every pipeline has
+// the same layout, so nothing else of a pass changes its pipelines
+struct PipelineKey
+{
+    vk::ShaderModule vertexShader;
+    vk::ShaderModule fragmentShader;
+    vk::ShaderModule depthVertexShader; // Null without a depth prepass
+
+    bool operator==(const PipelineKey& other) const = default;
+};
+
+struct PipelineKeyHash
+{
+    size_t operator()(const PipelineKey& key) const;
+};
+
+struct CachedPipeline
+{
+    vk::UniquePipeline pipeline;
+    // Only created for passes with a depth-only vertex shader
+    vk::UniquePipeline depthPrepassPipeline;
+    vk::UniquePipeline depthEqualPipeline;
 };
 
 class RendererVulkan: public Renderer
 {
   private:
-    // 2 for double buffering, 3 for triple, etc.
-    static constexpr uint32_t BACKBUFFER_COUNT = 2;
-
+    SDL_Window* windowHandle;
     vk::UniqueInstance instance;
     vk::UniqueDebugUtilsMessengerEXT debugCallback;
     vk::UniqueSurfaceKHR surface;
     uint32_t graphicsQueueIndex;
     vk::Queue graphicsQueue;
+    // Textures are uploaded on it. The graphics queue when the device has no other family for it
+    uint32_t transferQueueIndex;
+    vk::Queue transferQueue;
     vk::UniqueDevice device;
     vk::PhysicalDevice physicalDevice;
     vk::UniqueSwapchainKHR swapchain;
-    std::array<vk::UniqueFence, BACKBUFFER_COUNT> queueDoneFences;
-    std::array<vk::UniqueSemaphore, BACKBUFFER_COUNT> imageAvailableSemaphores;
-    std::array<vk::UniqueSemaphore, BACKBUFFER_COUNT> renderFinishedSemaphores;
+    PresentMode preferredPresentMode;
+    // Set when the swapchain no longer matches the surface, it is recreated at the next PreRender
+    bool swapchainOutOfDate;
+    // Set when no image could be acquired, e.g. when the window is minimized
+    bool skipFrame;
+    // Only used when rendering headless, in which case there is no surface or swapchain
+    std::vector<vk::UniqueImage> offscreenImages;
+    std::vector<vk::UniqueDeviceMemory> offscreenImageMemory;
+    // Swapchain images or offscreen images
+    std::vector<vk::Image> backBufferImages;
+    vk::Extent2D renderExtent;
 
     vk::UniqueRenderPass renderPass;
     std::vector<vk::UniqueFramebuffer> framebuffers;
@@ -56,23 +298,74 @@ class RendererVulkan: public Renderer
     vk::UniqueImage depthBuffer;
     vk::UniqueDeviceMemory depthBufferMemory;
     vk::UniqueImageView depthBufferView;
-    vk::UniqueDescriptorPool descriptorPool;
-    vk::UniqueDescriptorSet vertexIndexDescriptorSet;
+    // Carried between frames, since every frame's depth pyramid reads the previous frame's depth
+    RenderGraphResourceState depthBufferState;
     DescriptorSetLayouts descriptorSetLayouts;
-    std::array<vk::UniqueDescriptorSet, BACKBUFFER_COUNT> transformDescriptorSets;
-    vk::UniqueDescriptorSet viewProjectionDescriptorSet;
-    vk::UniquePipelineLayout pipelineLayout;
-    vk::UniquePipeline pipeline;
+    // Shared by every graphics pipeline, see createPipelineLayout
+    vk::UniquePipelineLayout graphicsPipelineLayout;
+    // Every descriptor set that outlives a frame, including the sampler manager's
+    DescriptorAllocator descriptorAllocator;
+    // Loaded from and saved to disk so that pipelines aren't recompiled on every launch
+    vk::UniquePipelineCache pipelineCache;
+    bool pipelineCacheWarm;
+    // In milliseconds, summed over every graphics pipeline created so far
+    double pipelineCreationTime;
 
-    vk::UniqueCommandPool commandPool;
-    std::vector<vk::UniqueCommandBuffer> commandBuffers;
+    GraphicsRenderPassVulkan* activeRenderPass;
+    std::vector<QueuedDraw> queuedDraws;
+    uint32_t queuedTransformCount;
+
+    // Kept between frames to avoid reallocating them every frame
+    std::vector<DrawChunk> drawChunks;
+    // One item per uploaded transform, value is the object's index in its draw
+    std::vector<SortItem> sortItems;
+    std::vector<SortItem> sortScratch;
+    // Indices of the objects that survived culling, laid out like the transforms
+    std::vector<uint32_t> visibleObjects;
+    // World space bounding spheres of every object list, built once per list and rebuilt when the
+    // list changes, like the instance tables of GPU-driven rendering
+    std::unordered_map<const std::vector<RenderObject>*, SphereBounds> cullingBounds;
+
+    // GPU-driven rendering generates the draws with compute shaders, so the CPU cost of a frame
+    // doesn't depend on the number of objects
+    bool gpuDrivenRendering;
+    bool multiDrawIndirectSupported;
+    bool frustumCulling;
+    bool occlusionCulling;
+    // The depth pyramid is built from the previous frame's depth, which doesn't exist after the
+    // depth buffer is created
+    bool depthBufferHasContent;
+    DepthPyramid depthPyramid;
+    vk::UniqueSampler depthPyramidSampler;
+    vk::UniquePipelineLayout depthPyramidPipelineLayout;
+    vk::UniquePipeline depthPyramidPipeline;
+    CullingStatistics cullingStatistics;
+    // Bounding sphere radius around the origin of every mesh, keyed by vertex buffer
+    std::unordered_map<ResourceIndex, float> meshRadii;
+    // Keyed by the diffuse texture in the high and the specular texture in the low 32 bits
+    std::unordered_map<uint64_t, uint32_t> materialIds;
+    std::unordered_map<const std::vector<RenderObject>*, std::vector<uint32_t>> objectMaterials;
+    vk::UniquePipelineLayout drawGenerationPipelineLayout;
+    vk::UniquePipeline resetDrawsPipeline;
+    vk::UniquePipeline generateDrawsPipeline;
+    std::unordered_map<const std::vector<RenderObject>*, InstanceTable> instanceTables;
+    // Tables of lists that changed, removed by getInstanceTable once no frame in flight uses them
+    std::vector<InstanceTable> retiredInstanceTables;
+    // Lists passed to MarkObjectListChanged whose cached data has not been dropped yet
+    std::unordered_set<const std::vector<RenderObject>*> changedObjectLists;
+    std::vector<vk::BufferCopy> transformCopies;
+    std::vector<std::vector<vk::BufferCopy>> chunkTransformCopies;
+    std::vector<vk::CommandBuffer> chunkCommandBuffers;
+    // Null for chunks whose pass has no depth prepass
+    std::vector<vk::CommandBuffer> depthPrepassCommandBuffers;
+    // Lays down depth before anything is shaded, so every pixel is shaded at most once
+    bool depthPrepass;
+
+    std::unique_ptr<WorkerPool> workerPool;
 
     std::optional<CameraVulkan> cameraOpt;
-    ResourceIndex cameraBufferIndex;
-    vk::UniqueDescriptorSet cameraPositionDescriptorSet;
 
     ResourceIndex lightBufferIndex;
-    vk::UniqueDescriptorSet lightBufferDescriptorSet;
 
     // Use dynamic memory so that the sampler manager can be initialized with a reference to
     // this->device
@@ -80,17 +373,87 @@ class RendererVulkan: public Renderer
     std::unique_ptr<BufferManagerVulkan> bufferManager;
     std::unique_ptr<TextureManagerVulkan> textureManager;
 
-    std::vector<GraphicsRenderPassVulkan> renderPasses;
-    std::vector<vk::UniqueShaderModule> shaderModules;
+    // Stored through pointers since they are handed out to the user
+    std::vector<std::unique_ptr<GraphicsRenderPassVulkan>> renderPasses;
+    // Keyed by a hash of the SPIR-V so that passes with the same shaders share modules
+    std::unordered_multimap<uint64_t, CachedShaderModule> shaderModules;
+    std::unordered_map<PipelineKey, CachedPipeline, PipelineKeyHash> pipelines;
 
+    // One context per frame in flight. 1 gives the lowest latency, 2 is double buffering, 3 is
+    // triple buffering, etc.
+    std::vector<FrameContext> frames;
     uint64_t currentFrame;
-    // Can't do currentFrame % BACKBUFFER_COUNT since the spec does not define the order of
-    // swapchain images
+    // Starts once PreRender has waited for the frame context and acquired the image, so the
+    // recording time leaves out every wait on the GPU and the swapchain
+    std::chrono::steady_clock::time_point recordBegin;
+    double cpuRecordTime;
+    // Timeline semaphore that the GPU sets to N + 1 once frame N has completed. It only ever
+    // increases, so anything can check a frame without a fence of its own
+    vk::UniqueSemaphore frameTimeline;
+    // Times the regions of every frame and counts its shader invocations
+    GpuProfiler gpuProfiler;
+    // Records everything between PreRender and Present, see recordQueuedDraws
+    RenderGraph renderGraph;
+    FrameGraphResources graphResources;
+    // Can't do currentFrame % frames.size() since the spec does not define the order of swapchain
+    // images
     uint32_t currentSwapchainImageIndex;
 
+    // Everything that doesn't depend on whether there is a window or not
+    void initialise(uint32_t framesInFlight);
+
+    // Returns false if the surface has no area, in which case the old swapchain is kept
+    bool recreateSwapchain();
+
+    FrameContext& getCurrentFrameContext();
+
+    // Loads the module the first time its SPIR-V is seen
+    const CachedShaderModule& getShaderModule(const std::string& path);
+
+    vk::CommandBuffer beginChunkCommandBuffer(uint32_t workerIndex);
+    // Binds everything except the pipeline and the pass's set. Materials are read through the
+    // material table, so nothing is bound per object
+    void bindFrameState(vk::CommandBuffer commandBuffer, vk::PipelineLayout pipelineLayout);
+    void bindPassState(vk::CommandBuffer commandBuffer, const GraphicsRenderPassVulkan& renderPass);
+    bool usesDepthPrepass(const QueuedDraw& draw) const;
+    // Records either the depth prepass or the shading of the objects. Both draw the same batches
+    void recordDrawChunk(
+        vk::CommandBuffer commandBuffer,
+        const QueuedDraw& draw,
+        uint32_t firstObject,
+        uint32_t endObject,
+        bool depthOnly);
+    // Records everything queued by Render since PreRender into the frame's command buffer
+    void recordQueuedDraws();
+    // Fill chunkCommandBuffers with the draws of every queued draw and add the passes that have to
+    // run before the render pass, see recordQueuedDraws
+    void recordSortedDraws();
+    void recordIndirectDraws();
+
+    // Drops everything cached for the list if it was marked as changed. Lists are told apart by
+    // address, so this runs the first time a list is drawn in a frame
+    void validateObjectList(const std::vector<RenderObject>& objects);
+    const InstanceTable& getInstanceTable(const std::vector<RenderObject>& objects);
+    float getMeshRadius(ResourceIndex vertexBuffer);
+    const SphereBounds& getCullingBounds(const std::vector<RenderObject>& objects);
+    // Adds the material to the material table the first time it is seen
+    uint32_t getMaterialId(const SurfaceProperty& surfaceProperty);
+    // Material ID of every object in the list, built once per list
+    const std::vector<uint32_t>& getObjectMaterials(const std::vector<RenderObject>& objects);
+    // Points the frame's draw generation set and the pyramid's levels at the image the render graph
+    // placed it in. Has to be called after the graph is compiled
+    void writeDepthPyramidDescriptors();
+    void recordDepthPyramid(vk::CommandBuffer commandBuffer);
+
   public:
-    RendererVulkan(SDL_Window* windowHandle);
-    ~RendererVulkan() = default;
+    RendererVulkan(
+        SDL_Window* windowHandle,
+        uint32_t framesInFlight = 2,
+        PresentMode preferredPresentMode = PresentMode::FIFO);
+    // Headless rendering without a window or swapchain, rendering into offscreen images instead
+    RendererVulkan(uint32_t width, uint32_t height, uint32_t framesInFlight = 2);
+    // Waits for the GPU and writes the pipeline cache to disk
+    ~RendererVulkan();
     RendererVulkan(const RendererVulkan& other) = delete;
     RendererVulkan& operator=(const RendererVulkan& other) = delete;
     RendererVulkan(RendererVulkan&& other) = default;
@@ -111,7 +474,41 @@ class RendererVulkan: public Renderer
     void SetCamera(Camera* toSet) override;
     void SetLightBuffer(ResourceIndex lightBufferIndexToUse) override;
 
+    // The frame that is recorded between PreRender and Present. The CPU runs at most as many frames
+    // ahead of the GPU as there are frames in flight
+    uint64_t GetCurrentFrame() const;
+    // Does not block. Compares the frame number against the frame timeline, so it is true once the
+    // GPU has completed the frame with that number
+    bool IsFrameComplete(uint64_t frame) const;
+    // Blocks until the frame has completed on the GPU
+    void WaitForFrame(uint64_t frame) const;
+    // In milliseconds, of the last frame that was submitted. Covers the CPU work from the end of
+    // the waits in PreRender until the frame is submitted in Present
+    double GetCpuRecordTime() const;
+    // Whether the pipeline cache loaded from disk at startup could be used
+    bool IsPipelineCacheWarm() const;
+    // In milliseconds, summed over every graphics pipeline created so far, so it shows how much
+    // the pipeline cache saves
+    double GetPipelineCreationTime() const;
+
     void PreRender() override;
+    // Data built from an object list is cached by the list's address. Call this after adding,
+    // removing or replacing objects of a list that was rendered before, or when a new list may
+    // have the address of a destroyed one. Not between PreRender and Present
+    void MarkObjectListChanged(const std::vector<RenderObject>& objects);
+    // All can be changed between frames. Occlusion culling only applies to GPU-driven rendering
+    void SetGpuDrivenRendering(bool enabled);
+    void SetFrustumCulling(bool enabled);
+    void SetOcclusionCulling(bool enabled);
+    // Passes without a depth-only vertex shader are drawn as if it was disabled
+    void SetDepthPrepass(bool enabled);
+    // Of the last GPU-driven frame that has finished on the GPU
+    CullingStatistics GetCullingStatistics() const;
+    // Of the last frame that has finished on the GPU. Regions are only timed when the graphics
+    // queue supports timestamps
+    const GpuFrameStatistics& GetGpuFrameStatistics() const;
+
+    // objectsToRender must stay alive until Present, which is when the draws are recorded
     void Render(const std::vector<RenderObject>& objectsToRender) override;
     void Present() override;
 };
\ No newline at end of file
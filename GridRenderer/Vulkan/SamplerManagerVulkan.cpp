@@ -2,21 +2,12 @@
 
 SamplerManagerVulkan::SamplerManagerVulkan(
     const vk::UniqueDevice& device,
-    const vk::UniqueDescriptorSetLayout& samplerSetLayout)
+    const vk::UniqueDescriptorSetLayout& samplerSetLayout,
+    DescriptorAllocator& descriptorAllocator)
     : device(device)
     , samplerSetLayout(samplerSetLayout)
+    , descriptorAllocator(descriptorAllocator)
 {
-    vk::DescriptorPoolSize samplerInfo = {
-        .type = vk::DescriptorType::eSampler,
-        .descriptorCount = 1,
-    };
-    vk::DescriptorPoolCreateInfo poolInfo = {
-        .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
-        .maxSets = 10,
-        .poolSizeCount = 1,
-        .pPoolSizes = &samplerInfo,
-    };
-    this->descriptorPool = device->createDescriptorPoolUnique(poolInfo);
 }
 
 ResourceIndex SamplerManagerVulkan::CreateSampler(SamplerType type, AddressMode adressMode)
@@ -40,19 +31,14 @@ ResourceIndex SamplerManagerVulkan::CreateSampler(SamplerType type, AddressMode
     };
     auto sampler = device->createSamplerUnique(samplerInfo);
 
-    vk::DescriptorSetAllocateInfo descSetInfo = {
-        .descriptorPool = *this->descriptorPool,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &*this->samplerSetLayout,
-    };
-    auto descriptorSet = std::move(device->allocateDescriptorSetsUnique(descSetInfo)[0]);
+    vk::DescriptorSet descriptorSet = descriptorAllocator.Allocate(*samplerSetLayout);
 
     vk::DescriptorImageInfo descriptorImageInfo = {
         .sampler = *sampler,
         .imageView = VK_NULL_HANDLE,
     };
     vk::WriteDescriptorSet imageWriteDescriptor = {
-        .dstSet = *descriptorSet,
+        .dstSet = descriptorSet,
         .dstBinding = 0,
         .dstArrayElement = 0,
         .descriptorCount = 1,
@@ -63,11 +49,11 @@ ResourceIndex SamplerManagerVulkan::CreateSampler(SamplerType type, AddressMode
     };
     device->updateDescriptorSets(1, &imageWriteDescriptor, 0, nullptr);
 
-    samplers.push_back({.sampler = std::move(sampler), .descriptorSet = std::move(descriptorSet)});
+    samplers.push_back({.sampler = std::move(sampler), .descriptorSet = descriptorSet});
     return samplers.size() - 1;
 }
 
 const vk::DescriptorSet& SamplerManagerVulkan::GetDescriptorSet(ResourceIndex index)
 {
-    return *samplers[index].descriptorSet;
+    return samplers[index].descriptorSet;
 }
\ No newline at end of file
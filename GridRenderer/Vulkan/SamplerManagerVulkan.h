@@ -4,11 +4,12 @@
 #include <vulkan/vulkan_raii.hpp>
 
 #include "../SamplerManager.h"
+#include "DescriptorAllocator.h"
 
 struct SamplerData
 {
     vk::UniqueSampler sampler;
-    vk::UniqueDescriptorSet descriptorSet;
+    vk::DescriptorSet descriptorSet;
 };
 
 class SamplerManagerVulkan: public SamplerManager
@@ -16,12 +17,16 @@ class SamplerManagerVulkan: public SamplerManager
   private:
     const vk::UniqueDevice& device;
     const vk::UniqueDescriptorSetLayout& samplerSetLayout;
+    // Shared with the renderer
+    DescriptorAllocator& descriptorAllocator;
 
-    vk::UniqueDescriptorPool descriptorPool;
     std::vector<SamplerData> samplers;
 
   public:
-    SamplerManagerVulkan(const vk::UniqueDevice&, const vk::UniqueDescriptorSetLayout&);
+    SamplerManagerVulkan(
+        const vk::UniqueDevice&,
+        const vk::UniqueDescriptorSetLayout&,
+        DescriptorAllocator& descriptorAllocator);
     SamplerManagerVulkan(const SamplerManagerVulkan& other) = delete;
     SamplerManagerVulkan& operator=(const SamplerManagerVulkan& other) = delete;
     SamplerManagerVulkan(SamplerManagerVulkan&& other) = default;
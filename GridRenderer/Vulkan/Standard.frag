@@ -1,14 +1,32 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec3 worldPosition;
 layout(location = 1) in vec2 uv;
 layout(location = 2) in vec3 normal;
+layout(location = 3) flat in uint materialId;
 
 layout(location = 0) out vec4 outColor;
 
-layout(binding = 0, set = 3) uniform sampler samp;
-layout(binding = 0, set = 4) uniform texture2D diffuseTexture;
-layout(binding = 0, set = 5) uniform texture2D specularTexture;
+// Set 0 changes per frame, set 1 per pass and set 2 per material, see BindingFrequency in
+// RendererVulkan.h
+layout(binding = 0, set = 1) uniform sampler samp;
+// Every texture, only the ones that have been added are valid. The size must match
+// MAX_TEXTURES in TextureManagerVulkan.h
+layout(binding = 0, set = 2) uniform texture2D textures[1024];
+
+// Matches GpuMaterial in RendererVulkan.h
+struct Material
+{
+    uint diffuseTexture;
+    uint specularTexture;
+};
+
+layout(binding = 1, set = 2) readonly buffer MaterialTable
+{
+    Material materials[];
+}
+materialTable;
 
 struct Light
 {
@@ -22,18 +40,30 @@ struct Light
 
 // This buffer is small, but uniform buffers don't allow unsized arrays so an
 // ssbo has to be used
-layout(binding = 0, set = 6) readonly buffer LightBuffer
+layout(binding = 5, set = 0) readonly buffer LightBuffer
 {
     Light lights[];
 }
 lights;
 
 // The interface name is optional
-layout(binding = 0, set = 7) uniform CameraBuffer
+layout(binding = 4, set = 0) uniform CameraBuffer
 {
     vec3 cameraPos;
 };
 
+// Matches GpuDrawParameters in RendererVulkan.h and DrawFlags in GraphicsRenderPass.h. Must be
+// identical in Standard.vert
+const uint DRAW_FLAG_MATERIAL_OVERRIDE = 1u;
+const uint DRAW_FLAG_UNLIT = 2u;
+
+layout(push_constant) uniform DrawParameters
+{
+    uint materialOverride;
+    uint flags;
+}
+drawParameters;
+
 void main()
 {
     vec3 ambient = vec3(0.1, 0.1, 0.1);
@@ -43,8 +73,18 @@ void main()
 
     uint nrOfLights = lights.lights.length();
 
-    vec3 diffuseMaterial = texture(sampler2D(diffuseTexture, samp), uv).xyz;
-    vec3 specularMaterial = texture(sampler2D(specularTexture, samp), uv).xyz;
+    // Instances of different materials can share a draw, so the index may diverge
+    Material material = materialTable.materials[materialId];
+    vec3 diffuseMaterial =
+        texture(sampler2D(textures[nonuniformEXT(material.diffuseTexture)], samp), uv).xyz;
+    vec3 specularMaterial =
+        texture(sampler2D(textures[nonuniformEXT(material.specularTexture)], samp), uv).xyz;
+
+    if((drawParameters.flags & DRAW_FLAG_UNLIT) != 0)
+    {
+        outColor = vec4(diffuseMaterial, 1.0);
+        return;
+    }
 
     vec3 position = worldPosition;
     vec3 normal = normalize(normal);
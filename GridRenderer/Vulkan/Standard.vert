@@ -15,41 +15,59 @@ struct Vertex
     float normalZ;
 };
 
-// Should always be updated together
+// Set 0 changes per frame, see BindingFrequency in RendererVulkan.h
+
+// Every mesh's vertices. Indices come from the index buffer and the draw's vertex offset is
+// already added to gl_VertexIndex
 layout(binding = 0, set = 0) readonly buffer VertexBuffer
 {
     Vertex vertices[];
 }
 vertexBuffer;
-layout(binding = 1, set = 0) readonly buffer IndexBuffer
-{
-    uint indices[];
-}
-indexBuffer;
 
 // Will be updated randomly
-layout(binding = 0, set = 1) readonly buffer TransformBuffer
+layout(binding = 1, set = 0) readonly buffer TransformBuffer
 {
     mat4 worldMatrices[];
 }
 transformBuffer;
 
+// Material of every transform, at the same index
+layout(binding = 2, set = 0) readonly buffer MaterialIdBuffer
+{
+    uint materialIds[];
+}
+materialIdBuffer;
+
 // Will be updated once per frame
-layout(binding = 0, set = 2) uniform CameraBuffer
+layout(binding = 3, set = 0) uniform CameraBuffer
 {
     mat4 viewProjMatrix;
 }
 cameraBuffer;
 
-// Outputs
+// Matches GpuDrawParameters in RendererVulkan.h and DrawFlags in GraphicsRenderPass.h. Must be
+// identical in Standard.frag
+const uint DRAW_FLAG_MATERIAL_OVERRIDE = 1u;
+const uint DRAW_FLAG_UNLIT = 2u;
+
+layout(push_constant) uniform DrawParameters
+{
+    uint materialOverride;
+    uint flags;
+}
+drawParameters;
+
+// Outputs. Must match StandardDepth.vert exactly, the depth prepass relies on equal depth
+invariant gl_Position;
 layout(location = 0) out vec3 outWorldPosition;
 layout(location = 1) out vec2 outUv;
 layout(location = 2) out vec3 outNormal;
+layout(location = 3) flat out uint outMaterialId;
 
 void main()
 {
-    uint index = indexBuffer.indices[gl_VertexIndex];
-    Vertex vertex = vertexBuffer.vertices[index];
+    Vertex vertex = vertexBuffer.vertices[gl_VertexIndex];
 
     vec3 position = vec3(vertex.positionX, vertex.positionY, vertex.positionZ);
     vec3 normal = vec3(vertex.normalX, vertex.normalY, vertex.normalZ);
@@ -61,4 +79,7 @@ void main()
     outWorldPosition = worldPosition.xyz;
     outUv = vec2(vertex.uvX, vertex.uvY);
     outNormal = (worldMatrix * vec4(normal, 0.0)).xyz;
+    outMaterialId = (drawParameters.flags & DRAW_FLAG_MATERIAL_OVERRIDE) != 0
+                        ? drawParameters.materialOverride
+                        : materialIdBuffer.materialIds[gl_InstanceIndex];
 }
\ No newline at end of file
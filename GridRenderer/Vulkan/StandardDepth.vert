@@ -0,0 +1,47 @@
+// Position-only variant of Standard.vert for the depth prepass
+#version 460
+
+// See Standard.vert
+struct Vertex
+{
+    float positionX;
+    float positionY;
+    float positionZ;
+    float uvX;
+    float uvY;
+    float normalX;
+    float normalY;
+    float normalZ;
+};
+
+layout(binding = 0, set = 0) readonly buffer VertexBuffer
+{
+    Vertex vertices[];
+}
+vertexBuffer;
+
+layout(binding = 1, set = 0) readonly buffer TransformBuffer
+{
+    mat4 worldMatrices[];
+}
+transformBuffer;
+
+layout(binding = 3, set = 0) uniform CameraBuffer
+{
+    mat4 viewProjMatrix;
+}
+cameraBuffer;
+
+// Computed exactly like in Standard.vert so that the main pass can test for equal depth
+invariant gl_Position;
+
+void main()
+{
+    Vertex vertex = vertexBuffer.vertices[gl_VertexIndex];
+
+    vec3 position = vec3(vertex.positionX, vertex.positionY, vertex.positionZ);
+    mat4 worldMatrix = transpose(transformBuffer.worldMatrices[gl_InstanceIndex]);
+
+    vec4 worldPosition = worldMatrix * vec4(position, 1.0);
+    gl_Position = cameraBuffer.viewProjMatrix * worldPosition;
+}
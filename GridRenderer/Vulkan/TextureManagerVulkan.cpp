@@ -1,24 +1,28 @@
 #include "TextureManagerVulkan.h"
 
+#include <array>
 #include <optional>
 
+#include "../Profiler.h"
 #include "StlHelpers/EntireCollection.h"
 
 TextureManagerVulkan::TextureManagerVulkan(
     const vk::UniqueDevice& device,
     const vk::PhysicalDevice& physicalDevice,
     const vk::Queue& uploadQueue,
-    uint32_t queueFamilyIndex,
+    uint32_t uploadQueueFamilyIndex,
+    uint32_t graphicsQueueFamilyIndex,
     const vk::UniqueDescriptorSetLayout& textureSetLayout)
     : device(device)
     , physicalDevice(physicalDevice)
     , uploadQueue(uploadQueue)
-    , queueFamilyIndex(queueFamilyIndex)
+    , uploadQueueFamilyIndex(uploadQueueFamilyIndex)
+    , graphicsQueueFamilyIndex(graphicsQueueFamilyIndex)
     , textureSetLayout(textureSetLayout)
 {
     vk::CommandPoolCreateInfo commandPoolInfo = {
         .flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
-        .queueFamilyIndex = queueFamilyIndex,
+        .queueFamilyIndex = uploadQueueFamilyIndex,
     };
     this->commandPool = device->createCommandPoolUnique(commandPoolInfo);
     vk::CommandBufferAllocateInfo commandBufferInfo = {
@@ -27,13 +31,18 @@ TextureManagerVulkan::TextureManagerVulkan(
         .commandBufferCount = 1,
     };
     this->commandBuffer = std::move(device->allocateCommandBuffersUnique(commandBufferInfo)[0]);
+    vk::SemaphoreTypeCreateInfo timelineCreateInfo = {
+        .semaphoreType = vk::SemaphoreType::eTimeline,
+        .initialValue = 0,
+    };
+    this->uploadTimeline = device->createSemaphoreUnique({.pNext = &timelineCreateInfo});
 
     vk::BufferCreateInfo bufferInfo = {
         .size = 4096 * 4096 * 4 * sizeof(float),
         .usage = vk::BufferUsageFlagBits::eTransferSrc,
         .sharingMode = vk::SharingMode::eExclusive,
         .queueFamilyIndexCount = 1,
-        .pQueueFamilyIndices = &this->queueFamilyIndex,
+        .pQueueFamilyIndices = &this->uploadQueueFamilyIndex,
     };
     this->stagingBuffer = device->createBufferUnique(bufferInfo);
 
@@ -65,17 +74,32 @@ TextureManagerVulkan::TextureManagerVulkan(
 
     device->bindBufferMemory(*stagingBuffer, *stagingBufferMemory, 0);
 
-    vk::DescriptorPoolSize textureInfo = {
-        .type = vk::DescriptorType::eSampledImage,
-        .descriptorCount = 1,
+    // The set also holds the material table, which the renderer writes
+    std::array<vk::DescriptorPoolSize, 2> poolSizes = {
+        vk::DescriptorPoolSize{
+            .type = vk::DescriptorType::eSampledImage,
+            .descriptorCount = MAX_TEXTURES,
+        },
+        vk::DescriptorPoolSize{
+            .type = vk::DescriptorType::eStorageBuffer,
+            .descriptorCount = 1,
+        },
     };
     vk::DescriptorPoolCreateInfo poolInfo = {
-        .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
-        .maxSets = 10,
-        .poolSizeCount = 1,
-        .pPoolSizes = &textureInfo,
+        .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet
+                 | vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind,
+        .maxSets = 1,
+        .poolSizeCount = (uint32_t)poolSizes.size(),
+        .pPoolSizes = poolSizes.data(),
     };
     this->descriptorPool = device->createDescriptorPoolUnique(poolInfo);
+
+    vk::DescriptorSetAllocateInfo allocationInfo = {
+        .descriptorPool = *descriptorPool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &*textureSetLayout,
+    };
+    this->descriptorSet = std::move(device->allocateDescriptorSetsUnique(allocationInfo)[0]);
 }
 
 std::optional<vk::Format> convertVkFormat(const FormatInfo& info)
@@ -116,6 +140,8 @@ std::optional<vk::Format> convertVkFormat(const FormatInfo& info)
 
 ResourceIndex TextureManagerVulkan::AddTexture(void* textureData, const TextureInfo& textureInfo)
 {
+    PROFILE_ZONE("AddTexture");
+    assert(textures.size() < MAX_TEXTURES);
     auto vkFormatOpt = convertVkFormat(textureInfo.format);
     assert(vkFormatOpt);
     vk::ImageCreateInfo imageInfo = {
@@ -134,7 +160,7 @@ ResourceIndex TextureManagerVulkan::AddTexture(void* textureData, const TextureI
         .usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst,
         .sharingMode = vk::SharingMode::eExclusive,
         .queueFamilyIndexCount = 1,
-        .pQueueFamilyIndices = &this->queueFamilyIndex,
+        .pQueueFamilyIndices = &this->uploadQueueFamilyIndex,
         .initialLayout = vk::ImageLayout::eUndefined,
     };
     vk::UniqueImage image = device->createImageUnique(imageInfo);
@@ -146,8 +172,18 @@ ResourceIndex TextureManagerVulkan::AddTexture(void* textureData, const TextureI
                              : textureInfo.format.componentSize == TexelComponentSize::WORD ? 4
                                                                                             : -1;
 
-    // Very simple (and slow) synchronization
-    device->waitIdle();
+    // Only the previous upload can still be using the staging buffer, rendering carries on
+    {
+        PROFILE_ZONE("Wait for previous upload");
+        vk::Result waitResult = device->waitSemaphores(
+            {
+                .semaphoreCount = 1,
+                .pSemaphores = &*uploadTimeline,
+                .pValues = &uploadCount,
+            },
+            UINT64_MAX);
+        assert(waitResult == vk::Result::eSuccess);
+    }
     void* memory = device->mapMemory(*stagingBufferMemory, 0, VK_WHOLE_SIZE);
     std::memcpy(
         memory,
@@ -185,9 +221,11 @@ ResourceIndex TextureManagerVulkan::AddTexture(void* textureData, const TextureI
         .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
     });
 
-    vk::ImageMemoryBarrier memoryBarrier = {
-        .srcAccessMask = vk::AccessFlags(),
-        .dstAccessMask = vk::AccessFlagBits::eTransferWrite,
+    vk::ImageMemoryBarrier2 memoryBarrier = {
+        .srcStageMask = vk::PipelineStageFlagBits2::eNone,
+        .srcAccessMask = vk::AccessFlagBits2::eNone,
+        .dstStageMask = vk::PipelineStageFlagBits2::eCopy,
+        .dstAccessMask = vk::AccessFlagBits2::eTransferWrite,
         .oldLayout = vk::ImageLayout::eUndefined,
         .newLayout = vk::ImageLayout::eTransferDstOptimal,
         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
@@ -202,13 +240,16 @@ ResourceIndex TextureManagerVulkan::AddTexture(void* textureData, const TextureI
                 .layerCount = 1,
             },
     };
-    commandBuffer->pipelineBarrier(
-        vk::PipelineStageFlagBits::eTopOfPipe,
-        vk::PipelineStageFlagBits::eTransfer,
-        vk::DependencyFlagBits::eByRegion,
-        {},
-        {},
-        {memoryBarrier});
+    vk::DependencyInfo dependencyInfo = {
+        .dependencyFlags = vk::DependencyFlagBits::eByRegion,
+        .memoryBarrierCount = 0,
+        .pMemoryBarriers = nullptr,
+        .bufferMemoryBarrierCount = 0,
+        .pBufferMemoryBarriers = nullptr,
+        .imageMemoryBarrierCount = 1,
+        .pImageMemoryBarriers = &memoryBarrier,
+    };
+    commandBuffer->pipelineBarrier2(dependencyInfo);
 
     vk::BufferImageCopy copyData = {
         .bufferOffset = 0,
@@ -240,13 +281,23 @@ ResourceIndex TextureManagerVulkan::AddTexture(void* textureData, const TextureI
         vk::ImageLayout::eTransferDstOptimal,
         {copyData});
 
+    // Within one family uploads are submitted to the graphics queue itself, and later
+    // submissions to it only sample the texture after this, so it can be used as soon as the
+    // descriptor is written. Otherwise this releases it to the graphics family, whose acquire
+    // makes the copy visible and repeats the layout transition
+    const bool ownershipTransfer = uploadQueueFamilyIndex != graphicsQueueFamilyIndex;
     memoryBarrier = {
-        .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
-        .dstAccessMask = vk::AccessFlagBits::eShaderRead,
+        .srcStageMask = vk::PipelineStageFlagBits2::eCopy,
+        .srcAccessMask = vk::AccessFlagBits2::eTransferWrite,
+        .dstStageMask = ownershipTransfer ? vk::PipelineStageFlagBits2::eNone
+                                          : vk::PipelineStageFlagBits2::eFragmentShader,
+        .dstAccessMask = ownershipTransfer ? vk::AccessFlagBits2::eNone
+                                           : vk::AccessFlagBits2::eShaderSampledRead,
         .oldLayout = vk::ImageLayout::eTransferDstOptimal,
         .newLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
-        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .srcQueueFamilyIndex = ownershipTransfer ? uploadQueueFamilyIndex : VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex =
+            ownershipTransfer ? graphicsQueueFamilyIndex : VK_QUEUE_FAMILY_IGNORED,
         .image = *image,
         .subresourceRange =
             {
@@ -257,25 +308,29 @@ ResourceIndex TextureManagerVulkan::AddTexture(void* textureData, const TextureI
                 .layerCount = 1,
             },
     };
-    commandBuffer->pipelineBarrier(
-        vk::PipelineStageFlagBits::eTransfer,
-        vk::PipelineStageFlagBits::eFragmentShader,
-        vk::DependencyFlagBits::eByRegion,
-        {},
-        {},
-        {memoryBarrier});
+    commandBuffer->pipelineBarrier2(dependencyInfo);
 
     commandBuffer->end();
+    ++uploadCount;
+    vk::TimelineSemaphoreSubmitInfo timelineSubmitInfo = {
+        .waitSemaphoreValueCount = 0,
+        .pWaitSemaphoreValues = nullptr,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &uploadCount,
+    };
     vk::SubmitInfo submitInfo = {
+        .pNext = &timelineSubmitInfo,
         .waitSemaphoreCount = 0,
         .pWaitSemaphores = nullptr,
         .pWaitDstStageMask = nullptr,
         .commandBufferCount = 1,
         .pCommandBuffers = &*commandBuffer,
-        .signalSemaphoreCount = 0,
-        .pSignalSemaphores = nullptr,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &*uploadTimeline,
     };
     this->uploadQueue.submit(submitInfo);
+    if(ownershipTransfer)
+        pendingAcquires.push_back(*image);
     vk::ImageViewCreateInfo imageViewInfo = {
         .image = *image,
         .viewType = vk::ImageViewType::e2D,
@@ -298,15 +353,6 @@ ResourceIndex TextureManagerVulkan::AddTexture(void* textureData, const TextureI
     };
     auto imageView = device->createImageViewUnique(imageViewInfo);
 
-    device->waitIdle();
-
-    vk::DescriptorSetAllocateInfo allocationInfo = {
-        .descriptorPool = *descriptorPool,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &*textureSetLayout,
-    };
-    auto descriptorSet = std::move(device->allocateDescriptorSetsUnique(allocationInfo)[0]);
-
     vk::DescriptorImageInfo descriptorImageInfo = {
         .sampler = VK_NULL_HANDLE,
         .imageView = *imageView,
@@ -315,7 +361,7 @@ ResourceIndex TextureManagerVulkan::AddTexture(void* textureData, const TextureI
     vk::WriteDescriptorSet imageWriteDescriptor = {
         .dstSet = *descriptorSet,
         .dstBinding = 0,
-        .dstArrayElement = 0,
+        .dstArrayElement = (uint32_t)textures.size(),
         .descriptorCount = 1,
         .descriptorType = vk::DescriptorType::eSampledImage,
         .pImageInfo = &descriptorImageInfo,
@@ -328,13 +374,61 @@ ResourceIndex TextureManagerVulkan::AddTexture(void* textureData, const TextureI
         .image = std::move(image),
         .imageView = std::move(imageView),
         .imageMemory = std::move(imageMemory),
-        .descriptorSet = std::move(descriptorSet),
     });
 
     return textures.size() - 1;
 }
 
-const vk::DescriptorSet& TextureManagerVulkan::GetDescriptorSet(ResourceIndex index)
+uint64_t TextureManagerVulkan::AcquireUploads(vk::CommandBuffer commandBuffer)
+{
+    if(pendingAcquires.empty())
+        return 0;
+
+    // The source stage chains with the submission's wait for the upload timeline
+    std::vector<vk::ImageMemoryBarrier2> acquireBarriers;
+    for(vk::Image image : pendingAcquires)
+    {
+        acquireBarriers.push_back({
+            .srcStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+            .srcAccessMask = vk::AccessFlagBits2::eNone,
+            .dstStageMask = vk::PipelineStageFlagBits2::eFragmentShader,
+            .dstAccessMask = vk::AccessFlagBits2::eShaderSampledRead,
+            .oldLayout = vk::ImageLayout::eTransferDstOptimal,
+            .newLayout = vk::ImageLayout::eShaderReadOnlyOptimal,
+            .srcQueueFamilyIndex = uploadQueueFamilyIndex,
+            .dstQueueFamilyIndex = graphicsQueueFamilyIndex,
+            .image = image,
+            .subresourceRange =
+                {
+                    .aspectMask = vk::ImageAspectFlagBits::eColor,
+                    .baseMipLevel = 0,
+                    .levelCount = 1,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+                },
+        });
+    }
+    commandBuffer.pipelineBarrier2({
+        .dependencyFlags = {},
+        .memoryBarrierCount = 0,
+        .pMemoryBarriers = nullptr,
+        .bufferMemoryBarrierCount = 0,
+        .pBufferMemoryBarriers = nullptr,
+        .imageMemoryBarrierCount = (uint32_t)acquireBarriers.size(),
+        .pImageMemoryBarriers = acquireBarriers.data(),
+    });
+    pendingAcquires.clear();
+
+    // The last upload, which signals after every one before it
+    return uploadCount;
+}
+
+vk::Semaphore TextureManagerVulkan::GetUploadTimeline() const
+{
+    return *uploadTimeline;
+}
+
+const vk::DescriptorSet& TextureManagerVulkan::GetDescriptorSet()
 {
-    return *textures[index].descriptorSet;
+    return *descriptorSet;
 }
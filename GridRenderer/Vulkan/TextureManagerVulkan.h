@@ -6,12 +6,14 @@
 
 #include "../TextureManager.h"
 
+// Size of the texture array, must match Standard.frag
+constexpr uint32_t MAX_TEXTURES = 1024;
+
 struct TextureData
 {
     vk::UniqueImage image;
     vk::UniqueImageView imageView;
     vk::UniqueDeviceMemory imageMemory;
-    vk::UniqueDescriptorSet descriptorSet;
 };
 
 class TextureManagerVulkan: public TextureManager
@@ -20,7 +22,8 @@ class TextureManagerVulkan: public TextureManager
     const vk::UniqueDevice& device;
     const vk::PhysicalDevice& physicalDevice;
     const vk::Queue& uploadQueue;
-    const uint32_t queueFamilyIndex;
+    const uint32_t uploadQueueFamilyIndex;
+    const uint32_t graphicsQueueFamilyIndex;
     const vk::UniqueDescriptorSetLayout& textureSetLayout;
 
     vk::UniqueBuffer stagingBuffer;
@@ -28,7 +31,16 @@ class TextureManagerVulkan: public TextureManager
 
     vk::UniqueCommandPool commandPool;
     vk::UniqueCommandBuffer commandBuffer;
+    // Signaled to the number of the upload once it has finished with the staging buffer and the
+    // command buffer
+    vk::UniqueSemaphore uploadTimeline;
+    uint64_t uploadCount = 0;
+    // Released by the upload queue's family but not yet acquired by the graphics queue's
+    std::vector<vk::Image> pendingAcquires;
     vk::UniqueDescriptorPool descriptorPool;
+    // Every texture at the index AddTexture returned, and the renderer's material table. Textures
+    // are added while the set is bound, and slots without a texture are never read
+    vk::UniqueDescriptorSet descriptorSet;
 
     std::vector<TextureData> textures;
 
@@ -37,13 +49,21 @@ class TextureManagerVulkan: public TextureManager
         const vk::UniqueDevice& device,
         const vk::PhysicalDevice& physicalDevice,
         const vk::Queue& uploadQueue,
-        uint32_t queueFamilyIndex,
+        uint32_t uploadQueueFamilyIndex,
+        uint32_t graphicsQueueFamilyIndex,
         const vk::UniqueDescriptorSetLayout& textureSetLayout);
     TextureManagerVulkan(const TextureManagerVulkan& other) = delete;
     TextureManagerVulkan& operator=(const TextureManagerVulkan& other) = delete;
     TextureManagerVulkan(TextureManagerVulkan&& other) = default;
     TextureManagerVulkan& operator=(TextureManagerVulkan&& other) = delete;
 
+    // Returns as soon as the upload is submitted. When the upload queue is in another family, the
+    // texture can only be sampled by command buffers that acquire it, see AcquireUploads
     ResourceIndex AddTexture(void* textureData, const TextureInfo& textureInfo) override;
-    const vk::DescriptorSet& GetDescriptorSet(ResourceIndex index);
+    // Records the graphics queue's half of the ownership transfer of every texture added since the
+    // last call. Returns the upload timeline value the submission has to wait for before its
+    // fragment shaders, or 0 if it doesn't have to wait
+    uint64_t AcquireUploads(vk::CommandBuffer commandBuffer);
+    vk::Semaphore GetUploadTimeline() const;
+    const vk::DescriptorSet& GetDescriptorSet();
 };
\ No newline at end of file
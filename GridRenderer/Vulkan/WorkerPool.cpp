@@ -0,0 +1,73 @@
+#include "WorkerPool.h"
+
+#include <cassert>
+
+#include "../Profiler.h"
+
+WorkerPool::WorkerPool(uint32_t threadCount)
+    : taskCount(0)
+    , nextTask(0)
+    , finishedTasks(0)
+    , stop(false)
+{
+    assert(threadCount > 0);
+    for(uint32_t i = 0; i < threadCount; ++i)
+        threads.emplace_back([this, i]() { workerLoop(i); });
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard lock(mutex);
+        stop = true;
+    }
+    workAvailable.notify_all();
+
+    for(auto& thread : threads)
+        thread.join();
+}
+
+void WorkerPool::workerLoop(uint32_t workerIndex)
+{
+    PROFILE_THREAD_NAME("Worker");
+    std::unique_lock lock(mutex);
+    while(true)
+    {
+        workAvailable.wait(lock, [&]() { return stop || nextTask < taskCount; });
+        if(stop)
+            return;
+
+        uint32_t taskIndex = nextTask++;
+        lock.unlock();
+        {
+            PROFILE_ZONE("Worker task");
+            task(taskIndex, workerIndex);
+        }
+        lock.lock();
+
+        if(++finishedTasks == taskCount)
+            workDone.notify_one();
+    }
+}
+
+uint32_t WorkerPool::GetWorkerCount() const
+{
+    return (uint32_t)threads.size();
+}
+
+void WorkerPool::Run(uint32_t taskCount, const std::function<void(uint32_t, uint32_t)>& task)
+{
+    if(taskCount == 0)
+        return;
+
+    std::unique_lock lock(mutex);
+    this->task = task;
+    this->taskCount = taskCount;
+    this->nextTask = 0;
+    this->finishedTasks = 0;
+    workAvailable.notify_all();
+
+    workDone.wait(lock, [&]() { return finishedTasks == this->taskCount; });
+    this->taskCount = 0;
+    this->nextTask = 0;
+}
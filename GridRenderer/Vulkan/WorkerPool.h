@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads that execute parallel-for style jobs. Every thread has a stable index which
+// lets callers keep per-thread resources such as command pools without any locking
+class WorkerPool
+{
+  private:
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable workDone;
+
+    std::function<void(uint32_t, uint32_t)> task;
+    uint32_t taskCount;
+    uint32_t nextTask;
+    uint32_t finishedTasks;
+    bool stop;
+
+    void workerLoop(uint32_t workerIndex);
+
+  public:
+    WorkerPool(uint32_t threadCount);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool& other) = delete;
+    WorkerPool& operator=(const WorkerPool& other) = delete;
+    WorkerPool(WorkerPool&& other) = delete;
+    WorkerPool& operator=(WorkerPool&& other) = delete;
+
+    uint32_t GetWorkerCount() const;
+
+    // Calls task(taskIndex, workerIndex) for every taskIndex in [0, taskCount) and returns once all
+    // of them have finished. Must not be called from inside a task
+    void Run(uint32_t taskCount, const std::function<void(uint32_t, uint32_t)>& task);
+};
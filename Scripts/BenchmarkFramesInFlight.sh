@@ -0,0 +1,47 @@
+#!/usr/bin/env bash
+# Runs the benchmark mode once with each number of frames in flight and prints the results next to
+# each other. One frame in flight has the lowest latency, more let the CPU record while the GPU
+# renders, which should show up as a lower frame time when both sides have work to do.
+#
+# Usage: Scripts/BenchmarkFramesInFlight.sh [renderer options...]
+# e.g.   Scripts/BenchmarkFramesInFlight.sh --grid-dimension 20 --present-mode immediate
+#
+# Environment: RENDERER (executable), FRAMES_IN_FLIGHT (space separated), OUTPUT_DIR (one JSON
+# per setting plus frames_in_flight.csv)
+
+set -euo pipefail
+
+ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+RENDERER="${RENDERER:-$ROOT_DIR/bin/vulkan/GridRenderer}"
+FRAMES_IN_FLIGHT="${FRAMES_IN_FLIGHT:-1 3}"
+OUTPUT_DIR="${OUTPUT_DIR:-$ROOT_DIR/bin/frames_in_flight}"
+
+mkdir -p "$OUTPUT_DIR"
+CSV="$OUTPUT_DIR/frames_in_flight.csv"
+echo "framesInFlight,frameP50Ms,frameP95Ms,recordP50Ms,gpuP50Ms" > "$CSV"
+
+# Only understands the flat JSON written by WriteBenchmarkJson
+json_value() {
+    local file="$1" object="$2" key="$3"
+    grep -o "\"$object\": {[^}]*}" "$file" | grep -o "\"$key\": [0-9.e+-]*" | head -n 1 \
+        | sed 's/.*: //'
+}
+
+for frames in $FRAMES_IN_FLIGHT; do
+    json="$OUTPUT_DIR/frames_in_flight_$frames.json"
+    # Windowed runs by default, since the swapchain is part of what the setting changes
+    "$RENDERER" --benchmark --frames-in-flight "$frames" --benchmark-json "$json" "$@" \
+        > /dev/null
+    frameP50=$(json_value "$json" frameTime p50)
+    frameP95=$(json_value "$json" frameTime p95)
+    recordP50=$(json_value "$json" cpuRecordTime p50)
+    gpuP50=$(json_value "$json" gpuTime p50)
+    echo "$frames,$frameP50,$frameP95,$recordP50,$gpuP50" >> "$CSV"
+done
+
+awk -F, '
+NR == 1 { next }
+{
+    printf "%d in flight: frame p50 %8.3f ms, p95 %8.3f ms, ", $1, $2, $3
+    printf "record p50 %8.3f ms, GPU p50 %8.3f ms\n", $4, $5
+}' "$CSV"
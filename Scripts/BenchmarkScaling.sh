@@ -0,0 +1,77 @@
+#!/usr/bin/env bash
+# Runs the benchmark mode headless at several grid dimensions and reports how the CPU record time
+# grows with the object count. The record time is measured inside the Vulkan renderer and leaves
+# out waiting for the GPU and presenting, see RendererVulkan::GetCpuRecordTime. Recording should be
+# linear, so the time each extra object adds has to stay roughly the same from one dimension to the
+# next. Exits nonzero when the last step costs more than TOLERANCE times as much per object as the
+# first one, or when the first step costs nothing, which means nothing was measured.
+#
+# Usage: Scripts/BenchmarkScaling.sh [renderer options...]
+# e.g.   Scripts/BenchmarkScaling.sh --frames-in-flight 3 --no-frustum-culling
+#
+# Environment: RENDERER (executable), DIMENSIONS (ascending, space separated), TOLERANCE,
+# OUTPUT_DIR (one JSON per dimension plus scaling.csv)
+
+set -euo pipefail
+
+ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+RENDERER="${RENDERER:-$ROOT_DIR/bin/vulkan/GridRenderer}"
+DIMENSIONS="${DIMENSIONS:-5 10 15 20 25}"
+TOLERANCE="${TOLERANCE:-1.5}"
+OUTPUT_DIR="${OUTPUT_DIR:-$ROOT_DIR/bin/scaling}"
+
+mkdir -p "$OUTPUT_DIR"
+CSV="$OUTPUT_DIR/scaling.csv"
+echo "gridDimension,objectCount,recordP50Ms,recordMeanMs,microsecondsPerObject" > "$CSV"
+
+# Only understands the flat JSON written by WriteBenchmarkJson
+json_value() {
+    local file="$1" object="$2" key="$3"
+    grep -o "\"$object\": {[^}]*}" "$file" | grep -o "\"$key\": [0-9.e+-]*" | head -n 1 \
+        | sed 's/.*: //'
+}
+
+for dimension in $DIMENSIONS; do
+    json="$OUTPUT_DIR/dimension_$dimension.json"
+    # The default orbit circles each grid at its own size, so every run sees its whole grid
+    "$RENDERER" --headless --benchmark --grid-dimension "$dimension" --benchmark-json "$json" \
+        "$@" > /dev/null
+    objects=$(grep -o '"objectCount": "[0-9]*"' "$json" | grep -o '[0-9]*')
+    p50=$(json_value "$json" cpuRecordTime p50)
+    mean=$(json_value "$json" cpuRecordTime mean)
+    perObject=$(awk -v t="$p50" -v n="$objects" 'BEGIN { printf "%.4f", t * 1000 / n }')
+    echo "$dimension,$objects,$p50,$mean,$perObject" >> "$CSV"
+done
+
+# Marginal cost between consecutive dimensions, which leaves out the per frame constant
+awk -F, -v tolerance="$TOLERANCE" '
+NR == 1 { next }
+{
+    printf "dimension %4d: %8d objects, record p50 %9.3f ms, %7.3f us per object\n", \
+        $1, $2, $3, $5
+    if (previousObjects != "" && $2 > previousObjects) {
+        marginal = ($3 - previousTime) * 1000 / ($2 - previousObjects)
+        if (firstMarginal == "")
+            firstMarginal = marginal
+        lastMarginal = marginal
+    }
+    previousObjects = $2
+    previousTime = $3
+}
+END {
+    if (firstMarginal == "") {
+        print "Need at least two dimensions with different object counts"
+        exit 1
+    }
+    printf "Marginal cost %.3f us per object at first, %.3f us at last\n", \
+        firstMarginal, lastMarginal
+    if (firstMarginal <= 0) {
+        print "Recording did not get slower with more objects, so the check proves nothing"
+        exit 1
+    }
+    if (lastMarginal > firstMarginal * tolerance) {
+        print "Recording grows faster than linearly"
+        exit 1
+    }
+    print "Recording grows linearly"
+}' "$CSV"